@@ -0,0 +1,299 @@
+/*-*- Mode: C; c-basic-offset: 8; indent-tabs-mode: nil -*-*/
+
+/*
+ * busactd
+ *
+ * Copyright (c) 2016 Samsung Electronics Co., Ltd.
+ *
+ * Licensed under the Apache License, Version 2.0 (the License);
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+/*
+ * Registry and parser microbenchmark. Runs the data structure
+ * operations of busactd without a bus and reports ns/op and
+ * allocations/op per registry size as JSON lines.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <assert.h>
+#include <getopt.h>
+#include <time.h>
+
+#include <glib.h>
+#include <gio/gio.h>
+
+#include <libsystem/libsystem.h>
+
+#include "busactd/busactd.h"
+
+#define BENCH_RULE      "sender='org.tizen.busactd.bench.sender' path='/Org/Tizen/BusActD/Bench' " \
+                        "interface=\"org.tizen.busactd.bench\" member=\"Trigger\" arg='on'"
+
+static const unsigned int bench_sizes[] = { 10, 100, 1000, 10000, 100000 };
+
+static struct {
+        unsigned int iterations;
+        unsigned int max_size;
+        const char *output;
+} arg = {
+        .iterations     = 1000,
+        .max_size       = 100000,
+        .output         = NULL,
+};
+
+/* Count heap allocations made while an operation is timed by
+ * interposing the glibc allocator. */
+#ifdef __GLIBC__
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+
+static bool bench_counting;
+static unsigned long bench_allocs;
+
+void *malloc(size_t size) {
+        if (bench_counting)
+                bench_allocs++;
+        return __libc_malloc(size);
+}
+
+void *calloc(size_t nmemb, size_t size) {
+        if (bench_counting)
+                bench_allocs++;
+        return __libc_calloc(nmemb, size);
+}
+
+void *realloc(void *ptr, size_t size) {
+        if (bench_counting)
+                bench_allocs++;
+        return __libc_realloc(ptr, size);
+}
+#else
+static bool bench_counting;
+static unsigned long bench_allocs;
+#endif
+
+struct bench_timer {
+        struct timespec start;
+        unsigned long allocs;
+};
+
+static void bench_timer_start(struct bench_timer *timer) {
+        bench_allocs = 0;
+        bench_counting = true;
+        clock_gettime(CLOCK_MONOTONIC, &timer->start);
+}
+
+static double bench_timer_stop(struct bench_timer *timer) {
+        struct timespec end;
+
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        bench_counting = false;
+        timer->allocs = bench_allocs;
+
+        return (end.tv_sec - timer->start.tv_sec) * 1e9 + (end.tv_nsec - timer->start.tv_nsec);
+}
+
+static void bench_report(FILE *f, const char *op, unsigned int size, unsigned int n, double ns, unsigned long allocs) {
+        fprintf(f,
+                "{\"op\":\"%s\",\"size\":%u,\"iterations\":%u,\"ns_per_op\":%.1f,\"allocs_per_op\":%.2f}\n",
+                op, size, n, ns / n, (double) allocs / n);
+}
+
+static struct busactd_match *bench_add(struct busactd *busactd, const char *prefix, unsigned int i, unsigned int *id) {
+        char busname[64];
+        struct busactd_listener *listener;
+        struct busactd_match *match;
+
+        snprintf(busname, sizeof(busname), "org.tizen.busactd.bench.%s%u", prefix, i);
+
+        listener = busactd_listener_get(busactd, busname);
+        if (!listener || busactd_match_new_from_string(listener, BENCH_RULE, &match, NULL) < 0) {
+                fprintf(stderr, "Failed to allocate\n");
+                exit(EXIT_FAILURE);
+        }
+
+        match->type = BUSACTD_MATCH_TYPE_RUNTIME;
+        match = busactd_add_match(match, NULL);
+        /* registered matches only, nothing is subscribed without a bus */
+        match->m_id = ++*id;
+
+        return match;
+}
+
+static void bench_size(FILE *f, unsigned int size) {
+        struct busactd_dbus bus = {};
+        struct busactd busactd = { .type = BUSACTD_TYPE_USER, .bus = &bus };
+        struct busactd_match **added;
+        struct bench_timer timer;
+        unsigned int i, n, id = 0;
+        char busname[64];
+        double ns;
+
+        for (i = 0; i < size; i++)
+                (void) bench_add(&busactd, "l", i, &id);
+
+        n = arg.iterations;
+        added = new0(struct busactd_match *, n);
+        if (!added) {
+                fprintf(stderr, "Failed to allocate\n");
+                exit(EXIT_FAILURE);
+        }
+
+        /* busactd_listener_get() on existing listeners */
+        bench_timer_start(&timer);
+        for (i = 0; i < n; i++) {
+                struct busactd_listener *listener;
+
+                snprintf(busname, sizeof(busname), "org.tizen.busactd.bench.l%u", (i * 7919) % size);
+                listener = busactd_listener_get(&busactd, busname);
+                listener->ref_count--;
+        }
+        ns = bench_timer_stop(&timer);
+        bench_report(f, "busactd_listener_get", size, n, ns, timer.allocs);
+
+        /* busactd_match_new_from_string() */
+        bench_timer_start(&timer);
+        for (i = 0; i < n; i++) {
+                struct busactd_match *match;
+
+                if (busactd_match_new_from_string(busactd.listener_list->data, BENCH_RULE, &match, NULL) < 0)
+                        exit(EXIT_FAILURE);
+                busactd_match_free(match);
+        }
+        ns = bench_timer_stop(&timer);
+        bench_report(f, "busactd_match_new_from_string", size, n, ns, timer.allocs);
+
+        /* busactd_add_match() of new listeners, the matches are parsed
+         * up front so only the insertion is timed. */
+        for (i = 0; i < n; i++) {
+                struct busactd_listener *listener;
+
+                snprintf(busname, sizeof(busname), "org.tizen.busactd.bench.n%u", i);
+                listener = busactd_listener_get(&busactd, busname);
+                if (!listener || busactd_match_new_from_string(listener, BENCH_RULE, &added[i], NULL) < 0)
+                        exit(EXIT_FAILURE);
+                added[i]->type = BUSACTD_MATCH_TYPE_RUNTIME;
+        }
+
+        bench_timer_start(&timer);
+        for (i = 0; i < n; i++)
+                added[i] = busactd_add_match(added[i], NULL);
+        ns = bench_timer_stop(&timer);
+        bench_report(f, "busactd_add_match", size, n, ns, timer.allocs);
+
+        for (i = 0; i < n; i++)
+                added[i]->m_id = ++id;
+
+        /* busactd_find_match_by_id() spread over the whole registry */
+        bench_timer_start(&timer);
+        for (i = 0; i < n; i++)
+                if (!busactd_find_match_by_id(&busactd, 1 + (i * 7919) % id))
+                        exit(EXIT_FAILURE);
+        ns = bench_timer_stop(&timer);
+        bench_report(f, "busactd_find_match_by_id", size, n, ns, timer.allocs);
+
+        /* busactd_remove_match() of the matches added above */
+        bench_timer_start(&timer);
+        for (i = 0; i < n; i++)
+                busactd_remove_match(added[i]);
+        ns = bench_timer_stop(&timer);
+        bench_report(f, "busactd_remove_match", size, n, ns, timer.allocs);
+
+        free(added);
+        g_list_free_full(busactd.listener_list, (GDestroyNotify) busactd_listener_free);
+}
+
+static void bench_show_help(void) {
+        printf("Usage: bench-busactd-registry [OPTIONS...]\n");
+        printf("       -i  --iterations=N    operations timed per size (%u)\n", arg.iterations);
+        printf("       -s  --max-size=N      largest registry size (%u)\n", arg.max_size);
+        printf("       -o  --output=FILE     write JSON lines to FILE instead of stdout\n");
+        printf("       -h  --help            show this help\n");
+}
+
+static int parse_argv(int argc, char *argv[]) {
+        static const struct option options[] = {
+                { "iterations", required_argument, NULL, 'i'    },
+                { "max-size",   required_argument, NULL, 's'    },
+                { "output",     required_argument, NULL, 'o'    },
+                { "help",       no_argument,       NULL, 'h'    },
+                { NULL,         0,                 NULL, 0      }
+        };
+
+        int c;
+
+        while ((c = getopt_long(argc, argv, "i:s:o:h", options, NULL)) >= 0) {
+
+                switch (c) {
+
+                case 'i':
+                        arg.iterations = strtoul(optarg, NULL, 10);
+                        break;
+
+                case 's':
+                        arg.max_size = strtoul(optarg, NULL, 10);
+                        break;
+
+                case 'o':
+                        arg.output = optarg;
+                        break;
+
+                case 'h':
+                        bench_show_help();
+                        exit(EXIT_SUCCESS);
+
+                default:
+                        bench_show_help();
+                        return -EINVAL;
+                }
+        }
+
+        if (!arg.iterations) {
+                fprintf(stderr, "Iterations have to be none 0.\n");
+                return -EINVAL;
+        }
+
+        return 0;
+}
+
+int main(int argc, char *argv[]) {
+        _cleanup_fclose_ FILE *output = NULL;
+        FILE *f = stdout;
+        unsigned int i;
+
+        if (parse_argv(argc, argv) < 0)
+                return EXIT_FAILURE;
+
+        if (arg.output) {
+                output = fopen(arg.output, "we");
+                if (!output) {
+                        fprintf(stderr, "Failed to open %s: %m\n", arg.output);
+                        return EXIT_FAILURE;
+                }
+                f = output;
+        }
+
+        for (i = 0; i < G_N_ELEMENTS(bench_sizes); i++) {
+                if (bench_sizes[i] > arg.max_size)
+                        break;
+
+                bench_size(f, bench_sizes[i]);
+        }
+
+        return EXIT_SUCCESS;
+}
@@ -0,0 +1,611 @@
+/*-*- Mode: C; c-basic-offset: 8; indent-tabs-mode: nil -*-*/
+
+/*
+ * busactd
+ *
+ * Copyright (c) 2016 Samsung Electronics Co., Ltd.
+ *
+ * Licensed under the Apache License, Version 2.0 (the License);
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+
+/*
+ * Replay benchmark: feeds a trace of trigger signals, as written by
+ * "busactd --capture" or "dbus-monitor --pcap", into a private
+ * dbus-daemon with busactd loading the given listener configs. The
+ * signals are sent at their recorded pace, scaled by --speed, or as
+ * fast as possible. Reports what busactd forwarded, how fast and at
+ * which cost.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <assert.h>
+#include <getopt.h>
+
+#include <glib.h>
+#include <gio/gio.h>
+
+#include <libsystem/libsystem.h>
+
+#include "busactd/capture.h"
+#include "bench-util.h"
+
+#ifndef BUSACTD_PATH
+#define BUSACTD_PATH "/usr/lib/busactd/busactd"
+#endif
+
+/* LoadedPhases lists them all once busactd is loaded */
+#define BENCH_LOAD_PHASES       3
+
+/* Drained once the forwards did not change for this long */
+#define BENCH_DRAIN_STABLE_USEC (250 * 1000)
+#define BENCH_DRAIN_POLL_USEC   (20 * 1000)
+
+static struct {
+        const char *config_dir;
+        double speed;
+        const char *busactd;
+        const char *trace;
+} arg = {
+        .config_dir     = NULL,
+        .speed          = 1.0,
+        .busactd        = BUSACTD_PATH,
+        .trace          = NULL,
+};
+
+/* Records of the trace, pointing into the mapped file */
+struct bench_trace {
+        GMappedFile *file;
+        const char *data;
+        gsize size;
+        gsize offset;
+        bool swapped;
+};
+
+/* Latency of a forwarded signal is taken from when the same signal
+ * went out of the replaying connection, as both are seen on the bus.
+ * busactd forwards to each listener in order, so the n-th forward of a
+ * signal to one destination belongs to the n-th time it was sent. */
+struct bench_replay_monitor {
+        GDBusConnection *connection;
+        GMutex lock;
+        char *replayer;
+        char *busactd;
+        /* signal key, see bench_signal_key(), to a GArray of the
+         * monotonic times it was seen going out */
+        GHashTable *sent;
+        /* "key destination" to the index into 'sent' of the next one
+         * forwarded to the destination */
+        GHashTable *next;
+        GArray *latencies;
+        guint64 triggers;
+        guint64 forwarded;
+        /* monotonic time the last forwarded signal was seen */
+        gint64 last_forward;
+};
+
+static void bench_show_help(void) {
+        printf("Usage: bench-busactd-replay [OPTIONS...] TRACE\n");
+        printf("       -c  --config-dir=DIR  listener configs busactd loads\n");
+        printf("       -s  --speed=X         replay X times as fast as recorded,\n");
+        printf("                             0 as fast as possible (%.1f)\n", arg.speed);
+        printf("       -b  --busactd=PATH    busactd binary (%s)\n", arg.busactd);
+        printf("       -h  --help            show this help\n");
+}
+
+static int parse_argv(int argc, char *argv[]) {
+        static const struct option options[] = {
+                { "config-dir", required_argument, NULL, 'c'    },
+                { "speed",      required_argument, NULL, 's'    },
+                { "busactd",    required_argument, NULL, 'b'    },
+                { "help",       no_argument,       NULL, 'h'    },
+                { NULL,         0,                 NULL, 0      }
+        };
+
+        int c;
+
+        while ((c = getopt_long(argc, argv, "c:s:b:h", options, NULL)) >= 0) {
+
+                switch (c) {
+
+                case 'c':
+                        arg.config_dir = optarg;
+                        break;
+
+                case 's':
+                        arg.speed = strtod(optarg, NULL);
+                        break;
+
+                case 'b':
+                        arg.busactd = optarg;
+                        break;
+
+                case 'h':
+                        bench_show_help();
+                        exit(EXIT_SUCCESS);
+
+                default:
+                        bench_show_help();
+                        return -EINVAL;
+                }
+        }
+
+        if (optind != argc - 1 || !arg.config_dir || arg.speed < 0) {
+                bench_show_help();
+                return -EINVAL;
+        }
+
+        arg.trace = argv[optind];
+
+        return 0;
+}
+
+static guint32 bench_trace_u32(struct bench_trace *trace, guint32 v) {
+        return trace->swapped ? GUINT32_SWAP_LE_BE(v) : v;
+}
+
+static int bench_trace_open(struct bench_trace *trace, const char *path) {
+        g_autoptr(GError) error = NULL;
+        struct busactd_capture_header header;
+
+        assert(trace);
+        assert(path);
+
+        trace->file = g_mapped_file_new(path, FALSE, &error);
+        if (!trace->file) {
+                fprintf(stderr, "Failed to open %s: %s\n", path, error->message);
+                return -ENOENT;
+        }
+
+        trace->data = g_mapped_file_get_contents(trace->file);
+        trace->size = g_mapped_file_get_length(trace->file);
+        if (trace->size < sizeof(header))
+                goto invalid;
+
+        memcpy(&header, trace->data, sizeof(header));
+        if (header.magic == BUSACTD_CAPTURE_MAGIC_SWAPPED)
+                trace->swapped = true;
+        else if (header.magic != BUSACTD_CAPTURE_MAGIC)
+                goto invalid;
+
+        if (bench_trace_u32(trace, header.linktype) != BUSACTD_CAPTURE_LINKTYPE)
+                goto invalid;
+
+        trace->offset = sizeof(header);
+
+        return 0;
+
+invalid:
+        fprintf(stderr, "%s is not a pcap trace of D-Bus messages\n", path);
+        return -EINVAL;
+}
+
+/* Returns the next message and its capture time in usec, NULL at the end */
+static const char *bench_trace_next(struct bench_trace *trace, gsize *size, gint64 *time) {
+        struct busactd_capture_record record;
+        const char *data;
+
+        if (trace->size - trace->offset < sizeof(record))
+                return NULL;
+
+        memcpy(&record, trace->data + trace->offset, sizeof(record));
+        record.incl_len = bench_trace_u32(trace, record.incl_len);
+        if (trace->size - trace->offset - sizeof(record) < record.incl_len)
+                return NULL;
+
+        data = trace->data + trace->offset + sizeof(record);
+        trace->offset += sizeof(record) + record.incl_len;
+
+        *size = record.incl_len;
+        *time = (gint64) bench_trace_u32(trace, record.ts_sec) * G_USEC_PER_SEC +
+                bench_trace_u32(trace, record.ts_usec);
+
+        return data;
+}
+
+/* Signals with an equal body are told apart by order only, which a
+ * listener filtering on the body cannot mix up. */
+static char *bench_signal_key(GDBusMessage *message) {
+        GVariant *body = g_dbus_message_get_body(message);
+        guint hash = 0;
+
+        if (body) {
+                g_autoptr(GBytes) bytes = g_variant_get_data_as_bytes(body);
+
+                hash = g_bytes_hash(bytes);
+        }
+
+        return g_strdup_printf("%s %s %s %08x",
+                               g_dbus_message_get_path(message),
+                               g_dbus_message_get_interface(message),
+                               g_dbus_message_get_member(message),
+                               hash);
+}
+
+static GDBusMessage *bench_replay_monitor_filter(GDBusConnection *connection,
+                                                 GDBusMessage *message,
+                                                 gboolean incoming,
+                                                 gpointer user_data) {
+
+        struct bench_replay_monitor *monitor = user_data;
+        const char *sender, *destination;
+        gint64 now;
+        GArray *sent;
+        char *key;
+
+        if (!incoming || g_dbus_message_get_message_type(message) != G_DBUS_MESSAGE_TYPE_SIGNAL)
+                goto finish;
+
+        now = g_get_monotonic_time();
+        sender = g_dbus_message_get_sender(message);
+        destination = g_dbus_message_get_destination(message);
+
+        g_mutex_lock(&monitor->lock);
+
+        if (!destination && streq_ptr(sender, monitor->replayer)) {
+                key = bench_signal_key(message);
+                sent = g_hash_table_lookup(monitor->sent, key);
+                if (!sent) {
+                        sent = g_array_new(FALSE, FALSE, sizeof(gint64));
+                        g_hash_table_insert(monitor->sent, key, sent);
+                } else
+                        g_free(key);
+
+                g_array_append_val(sent, now);
+                monitor->triggers++;
+        } else if (destination && streq_ptr(sender, monitor->busactd)) {
+                key = bench_signal_key(message);
+                sent = g_hash_table_lookup(monitor->sent, key);
+                if (sent) {
+                        char *next_key = g_strdup_printf("%s %s", key, destination);
+                        guint i = GPOINTER_TO_UINT(g_hash_table_lookup(monitor->next, next_key));
+
+                        if (i < sent->len) {
+                                gint64 latency = now - g_array_index(sent, gint64, i);
+
+                                g_array_append_val(monitor->latencies, latency);
+                        }
+                        g_hash_table_replace(monitor->next, next_key, GUINT_TO_POINTER(i + 1));
+                }
+                monitor->forwarded++;
+                monitor->last_forward = now;
+                g_free(key);
+        }
+
+        g_mutex_unlock(&monitor->lock);
+
+finish:
+        g_object_unref(message);
+        return NULL;
+}
+
+static int bench_replay_monitor_start(struct bench_replay_monitor *monitor,
+                                      struct bench_bus *bus,
+                                      const char *replayer,
+                                      const char *busactd) {
+
+        const char *rules[] = { "type='signal'", NULL };
+        g_autoptr(GError) error = NULL;
+        g_autoptr(GVariant) reply = NULL;
+
+        assert(monitor);
+        assert(bus);
+
+        g_mutex_init(&monitor->lock);
+        monitor->replayer = g_strdup(replayer);
+        monitor->busactd = g_strdup(busactd);
+        monitor->sent = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, (GDestroyNotify) g_array_unref);
+        monitor->next = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+        monitor->latencies = g_array_new(FALSE, FALSE, sizeof(gint64));
+
+        monitor->connection = bench_bus_connect(bus);
+        if (!monitor->connection)
+                return -ECONNREFUSED;
+
+        g_dbus_connection_add_filter(monitor->connection, bench_replay_monitor_filter, monitor, NULL);
+
+        reply = g_dbus_connection_call_sync(monitor->connection,
+                                            "org.freedesktop.DBus",
+                                            "/org/freedesktop/DBus",
+                                            "org.freedesktop.DBus.Monitoring",
+                                            "BecomeMonitor",
+                                            g_variant_new("(^asu)", rules, 0),
+                                            NULL,
+                                            G_DBUS_CALL_FLAGS_NONE,
+                                            -1, NULL, &error);
+        if (!reply) {
+                fprintf(stderr, "Failed to become monitor: %s\n", error->message);
+                return -EPERM;
+        }
+
+        return 0;
+}
+
+static void bench_replay_monitor_stop(struct bench_replay_monitor *monitor) {
+
+        assert(monitor);
+
+        if (!monitor->latencies)
+                return;
+
+        if (monitor->connection) {
+                g_dbus_connection_close_sync(monitor->connection, NULL, NULL);
+                g_object_unref(monitor->connection);
+                monitor->connection = NULL;
+        }
+
+        g_hash_table_destroy(monitor->sent);
+        g_hash_table_destroy(monitor->next);
+        g_array_free(monitor->latencies, TRUE);
+        monitor->latencies = NULL;
+        g_free(monitor->replayer);
+        g_free(monitor->busactd);
+
+        g_mutex_clear(&monitor->lock);
+}
+
+static int bench_busactd_wait_loaded(GDBusConnection *connection, unsigned int timeout_sec) {
+        gint64 deadline;
+
+        assert(connection);
+
+        deadline = g_get_monotonic_time() + (gint64) timeout_sec * G_USEC_PER_SEC;
+
+        while (g_get_monotonic_time() < deadline) {
+                g_autoptr(GVariant) reply = NULL, phases = NULL;
+
+                reply = g_dbus_connection_call_sync(connection,
+                                                    "org.tizen.busactd",
+                                                    "/Org/Tizen/BusActD",
+                                                    "org.freedesktop.DBus.Properties",
+                                                    "Get",
+                                                    g_variant_new("(ss)", "org.tizen.busactd", "LoadedPhases"),
+                                                    G_VARIANT_TYPE("(v)"),
+                                                    G_DBUS_CALL_FLAGS_NO_AUTO_START,
+                                                    -1, NULL, NULL);
+                if (reply) {
+                        g_variant_get(reply, "(v)", &phases);
+                        if (g_variant_n_children(phases) >= BENCH_LOAD_PHASES)
+                                return 0;
+                }
+
+                g_usleep(100 * 1000);
+        }
+
+        fprintf(stderr, "busactd did not get loaded within %u sec\n", timeout_sec);
+
+        return -ETIMEDOUT;
+}
+
+static char *bench_get_name_owner(GDBusConnection *connection, const char *name) {
+        g_autoptr(GVariant) reply = NULL;
+        char *owner = NULL;
+
+        reply = g_dbus_connection_call_sync(connection,
+                                            "org.freedesktop.DBus",
+                                            "/org/freedesktop/DBus",
+                                            "org.freedesktop.DBus",
+                                            "GetNameOwner",
+                                            g_variant_new("(s)", name),
+                                            G_VARIANT_TYPE("(s)"),
+                                            G_DBUS_CALL_FLAGS_NONE,
+                                            -1, NULL, NULL);
+        if (reply)
+                g_variant_get(reply, "(s)", &owner);
+
+        return owner;
+}
+
+/* Waits for busactd to forward what it still has queued, until neither
+ * its SignalsForwarded nor the forwards the monitor saw change any
+ * longer. */
+static int bench_replay_drain(GDBusConnection *connection,
+                              struct bench_replay_monitor *monitor,
+                              unsigned int timeout_sec) {
+
+        guint64 last = G_MAXUINT64;
+        gint64 deadline, stable_since = 0;
+
+        assert(connection);
+        assert(monitor);
+
+        deadline = g_get_monotonic_time() + (gint64) timeout_sec * G_USEC_PER_SEC;
+
+        while (g_get_monotonic_time() < deadline) {
+                g_autoptr(GVariant) statistics = NULL;
+                guint64 forwarded;
+                gint64 now;
+
+                statistics = bench_busactd_statistics(connection);
+
+                g_mutex_lock(&monitor->lock);
+                forwarded = bench_statistic(statistics, "SignalsForwarded") + monitor->forwarded;
+                g_mutex_unlock(&monitor->lock);
+
+                now = g_get_monotonic_time();
+                if (forwarded != last) {
+                        last = forwarded;
+                        stable_since = now;
+                } else if (now - stable_since >= BENCH_DRAIN_STABLE_USEC)
+                        return 0;
+
+                g_usleep(BENCH_DRAIN_POLL_USEC);
+        }
+
+        fprintf(stderr, "busactd did not drain within %u sec\n", timeout_sec);
+
+        return -ETIMEDOUT;
+}
+
+/* Sends the trace, returns the number of signals sent */
+static guint64 bench_replay(struct bench_trace *trace, GDBusConnection *connection, guint64 *skipped) {
+        gint64 start, first = -1, time;
+        guint64 sent = 0;
+        const char *data;
+        gsize size;
+
+        start = g_get_monotonic_time();
+
+        while ((data = bench_trace_next(trace, &size, &time))) {
+                g_autoptr(GDBusMessage) message = NULL;
+
+                message = g_dbus_message_new_from_blob((guchar *) data, size, G_DBUS_CAPABILITY_FLAGS_NONE, NULL);
+                if (!message ||
+                    g_dbus_message_get_message_type(message) != G_DBUS_MESSAGE_TYPE_SIGNAL ||
+                    g_dbus_message_get_destination(message)) {
+                        (*skipped)++;
+                        continue;
+                }
+
+                if (first < 0)
+                        first = time;
+
+                if (arg.speed > 0) {
+                        gint64 due = start + (gint64) ((time - first) / arg.speed);
+                        gint64 now = g_get_monotonic_time();
+
+                        if (due > now)
+                                g_usleep(due - now);
+                }
+
+                g_dbus_message_set_sender(message, NULL);
+
+                if (g_dbus_connection_send_message(connection, message,
+                                                   G_DBUS_SEND_MESSAGE_FLAGS_NONE, NULL, NULL))
+                        sent++;
+                else
+                        (*skipped)++;
+        }
+
+        g_dbus_connection_flush_sync(connection, NULL, NULL);
+
+        return sent;
+}
+
+int main(int argc, char *argv[]) {
+        struct bench_bus bus = {};
+        struct bench_trace trace = {};
+        struct bench_replay_monitor monitor = {};
+        struct bench_proc_stat before = {}, after = {};
+        g_autoptr(GVariant) stats_before = NULL, stats_after = NULL;
+        GDBusConnection *connection = NULL, *replayer = NULL;
+        _cleanup_free_ char *conf_arg = NULL;
+        g_autofree char *owner = NULL;
+        char *busactd_args[2] = {};
+        GPid busactd_pid = 0;
+        guint64 sent, skipped = 0;
+        gint64 start, elapsed;
+        int r;
+
+        r = parse_argv(argc, argv);
+        if (r < 0)
+                return EXIT_FAILURE;
+
+        r = bench_trace_open(&trace, arg.trace);
+        if (r < 0)
+                goto finish;
+
+        r = bench_bus_start(&bus);
+        if (r < 0)
+                goto finish;
+
+        if (asprintf(&conf_arg, "--config-dir=%s", arg.config_dir) < 0) {
+                r = -ENOMEM;
+                goto finish;
+        }
+
+        busactd_args[0] = conf_arg;
+
+        r = bench_busactd_start(&bus, arg.busactd, busactd_args, &busactd_pid);
+        if (r < 0)
+                goto finish;
+
+        connection = bench_bus_connect(&bus);
+        replayer = bench_bus_connect(&bus);
+        if (!connection || !replayer) {
+                r = -ECONNREFUSED;
+                goto finish;
+        }
+
+        r = bench_busactd_wait_loaded(connection, 120);
+        if (r < 0)
+                goto finish;
+
+        owner = bench_get_name_owner(connection, "org.tizen.busactd");
+        r = bench_replay_monitor_start(&monitor, &bus,
+                                       g_dbus_connection_get_unique_name(replayer), owner);
+        if (r < 0)
+                goto finish;
+
+        (void) bench_proc_stat(busactd_pid, &before);
+        stats_before = bench_busactd_statistics(connection);
+
+        start = g_get_monotonic_time();
+        sent = bench_replay(&trace, replayer, &skipped);
+
+        r = bench_replay_drain(connection, &monitor, 60);
+        if (r < 0)
+                goto finish;
+
+        (void) bench_proc_stat(busactd_pid, &after);
+        stats_after = bench_busactd_statistics(connection);
+
+        g_mutex_lock(&monitor.lock);
+
+        /* the clock stops at the last forward, not at the end of the
+         * wait telling there is none left */
+        if (monitor.last_forward > start)
+                elapsed = monitor.last_forward - start;
+        else
+                elapsed = g_get_monotonic_time() - start;
+
+        printf("trace:                  %s\n", arg.trace);
+        if (arg.speed > 0)
+                printf("speed:                  %.1fx\n", arg.speed);
+        else
+                printf("speed:                  max\n");
+        printf("signals sent:           %" G_GUINT64_FORMAT "\n", sent);
+        printf("records skipped:        %" G_GUINT64_FORMAT "\n", skipped);
+        printf("triggers seen:          %" G_GUINT64_FORMAT "\n", monitor.triggers);
+        printf("signals forwarded:      %" G_GUINT64_FORMAT "\n", monitor.forwarded);
+        printf("forwarded/sec:          %.1f\n", (double) monitor.forwarded * G_USEC_PER_SEC / elapsed);
+        printf("latency p50 (usec):     %" G_GINT64_FORMAT "\n", bench_percentile(monitor.latencies, 50));
+        printf("latency p99 (usec):     %" G_GINT64_FORMAT "\n", bench_percentile(monitor.latencies, 99));
+        printf("busactd cpu (%%):        %.1f\n", (after.cpu_sec - before.cpu_sec) * 100.0 * G_USEC_PER_SEC / elapsed);
+        printf("busactd rss (kB):       %ld\n", after.rss_kb);
+        printf("busactd rss peak (kB):  %ld\n", after.hwm_kb);
+        printf("filters dropped:        %" G_GUINT64_FORMAT "\n",
+               bench_statistic(stats_after, "FilterDropped") - bench_statistic(stats_before, "FilterDropped"));
+        printf("forward failed:         %" G_GUINT64_FORMAT "\n",
+               bench_statistic(stats_after, "SignalsForwardFailed") - bench_statistic(stats_before, "SignalsForwardFailed"));
+
+        g_mutex_unlock(&monitor.lock);
+
+finish:
+        bench_replay_monitor_stop(&monitor);
+        if (replayer)
+                g_object_unref(replayer);
+        if (connection)
+                g_object_unref(connection);
+        bench_process_stop(busactd_pid);
+        bench_bus_stop(&bus);
+        if (trace.file)
+                g_mapped_file_unref(trace.file);
+
+        return r < 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,267 @@
+/*-*- Mode: C; c-basic-offset: 8; indent-tabs-mode: nil -*-*/
+
+/*
+ * busactd
+ *
+ * Copyright (c) 2016 Samsung Electronics Co., Ltd.
+ *
+ * Licensed under the Apache License, Version 2.0 (the License);
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+
+/*
+ * Startup benchmark: for each requested config set size, starts a
+ * private dbus-daemon, generates that many listener configs and lets
+ * busactd load them with --startup-report. The per-phase breakdown of
+ * every run is collected into a single JSON array.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <assert.h>
+#include <getopt.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include <glib.h>
+#include <gio/gio.h>
+
+#include <libsystem/libsystem.h>
+
+#include "bench-util.h"
+
+#ifndef BUSACTD_PATH
+#define BUSACTD_PATH "/usr/lib/busactd/busactd"
+#endif
+
+static struct {
+        const char *sizes;
+        unsigned int rules;
+        unsigned int iterations;
+        const char *busactd;
+        const char *output;
+} arg = {
+        .sizes          = "1000,10000,50000",
+        .rules          = 1,
+        .iterations     = 1,
+        .busactd        = BUSACTD_PATH,
+        .output         = NULL,
+};
+
+static void bench_show_help(void) {
+        printf("Usage: bench-busactd-startup [OPTIONS...]\n");
+        printf("       -s  --sizes=N[,N...]  numbers of listener configs (%s)\n", arg.sizes);
+        printf("       -m  --rules=M         rules per listener (%u)\n", arg.rules);
+        printf("       -i  --iterations=I    runs per size (%u)\n", arg.iterations);
+        printf("       -b  --busactd=PATH    busactd binary (%s)\n", arg.busactd);
+        printf("       -o  --output=FILE     write the JSON report to FILE\n");
+        printf("       -h  --help            show this help\n");
+}
+
+static int parse_argv(int argc, char *argv[]) {
+        static const struct option options[] = {
+                { "sizes",      required_argument, NULL, 's'    },
+                { "rules",      required_argument, NULL, 'm'    },
+                { "iterations", required_argument, NULL, 'i'    },
+                { "busactd",    required_argument, NULL, 'b'    },
+                { "output",     required_argument, NULL, 'o'    },
+                { "help",       no_argument,       NULL, 'h'    },
+                { NULL,         0,                 NULL, 0      }
+        };
+
+        int c;
+
+        while ((c = getopt_long(argc, argv, "s:m:i:b:o:h", options, NULL)) >= 0) {
+
+                switch (c) {
+
+                case 's':
+                        arg.sizes = optarg;
+                        break;
+
+                case 'm':
+                        arg.rules = strtoul(optarg, NULL, 10);
+                        break;
+
+                case 'i':
+                        arg.iterations = strtoul(optarg, NULL, 10);
+                        break;
+
+                case 'b':
+                        arg.busactd = optarg;
+                        break;
+
+                case 'o':
+                        arg.output = optarg;
+                        break;
+
+                case 'h':
+                        bench_show_help();
+                        exit(EXIT_SUCCESS);
+
+                default:
+                        bench_show_help();
+                        return -EINVAL;
+                }
+        }
+
+        if (!arg.rules || !arg.iterations) {
+                fprintf(stderr, "All counts have to be none 0.\n");
+                return -EINVAL;
+        }
+
+        return 0;
+}
+
+static int bench_generate(struct bench_bus *bus, unsigned int listeners) {
+        _cleanup_free_ char *conf_dir = NULL;
+        GString *content;
+        unsigned int l, m;
+        int r = 0;
+
+        assert(bus);
+
+        if (asprintf(&conf_dir, "%s/conf/user", bus->dir) < 0)
+                return -ENOMEM;
+
+        if (g_mkdir_with_parents(conf_dir, 0755) < 0)
+                return -errno;
+
+        content = g_string_new(NULL);
+
+        for (l = 0; l < listeners; l++) {
+                _cleanup_free_ char *path = NULL;
+
+                if (asprintf(&path, "%s/" BENCH_BUSNAME_PREFIX "l%u.conf", conf_dir, l) < 0) {
+                        r = -ENOMEM;
+                        break;
+                }
+
+                g_string_printf(content, "[BusAct]\nBusName=" BENCH_BUSNAME_PREFIX "l%u\n", l);
+                for (m = 0; m < arg.rules; m++)
+                        g_string_append_printf(content,
+                                               "Subscribe=path=\"" BENCH_PATH "\" "
+                                               "interface=\"" BENCH_INTERFACE ".L%u\" member=\"R%u\"\n",
+                                               l, m);
+
+                r = bench_write_file(path, content->str);
+                if (r < 0)
+                        break;
+        }
+
+        g_string_free(content, TRUE);
+
+        return r;
+}
+
+/* Runs busactd once over a freshly generated set and appends its
+ * startup report to 'out'. */
+static int bench_run(unsigned int listeners, unsigned int iteration, GString *out) {
+        struct bench_bus bus = {};
+        _cleanup_free_ char *conf_arg = NULL, *report_path = NULL, *report_arg = NULL;
+        g_autofree gchar *report = NULL;
+        char *busactd_args[3] = {};
+        GPid pid = 0;
+        int r, status;
+
+        r = bench_bus_start(&bus);
+        if (r < 0)
+                goto finish;
+
+        r = bench_generate(&bus, listeners);
+        if (r < 0)
+                goto finish;
+
+        if (asprintf(&conf_arg, "--config-dir=%s/conf", bus.dir) < 0 ||
+            asprintf(&report_path, "%s/startup.json", bus.dir) < 0 ||
+            asprintf(&report_arg, "--startup-report=%s", report_path) < 0) {
+                r = -ENOMEM;
+                goto finish;
+        }
+
+        busactd_args[0] = conf_arg;
+        busactd_args[1] = report_arg;
+
+        r = bench_busactd_start(&bus, arg.busactd, busactd_args, &pid);
+        if (r < 0)
+                goto finish;
+
+        /* busactd leaves on its own once the report is written */
+        if (waitpid(pid, &status, 0) < 0) {
+                r = -errno;
+                goto finish;
+        }
+        pid = 0;
+
+        if (!g_file_get_contents(report_path, &report, NULL, NULL)) {
+                fprintf(stderr, "busactd did not write a startup report for %u listeners\n", listeners);
+                r = -ENOENT;
+                goto finish;
+        }
+
+        g_string_append_printf(out, "%s  { \"files\": %u, \"iteration\": %u, \"report\": %s  }",
+                               out->len > 2 ? ",\n" : "", listeners, iteration, g_strstrip(report));
+
+        fprintf(stderr, "%u listeners, run %u: done\n", listeners, iteration);
+
+finish:
+        bench_process_stop(pid);
+        bench_bus_stop(&bus);
+
+        return r;
+}
+
+int main(int argc, char *argv[]) {
+        _cleanup_free_ char *sizes = NULL;
+        GString *out;
+        char *size, *saveptr = NULL;
+        unsigned int i;
+        int r;
+
+        r = parse_argv(argc, argv);
+        if (r < 0)
+                return EXIT_FAILURE;
+
+        sizes = strdup(arg.sizes);
+        if (!sizes)
+                return EXIT_FAILURE;
+
+        out = g_string_new("[\n");
+
+        for (size = strtok_r(sizes, ",", &saveptr); size; size = strtok_r(NULL, ",", &saveptr)) {
+                unsigned int listeners = strtoul(size, NULL, 10);
+
+                if (!listeners)
+                        continue;
+
+                for (i = 0; i < arg.iterations; i++) {
+                        r = bench_run(listeners, i, out);
+                        if (r < 0)
+                                goto finish;
+                }
+        }
+
+        g_string_append(out, "\n]\n");
+
+        if (arg.output)
+                r = bench_write_file(arg.output, out->str);
+        else
+                fputs(out->str, stdout);
+
+finish:
+        g_string_free(out, TRUE);
+
+        return r < 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+}
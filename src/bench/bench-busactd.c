@@ -0,0 +1,411 @@
+/*-*- Mode: C; c-basic-offset: 8; indent-tabs-mode: nil -*-*/
+
+/*
+ * busactd
+ *
+ * Copyright (c) 2016 Samsung Electronics Co., Ltd.
+ *
+ * Licensed under the Apache License, Version 2.0 (the License);
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+/*
+ * End-to-end load benchmark: starts a private dbus-daemon, generates
+ * listener configs, runs busactd against them and drives it with
+ * trigger signals from several sender threads.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <assert.h>
+#include <getopt.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include <glib.h>
+#include <gio/gio.h>
+
+#include <libsystem/libsystem.h>
+
+#include "bench-util.h"
+
+#ifndef BUSACTD_PATH
+#define BUSACTD_PATH "/usr/lib/busactd/busactd"
+#endif
+
+static struct {
+        unsigned int listeners;
+        unsigned int rules;
+        unsigned int senders;
+        unsigned int rate;
+        unsigned int duration;
+        bool activate;
+        const char *busactd;
+        const char *stub;
+} arg = {
+        .listeners      = 100,
+        .rules          = 10,
+        .senders        = 4,
+        .rate           = 1000,
+        .duration       = 10,
+        .activate       = false,
+        .busactd        = BUSACTD_PATH,
+        .stub           = NULL,
+};
+
+struct bench_sender {
+        struct bench_bus *bus;
+        unsigned int index;
+        guint64 sent;
+        GThread *thread;
+};
+
+static void bench_show_help(void) {
+        printf("Usage: bench-busactd [OPTIONS...]\n");
+        printf("       -n  --listeners=N     number of listener configs (%u)\n", arg.listeners);
+        printf("       -m  --rules=M         rules per listener (%u)\n", arg.rules);
+        printf("       -k  --senders=K       sender threads (%u)\n", arg.senders);
+        printf("       -r  --rate=R          signals per second per sender (%u)\n", arg.rate);
+        printf("       -d  --duration=SEC    duration of the load phase (%u)\n", arg.duration);
+        printf("       -a  --activate        install stub services claiming the names\n");
+        printf("       -b  --busactd=PATH    busactd binary (%s)\n", arg.busactd);
+        printf("       -h  --help            show this help\n");
+}
+
+static int parse_argv(int argc, char *argv[]) {
+        static const struct option options[] = {
+                { "listeners",  required_argument, NULL, 'n'    },
+                { "rules",      required_argument, NULL, 'm'    },
+                { "senders",    required_argument, NULL, 'k'    },
+                { "rate",       required_argument, NULL, 'r'    },
+                { "duration",   required_argument, NULL, 'd'    },
+                { "activate",   no_argument,       NULL, 'a'    },
+                { "busactd",    required_argument, NULL, 'b'    },
+                { "stub",       required_argument, NULL, 's'    },
+                { "help",       no_argument,       NULL, 'h'    },
+                { NULL,         0,                 NULL, 0      }
+        };
+
+        int c;
+
+        while ((c = getopt_long(argc, argv, "n:m:k:r:d:ab:s:h", options, NULL)) >= 0) {
+
+                switch (c) {
+
+                case 'n':
+                        arg.listeners = strtoul(optarg, NULL, 10);
+                        break;
+
+                case 'm':
+                        arg.rules = strtoul(optarg, NULL, 10);
+                        break;
+
+                case 'k':
+                        arg.senders = strtoul(optarg, NULL, 10);
+                        break;
+
+                case 'r':
+                        arg.rate = strtoul(optarg, NULL, 10);
+                        break;
+
+                case 'd':
+                        arg.duration = strtoul(optarg, NULL, 10);
+                        break;
+
+                case 'a':
+                        arg.activate = true;
+                        break;
+
+                case 'b':
+                        arg.busactd = optarg;
+                        break;
+
+                case 's':
+                        arg.stub = optarg;
+                        break;
+
+                case 'h':
+                        bench_show_help();
+                        exit(EXIT_SUCCESS);
+
+                default:
+                        bench_show_help();
+                        return -EINVAL;
+                }
+        }
+
+        if (!arg.listeners || !arg.rules || !arg.senders || !arg.rate || !arg.duration) {
+                fprintf(stderr, "All counts have to be none 0.\n");
+                return -EINVAL;
+        }
+
+        return 0;
+}
+
+/* Activated by the private bus on behalf of a forwarded trigger: claim
+ * the name, wait for the trigger and go away again so the listener is
+ * armed for the next round. */
+static void bench_stub_signal_callback(GDBusConnection *connection,
+                                       const gchar *sender_name,
+                                       const gchar *object_path,
+                                       const gchar *interface_name,
+                                       const gchar *signal_name,
+                                       GVariant *parameters,
+                                       gpointer user_data) {
+
+        g_main_loop_quit(user_data);
+}
+
+static gboolean bench_stub_timeout(gpointer user_data) {
+
+        g_main_loop_quit(user_data);
+
+        return G_SOURCE_REMOVE;
+}
+
+static int bench_run_stub(const char *name) {
+        g_autoptr(GError) error = NULL;
+        GDBusConnection *connection;
+        GMainLoop *loop;
+
+        connection = g_bus_get_sync(G_BUS_TYPE_STARTER, NULL, &error);
+        if (!connection) {
+                fprintf(stderr, "Failed to connect to starter bus: %s\n", error->message);
+                return -ECONNREFUSED;
+        }
+
+        loop = g_main_loop_new(NULL, FALSE);
+
+        g_dbus_connection_signal_subscribe(connection, NULL, NULL, NULL, BENCH_PATH, NULL,
+                                           G_DBUS_SIGNAL_FLAGS_NONE,
+                                           bench_stub_signal_callback, loop, NULL);
+        g_bus_own_name_on_connection(connection, name, G_BUS_NAME_OWNER_FLAGS_DO_NOT_QUEUE,
+                                     NULL, NULL, NULL, NULL);
+        g_timeout_add_seconds(10, bench_stub_timeout, loop);
+
+        g_main_loop_run(loop);
+
+        g_main_loop_unref(loop);
+        g_object_unref(connection);
+
+        return 0;
+}
+
+static int bench_generate(struct bench_bus *bus, const char *self) {
+        _cleanup_free_ char *conf_dir = NULL;
+        unsigned int l, m;
+        int r;
+
+        assert(bus);
+
+        if (asprintf(&conf_dir, "%s/conf/user", bus->dir) < 0)
+                return -ENOMEM;
+
+        if (g_mkdir_with_parents(conf_dir, 0755) < 0)
+                return -errno;
+
+        for (l = 0; l < arg.listeners; l++) {
+                _cleanup_free_ char *path = NULL, *busname = NULL;
+                GString *content;
+
+                if (asprintf(&busname, BENCH_BUSNAME_PREFIX "l%u", l) < 0 ||
+                    asprintf(&path, "%s/%s.conf", conf_dir, busname) < 0)
+                        return -ENOMEM;
+
+                content = g_string_new("[BusAct]\n");
+                g_string_append_printf(content, "BusName=%s\n", busname);
+                for (m = 0; m < arg.rules; m++)
+                        g_string_append_printf(content,
+                                               "Subscribe=path=\"" BENCH_PATH "\" "
+                                               "interface=\"" BENCH_INTERFACE ".L%u\" member=\"R%u\"\n",
+                                               l, m);
+
+                r = bench_write_file(path, content->str);
+                g_string_free(content, TRUE);
+                if (r < 0)
+                        return r;
+
+                if (!arg.activate)
+                        continue;
+
+                free(path);
+                if (asprintf(&path, "%s/services/%s.service", bus->dir, busname) < 0)
+                        return -ENOMEM;
+
+                content = g_string_new("[D-BUS Service]\n");
+                g_string_append_printf(content, "Name=%s\nExec=%s --stub %s\n", busname, self, busname);
+
+                r = bench_write_file(path, content->str);
+                g_string_free(content, TRUE);
+                if (r < 0)
+                        return r;
+        }
+
+        return 0;
+}
+
+static gpointer bench_sender_thread(gpointer user_data) {
+        struct bench_sender *sender = user_data;
+        GDBusConnection *connection;
+        unsigned int n_targets = arg.listeners * arg.rules;
+        gint64 start, end, next, interval, now;
+        guint64 target = sender->index;
+
+        connection = bench_bus_connect(sender->bus);
+        if (!connection)
+                return NULL;
+
+        interval = G_USEC_PER_SEC / arg.rate;
+        start = next = g_get_monotonic_time();
+        end = start + (gint64) arg.duration * G_USEC_PER_SEC;
+
+        while ((now = g_get_monotonic_time()) < end) {
+                char interface[64], member[16];
+                unsigned int t = target % n_targets;
+
+                snprintf(interface, sizeof(interface), BENCH_INTERFACE ".L%u", t / arg.rules);
+                snprintf(member, sizeof(member), "R%u", t % arg.rules);
+
+                if (g_dbus_connection_emit_signal(connection, NULL, BENCH_PATH, interface, member,
+                                                  g_variant_new("(t)", (guint64) g_get_monotonic_time()),
+                                                  NULL))
+                        sender->sent++;
+
+                target += arg.senders;
+                next += interval;
+                if (next > now)
+                        g_usleep(next - now);
+        }
+
+        g_dbus_connection_flush_sync(connection, NULL, NULL);
+        g_object_unref(connection);
+
+        return NULL;
+}
+
+int main(int argc, char *argv[]) {
+        struct bench_bus bus = {};
+        struct bench_monitor monitor = {};
+        struct bench_proc_stat before = {}, after = {};
+        struct bench_sender *senders = NULL;
+        GDBusConnection *connection = NULL;
+        _cleanup_free_ char *conf_dir = NULL, *conf_arg = NULL;
+        char *busactd_args[2] = {};
+        GPid busactd_pid = 0;
+        guint64 sent = 0, forwarded;
+        gint64 start, elapsed;
+        unsigned int i;
+        int r;
+
+        r = parse_argv(argc, argv);
+        if (r < 0)
+                return EXIT_FAILURE;
+
+        if (arg.stub)
+                return bench_run_stub(arg.stub) < 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+
+        r = bench_bus_start(&bus);
+        if (r < 0)
+                goto finish;
+
+        r = bench_generate(&bus, argv[0][0] == '/' ? argv[0] : g_find_program_in_path(argv[0]));
+        if (r < 0)
+                goto finish;
+
+        if (asprintf(&conf_arg, "--config-dir=%s/conf", bus.dir) < 0) {
+                r = -ENOMEM;
+                goto finish;
+        }
+
+        busactd_args[0] = conf_arg;
+
+        r = bench_busactd_start(&bus, arg.busactd, busactd_args, &busactd_pid);
+        if (r < 0)
+                goto finish;
+
+        connection = bench_bus_connect(&bus);
+        if (!connection) {
+                r = -ECONNREFUSED;
+                goto finish;
+        }
+
+        r = bench_busactd_wait_ready(connection, BENCH_BUSNAME_PREFIX,
+                                     arg.listeners * arg.rules, 120);
+        if (r < 0)
+                goto finish;
+
+        r = bench_monitor_start(&monitor, &bus);
+        if (r < 0)
+                goto finish;
+
+        (void) bench_proc_stat(busactd_pid, &before);
+
+        senders = new0(struct bench_sender, arg.senders);
+        if (!senders) {
+                r = -ENOMEM;
+                goto finish;
+        }
+
+        start = g_get_monotonic_time();
+
+        for (i = 0; i < arg.senders; i++) {
+                senders[i].bus = &bus;
+                senders[i].index = i;
+                senders[i].thread = g_thread_new("bench-sender", bench_sender_thread, &senders[i]);
+        }
+
+        for (i = 0; i < arg.senders; i++) {
+                g_thread_join(senders[i].thread);
+                sent += senders[i].sent;
+        }
+
+        /* Let busactd drain what is still queued. */
+        g_usleep(G_USEC_PER_SEC);
+        elapsed = g_get_monotonic_time() - start;
+
+        (void) bench_proc_stat(busactd_pid, &after);
+
+        g_mutex_lock(&monitor.lock);
+        forwarded = monitor.forwarded;
+
+        printf("listeners:              %u\n", arg.listeners);
+        printf("rules per listener:     %u\n", arg.rules);
+        printf("senders:                %u\n", arg.senders);
+        printf("mode:                   %s\n", arg.activate ? "activate" : "forward");
+        printf("signals sent:           %" G_GUINT64_FORMAT "\n", sent);
+        printf("triggers seen:          %" G_GUINT64_FORMAT "\n", monitor.triggers);
+        printf("signals forwarded:      %" G_GUINT64_FORMAT "\n", forwarded);
+        printf("forwarded/sec:          %.1f\n", (double) forwarded * G_USEC_PER_SEC / elapsed);
+        printf("latency p50 (usec):     %" G_GINT64_FORMAT "\n", bench_percentile(monitor.latencies, 50));
+        printf("latency p99 (usec):     %" G_GINT64_FORMAT "\n", bench_percentile(monitor.latencies, 99));
+        printf("busactd cpu (%%):        %.1f\n", (after.cpu_sec - before.cpu_sec) * 100.0 * G_USEC_PER_SEC / elapsed);
+        printf("busactd rss (kB):       %ld\n", after.rss_kb);
+        printf("busactd rss peak (kB):  %ld\n", after.hwm_kb);
+        if (forwarded)
+                printf("ctxt switches/signal:   %.2f\n",
+                       (double) (after.ctxt_switches - before.ctxt_switches) / forwarded);
+
+        g_mutex_unlock(&monitor.lock);
+
+finish:
+        free(senders);
+        bench_monitor_stop(&monitor);
+        if (connection)
+                g_object_unref(connection);
+        bench_process_stop(busactd_pid);
+        bench_bus_stop(&bus);
+
+        return r < 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+}
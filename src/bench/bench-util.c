@@ -0,0 +1,497 @@
+/*-*- Mode: C; c-basic-offset: 8; indent-tabs-mode: nil -*-*/
+
+/*
+ * busactd
+ *
+ * Copyright (c) 2016 Samsung Electronics Co., Ltd.
+ *
+ * Licensed under the Apache License, Version 2.0 (the License);
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <assert.h>
+#include <signal.h>
+#include <unistd.h>
+#include <ftw.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#include <glib.h>
+#include <gio/gio.h>
+
+#include <libsystem/libsystem.h>
+
+#include "bench-util.h"
+
+static const char bench_bus_config[] =
+        "<!DOCTYPE busconfig PUBLIC \"-//freedesktop//DTD D-Bus Bus Configuration 1.0//EN\"\n"
+        " \"http://www.freedesktop.org/standards/dbus/1.0/busconfig.dtd\">\n"
+        "<busconfig>\n"
+        "  <type>session</type>\n"
+        "  <listen>unix:dir=%s</listen>\n"
+        "  <servicedir>%s/services</servicedir>\n"
+        "  <policy context=\"default\">\n"
+        "    <allow send_destination=\"*\" eavesdrop=\"true\"/>\n"
+        "    <allow eavesdrop=\"true\"/>\n"
+        "    <allow own=\"*\"/>\n"
+        "  </policy>\n"
+        "  <limit name=\"max_match_rules_per_connection\">1000000</limit>\n"
+        "  <limit name=\"max_incoming_bytes\">1000000000</limit>\n"
+        "  <limit name=\"max_outgoing_bytes\">1000000000</limit>\n"
+        "  <limit name=\"max_replies_per_connection\">1000000</limit>\n"
+        "  <limit name=\"max_connections_per_user\">100000</limit>\n"
+        "  <limit name=\"max_pending_service_starts\">100000</limit>\n"
+        "</busconfig>\n";
+
+int bench_write_file(const char *path, const char *content) {
+        g_autoptr(GError) error = NULL;
+
+        assert(path);
+        assert(content);
+
+        if (!g_file_set_contents(path, content, -1, &error)) {
+                fprintf(stderr, "Failed to write %s: %s\n", path, error->message);
+                return -EIO;
+        }
+
+        return 0;
+}
+
+static int bench_rm_rf_one(const char *path, const struct stat *st, int flag, struct FTW *ftw) {
+        return remove(path);
+}
+
+int bench_rm_rf(const char *path) {
+
+        assert(path);
+
+        return nftw(path, bench_rm_rf_one, 64, FTW_DEPTH | FTW_PHYS) < 0 ? -errno : 0;
+}
+
+int bench_bus_start(struct bench_bus *bus) {
+        _cleanup_free_ char *config = NULL, *config_path = NULL, *services = NULL;
+        g_autoptr(GError) error = NULL;
+        char *argv[] = { "dbus-daemon", NULL, "--nofork", "--print-address=1", NULL };
+        _cleanup_free_ char *config_arg = NULL;
+        char buf[4096];
+        ssize_t n;
+        int out, r;
+
+        assert(bus);
+
+        bus->dir = g_dir_make_tmp("bench-busactd-XXXXXX", &error);
+        if (!bus->dir) {
+                fprintf(stderr, "Failed to make temporary directory: %s\n", error->message);
+                return -EIO;
+        }
+
+        if (asprintf(&services, "%s/services", bus->dir) < 0 ||
+            asprintf(&config_path, "%s/bus.conf", bus->dir) < 0 ||
+            asprintf(&config_arg, "--config-file=%s", config_path) < 0 ||
+            asprintf(&config, bench_bus_config, bus->dir, bus->dir) < 0)
+                return -ENOMEM;
+
+        if (mkdir(services, 0755) < 0)
+                return -errno;
+
+        r = bench_write_file(config_path, config);
+        if (r < 0)
+                return r;
+
+        argv[1] = config_arg;
+
+        if (!g_spawn_async_with_pipes(NULL, argv, NULL,
+                                      G_SPAWN_SEARCH_PATH | G_SPAWN_DO_NOT_REAP_CHILD,
+                                      NULL, NULL, &bus->pid, NULL, &out, NULL, &error)) {
+                fprintf(stderr, "Failed to spawn dbus-daemon: %s\n", error->message);
+                return -ECHILD;
+        }
+
+        n = read(out, buf, sizeof(buf) - 1);
+        close(out);
+        if (n <= 0) {
+                fprintf(stderr, "Failed to read the address of dbus-daemon\n");
+                return -EIO;
+        }
+
+        buf[n] = '\0';
+        bus->address = strdup(g_strstrip(buf));
+        if (!bus->address)
+                return -ENOMEM;
+
+        return 0;
+}
+
+void bench_process_stop(GPid pid) {
+
+        if (pid <= 0)
+                return;
+
+        (void) kill(pid, SIGTERM);
+        (void) waitpid(pid, NULL, 0);
+}
+
+void bench_bus_stop(struct bench_bus *bus) {
+
+        assert(bus);
+
+        bench_process_stop(bus->pid);
+        bus->pid = 0;
+
+        if (bus->dir)
+                (void) bench_rm_rf(bus->dir);
+
+        free(bus->dir);
+        free(bus->address);
+        bus->dir = NULL;
+        bus->address = NULL;
+}
+
+GDBusConnection *bench_bus_connect(struct bench_bus *bus) {
+        g_autoptr(GError) error = NULL;
+        GDBusConnection *connection;
+
+        assert(bus);
+        assert(bus->address);
+
+        connection = g_dbus_connection_new_for_address_sync(bus->address,
+                                                            G_DBUS_CONNECTION_FLAGS_AUTHENTICATION_CLIENT |
+                                                            G_DBUS_CONNECTION_FLAGS_MESSAGE_BUS_CONNECTION,
+                                                            NULL, NULL, &error);
+        if (!connection)
+                fprintf(stderr, "Failed to connect to %s: %s\n", bus->address, error->message);
+
+        return connection;
+}
+
+int bench_busactd_start(struct bench_bus *bus, const char *busactd_path, char **args, GPid *pid) {
+        g_autoptr(GError) error = NULL;
+        GPtrArray *argv;
+        gchar **envp;
+        bool ok;
+
+        assert(bus);
+        assert(busactd_path);
+        assert(pid);
+
+        argv = g_ptr_array_new();
+        g_ptr_array_add(argv, (gpointer) busactd_path);
+        g_ptr_array_add(argv, "--user");
+        for (; args && *args; args++)
+                g_ptr_array_add(argv, *args);
+        g_ptr_array_add(argv, NULL);
+
+        envp = g_get_environ();
+        envp = g_environ_setenv(envp, "DBUS_SESSION_BUS_ADDRESS", bus->address, TRUE);
+        envp = g_environ_setenv(envp, "XDG_RUNTIME_DIR", bus->dir, TRUE);
+
+        ok = g_spawn_async(NULL, (gchar **) argv->pdata, envp,
+                           G_SPAWN_DO_NOT_REAP_CHILD, NULL, NULL, pid, &error);
+
+        g_strfreev(envp);
+        g_ptr_array_free(argv, TRUE);
+
+        if (!ok) {
+                fprintf(stderr, "Failed to spawn %s: %s\n", busactd_path, error->message);
+                return -ECHILD;
+        }
+
+        return 0;
+}
+
+/* Counts the matches of the listeners named 'prefix'*, paging through
+ * ListListenersFiltered. */
+static int bench_busactd_count_matches(GDBusConnection *connection, const char *prefix, unsigned int *n) {
+        unsigned int cursor = 0;
+
+        *n = 0;
+
+        do {
+                g_autoptr(GVariant) reply = NULL, list = NULL;
+
+                reply = g_dbus_connection_call_sync(connection,
+                                                    "org.tizen.busactd",
+                                                    "/Org/Tizen/BusActD",
+                                                    "org.tizen.busactd",
+                                                    "ListListenersFiltered",
+                                                    g_variant_new("(ssuu)", prefix, "", cursor, 0),
+                                                    G_VARIANT_TYPE("(a(sususssss)u)"),
+                                                    G_DBUS_CALL_FLAGS_NO_AUTO_START,
+                                                    -1, NULL, NULL);
+                if (!reply)
+                        return -EIO;
+
+                g_variant_get(reply, "(@a(sususssss)u)", &list, &cursor);
+                *n += g_variant_n_children(list);
+        } while (cursor);
+
+        return 0;
+}
+
+int bench_busactd_wait_ready(GDBusConnection *connection, const char *prefix, unsigned int n_matches, unsigned int timeout_sec) {
+        gint64 deadline;
+
+        assert(connection);
+        assert(prefix);
+
+        if (!n_matches)
+                return 0;
+
+        deadline = g_get_monotonic_time() + (gint64) timeout_sec * G_USEC_PER_SEC;
+
+        /* Ready once all expected matches are listed. A listing which
+         * raced with loading fails and is just tried again. */
+        while (g_get_monotonic_time() < deadline) {
+                unsigned int n;
+
+                if (bench_busactd_count_matches(connection, prefix, &n) == 0 && n >= n_matches)
+                        return 0;
+
+                g_usleep(100 * 1000);
+        }
+
+        fprintf(stderr, "busactd did not get ready within %u sec\n", timeout_sec);
+
+        return -ETIMEDOUT;
+}
+
+static int bench_proc_ctxt_switches(GPid pid, struct bench_proc_stat *stat) {
+        _cleanup_free_ char *dir = NULL;
+        const char *task;
+        GDir *d;
+
+        if (asprintf(&dir, "/proc/%d/task", pid) < 0)
+                return -ENOMEM;
+
+        d = g_dir_open(dir, 0, NULL);
+        if (!d)
+                return -ENOENT;
+
+        stat->ctxt_switches = 0;
+
+        while ((task = g_dir_read_name(d))) {
+                _cleanup_free_ char *path = NULL, *content = NULL;
+                char *line;
+
+                if (asprintf(&path, "%s/%s/status", dir, task) < 0)
+                        break;
+
+                if (!g_file_get_contents(path, &content, NULL, NULL))
+                        continue;
+
+                for (line = strtok(content, "\n"); line; line = strtok(NULL, "\n")) {
+                        if (!strncmp(line, "voluntary_ctxt_switches:", 24))
+                                stat->ctxt_switches += strtoul(line + 24, NULL, 10);
+                        else if (!strncmp(line, "nonvoluntary_ctxt_switches:", 27))
+                                stat->ctxt_switches += strtoul(line + 27, NULL, 10);
+                }
+        }
+
+        g_dir_close(d);
+
+        return 0;
+}
+
+int bench_proc_stat(GPid pid, struct bench_proc_stat *stat) {
+        _cleanup_free_ char *path = NULL, *content = NULL;
+        unsigned long utime, stime;
+        char *p, *line;
+
+        assert(stat);
+
+        if (asprintf(&path, "/proc/%d/stat", pid) < 0)
+                return -ENOMEM;
+
+        if (!g_file_get_contents(path, &content, NULL, NULL))
+                return -ENOENT;
+
+        /* Skip "pid (comm) " which may contain spaces, then state
+         * and 10 more fields up to utime and stime. */
+        p = strrchr(content, ')');
+        if (!p || sscanf(p + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu",
+                         &utime, &stime) != 2)
+                return -EINVAL;
+
+        stat->cpu_sec = (double) (utime + stime) / sysconf(_SC_CLK_TCK);
+
+        free(path);
+        free(content);
+        path = content = NULL;
+
+        if (asprintf(&path, "/proc/%d/status", pid) < 0)
+                return -ENOMEM;
+
+        if (!g_file_get_contents(path, &content, NULL, NULL))
+                return -ENOENT;
+
+        stat->rss_kb = stat->hwm_kb = 0;
+
+        for (line = strtok(content, "\n"); line; line = strtok(NULL, "\n")) {
+                if (!strncmp(line, "VmRSS:", 6))
+                        stat->rss_kb = strtol(line + 6, NULL, 10);
+                else if (!strncmp(line, "VmHWM:", 6))
+                        stat->hwm_kb = strtol(line + 6, NULL, 10);
+        }
+
+        return bench_proc_ctxt_switches(pid, stat);
+}
+
+GVariant *bench_busactd_statistics(GDBusConnection *connection) {
+        g_autoptr(GVariant) reply = NULL;
+
+        assert(connection);
+
+        reply = g_dbus_connection_call_sync(connection,
+                                            "org.tizen.busactd",
+                                            "/Org/Tizen/BusActD",
+                                            "org.tizen.busactd",
+                                            "GetStatistics",
+                                            NULL,
+                                            G_VARIANT_TYPE("(a{st})"),
+                                            G_DBUS_CALL_FLAGS_NO_AUTO_START,
+                                            -1, NULL, NULL);
+        if (!reply)
+                return NULL;
+
+        return g_variant_get_child_value(reply, 0);
+}
+
+guint64 bench_statistic(GVariant *statistics, const char *name) {
+        guint64 value = 0;
+
+        assert(name);
+
+        if (statistics)
+                (void) g_variant_lookup(statistics, name, "t", &value);
+
+        return value;
+}
+
+static GDBusMessage *bench_monitor_filter(GDBusConnection *connection,
+                                          GDBusMessage *message,
+                                          gboolean incoming,
+                                          gpointer user_data) {
+
+        struct bench_monitor *monitor = user_data;
+        GVariant *body;
+        guint64 sent;
+        gint64 latency;
+
+        if (!incoming ||
+            g_dbus_message_get_message_type(message) != G_DBUS_MESSAGE_TYPE_SIGNAL ||
+            !streq_ptr(g_dbus_message_get_path(message), BENCH_PATH))
+                goto finish;
+
+        if (!g_dbus_message_get_destination(message)) {
+                g_mutex_lock(&monitor->lock);
+                monitor->triggers++;
+                g_mutex_unlock(&monitor->lock);
+                goto finish;
+        }
+
+        body = g_dbus_message_get_body(message);
+        if (!body || !g_variant_is_of_type(body, G_VARIANT_TYPE("(t)")))
+                goto finish;
+
+        g_variant_get(body, "(t)", &sent);
+        latency = g_get_monotonic_time() - (gint64) sent;
+
+        g_mutex_lock(&monitor->lock);
+        monitor->forwarded++;
+        g_array_append_val(monitor->latencies, latency);
+        g_mutex_unlock(&monitor->lock);
+
+finish:
+        g_object_unref(message);
+        return NULL;
+}
+
+int bench_monitor_start(struct bench_monitor *monitor, struct bench_bus *bus) {
+        const char *rules[] = { "type='signal',path='" BENCH_PATH "'", NULL };
+        g_autoptr(GError) error = NULL;
+        g_autoptr(GVariant) reply = NULL;
+
+        assert(monitor);
+        assert(bus);
+
+        g_mutex_init(&monitor->lock);
+        monitor->latencies = g_array_new(FALSE, FALSE, sizeof(gint64));
+        monitor->triggers = monitor->forwarded = 0;
+
+        monitor->connection = bench_bus_connect(bus);
+        if (!monitor->connection)
+                return -ECONNREFUSED;
+
+        g_dbus_connection_add_filter(monitor->connection, bench_monitor_filter, monitor, NULL);
+
+        reply = g_dbus_connection_call_sync(monitor->connection,
+                                            "org.freedesktop.DBus",
+                                            "/org/freedesktop/DBus",
+                                            "org.freedesktop.DBus.Monitoring",
+                                            "BecomeMonitor",
+                                            g_variant_new("(^asu)", rules, 0),
+                                            NULL,
+                                            G_DBUS_CALL_FLAGS_NONE,
+                                            -1, NULL, &error);
+        if (!reply) {
+                fprintf(stderr, "Failed to become monitor: %s\n", error->message);
+                return -EPERM;
+        }
+
+        return 0;
+}
+
+void bench_monitor_stop(struct bench_monitor *monitor) {
+
+        assert(monitor);
+
+        if (!monitor->latencies)
+                return;
+
+        if (monitor->connection) {
+                g_dbus_connection_close_sync(monitor->connection, NULL, NULL);
+                g_object_unref(monitor->connection);
+                monitor->connection = NULL;
+        }
+
+        g_array_free(monitor->latencies, TRUE);
+        monitor->latencies = NULL;
+
+        g_mutex_clear(&monitor->lock);
+}
+
+static int bench_compare_gint64(const void *a, const void *b) {
+        gint64 x = *(const gint64 *) a, y = *(const gint64 *) b;
+
+        return x < y ? -1 : x > y;
+}
+
+gint64 bench_percentile(GArray *values, double percent) {
+        guint i;
+
+        assert(values);
+
+        if (!values->len)
+                return 0;
+
+        qsort(values->data, values->len, sizeof(gint64), bench_compare_gint64);
+
+        i = (guint) (percent / 100.0 * (values->len - 1) + 0.5);
+
+        return g_array_index(values, gint64, MIN(i, values->len - 1));
+}
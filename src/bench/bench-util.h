@@ -0,0 +1,71 @@
+/*-*- Mode: C; c-basic-offset: 8; indent-tabs-mode: nil -*-*/
+
+/*
+ * busactd
+ *
+ * Copyright (c) 2016 Samsung Electronics Co., Ltd.
+ *
+ * Licensed under the Apache License, Version 2.0 (the License);
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#pragma once
+
+#include <stdbool.h>
+#include <glib.h>
+#include <gio/gio.h>
+
+#define BENCH_PATH              "/Org/Tizen/BusActD/Bench"
+#define BENCH_INTERFACE         "org.tizen.busactd.bench"
+#define BENCH_BUSNAME_PREFIX    "org.tizen.busactd.bench."
+
+/* A private dbus-daemon living in its own temporary directory. */
+struct bench_bus {
+        char *dir;
+        char *address;
+        GPid pid;
+};
+
+struct bench_proc_stat {
+        double cpu_sec;
+        long rss_kb;
+        long hwm_kb;
+        /* of all threads */
+        unsigned long ctxt_switches;
+};
+
+/* Eavesdrops the private bus and collects the latency of signals
+ * forwarded by busactd, i.e. signals having a destination, whose body
+ * starts with the monotonic send time in usec. */
+struct bench_monitor {
+        GDBusConnection *connection;
+        GMutex lock;
+        GArray *latencies;
+        guint64 triggers;
+        guint64 forwarded;
+};
+
+int bench_bus_start(struct bench_bus *bus);
+void bench_bus_stop(struct bench_bus *bus);
+GDBusConnection *bench_bus_connect(struct bench_bus *bus);
+int bench_busactd_start(struct bench_bus *bus, const char *busactd_path, char **args, GPid *pid);
+int bench_busactd_wait_ready(GDBusConnection *connection, const char *prefix, unsigned int n_matches, unsigned int timeout_sec);
+void bench_process_stop(GPid pid);
+int bench_proc_stat(GPid pid, struct bench_proc_stat *stat);
+GVariant *bench_busactd_statistics(GDBusConnection *connection);
+guint64 bench_statistic(GVariant *statistics, const char *name);
+int bench_monitor_start(struct bench_monitor *monitor, struct bench_bus *bus);
+void bench_monitor_stop(struct bench_monitor *monitor);
+gint64 bench_percentile(GArray *values, double percent);
+int bench_write_file(const char *path, const char *content);
+int bench_rm_rf(const char *path);
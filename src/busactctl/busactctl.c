@@ -0,0 +1,638 @@
+/*-*- Mode: C; c-basic-offset: 8; indent-tabs-mode: nil -*-*/
+
+/*
+ * busactd
+ *
+ * Copyright (c) 2016 Samsung Electronics Co., Ltd.
+ *
+ * Licensed under the Apache License, Version 2.0 (the License);
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+/*
+ * busactctl: tools around busactd.
+ *
+ *   analyze  report what a listener config tree costs before it ships
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <assert.h>
+#include <getopt.h>
+#include <ftw.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <glib.h>
+#include <gio/gio.h>
+
+#include <libsystem/libsystem.h>
+#include <libsystem/glib-util.h>
+
+#include "busactd/busactd.h"
+#include "busactd/conf.h"
+#include "busactd/shmstats.h"
+#include "log.h"
+
+#ifndef DBUS_SERVICE_DIR
+#define DBUS_SERVICE_DIR "/usr/share/dbus-1/services"
+#endif
+
+#ifndef DBUS_SYSTEM_SERVICE_DIR
+#define DBUS_SYSTEM_SERVICE_DIR "/usr/share/dbus-1/system-services"
+#endif
+
+#define EXIT_THRESHOLD  2
+
+enum {
+        THRESHOLD_RULES,
+        THRESHOLD_DUPLICATES,
+        THRESHOLD_SUBSUMED,
+        THRESHOLD_BROAD,
+        THRESHOLD_UNACTIVATABLE,
+        THRESHOLD_COST,
+        _THRESHOLD_MAX,
+};
+
+static const char * const threshold_names[_THRESHOLD_MAX] = {
+        [THRESHOLD_RULES]               = "match rules:",
+        [THRESHOLD_DUPLICATES]          = "duplicate rules:",
+        [THRESHOLD_SUBSUMED]            = "subsumed rules:",
+        [THRESHOLD_BROAD]               = "broad rules:",
+        [THRESHOLD_UNACTIVATABLE]       = "listeners without activation file:",
+        [THRESHOLD_COST]                = "comparisons per signal:",
+};
+
+static struct {
+        GPtrArray *services_dirs;
+        long thresholds[_THRESHOLD_MAX];
+        const char *stats_path;
+        unsigned int delay;
+        unsigned int iterations;
+        bool batch;
+} arg = {
+        .thresholds = { -1, -1, -1, -1, -1, -1 },
+        .stats_path = BUSACTD_RUNTIME_DIR "/" BUSACTD_SHM_STATS_FILE,
+        .delay = 1,
+};
+
+/* The tree being analyzed, never connected to a bus */
+static struct busactd_dbus analyze_bus;
+static struct busactd analyze_busactd = {
+        .bus = &analyze_bus,
+};
+
+static void busactctl_show_help(void) {
+        printf("Usage: busactctl COMMAND [OPTIONS...]\n\n");
+        printf("Commands:\n");
+        printf("  analyze DIR...               analyze the listener configs below DIR\n");
+        printf("  top                          show the statistics busactd publishes\n\n");
+        printf("Options of analyze:\n");
+        printf("  -s  --services-dir=DIR       look up activation files in DIR, may be\n");
+        printf("                               repeated (%s and\n", DBUS_SERVICE_DIR);
+        printf("                               %s)\n", DBUS_SYSTEM_SERVICE_DIR);
+        printf("      --max-rules=N            fail above N installed match rules\n");
+        printf("      --max-duplicates=N       fail above N duplicate rules\n");
+        printf("      --max-subsumed=N         fail above N rules subsumed by others\n");
+        printf("      --max-broad=N            fail above N rules without interface and member\n");
+        printf("      --max-unactivatable=N    fail above N listeners without activation file\n");
+        printf("      --max-cost=N             fail above N rule comparisons per signal\n");
+        printf("Options of top:\n");
+        printf("  -p  --path=FILE              statistics file (%s)\n", arg.stats_path);
+        printf("  -d  --delay=SEC              seconds between updates (%u)\n", arg.delay);
+        printf("  -n  --iterations=N           exit after N updates, 0 is forever (%u)\n", arg.iterations);
+        printf("  -b  --batch                  do not clear the screen between updates\n");
+        printf("  -h  --help                   show this help\n\n");
+        printf("analyze exits with %d when a threshold is exceeded.\n", EXIT_THRESHOLD);
+}
+
+/* The match rule GDBus installs for a subscription, used as the
+ * identity of a rule. */
+static char *busactctl_match_rule(struct busactd_match *match) {
+        GString *rule = g_string_new("type='signal'");
+
+        if (match->sender)
+                g_string_append_printf(rule, ",sender='%s'", match->sender);
+        if (match->interface)
+                g_string_append_printf(rule, ",interface='%s'", match->interface);
+        if (match->member)
+                g_string_append_printf(rule, ",member='%s'", match->member);
+        if (match->path)
+                g_string_append_printf(rule, ",path='%s'", match->path);
+        if (match->arg)
+                g_string_append_printf(rule, ",arg0='%s'", match->arg);
+
+        return g_string_free(rule, FALSE);
+}
+
+/* Whether every signal matching 'a' also matches 'b' */
+static bool busactctl_match_covers(struct busactd_match *b, struct busactd_match *a) {
+
+        return (!b->sender || streq_ptr(a->sender, b->sender)) &&
+               (!b->path || streq_ptr(a->path, b->path)) &&
+               (!b->interface || streq_ptr(a->interface, b->interface)) &&
+               (!b->member || streq_ptr(a->member, b->member)) &&
+               (!b->arg || streq_ptr(a->arg, b->arg)) &&
+               (!b->filter || streq_ptr(a->filter, b->filter));
+}
+
+static int busactctl_analyze_file(const char *path, const struct stat *st, int flag, struct FTW *ftw) {
+        struct busactd_listener *listener = NULL;
+        int r;
+
+        if (flag != FTW_F || !endswith(path, BUSACTD_CONF_EXT))
+                return 0;
+
+        /* the daemon settings, not a listener */
+        if (streq(path + ftw->base, BUSACTD ".conf"))
+                return 0;
+
+        r = busactd_config_parse_listener(&analyze_busactd, path, &listener);
+        if (r < 0) {
+                fprintf(stderr, "Failed to parse %s: %s\n", path, strerror(-r));
+                return 0;
+        }
+
+        if (listener)
+                busactd_add_listener(listener);
+
+        return 0;
+}
+
+static GHashTable *busactctl_load_service_names(void) {
+        GHashTable *names;
+        unsigned int i;
+
+        names = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+
+        for (i = 0; i < arg.services_dirs->len; i++) {
+                const char *dir = g_ptr_array_index(arg.services_dirs, i);
+                const char *name;
+                GDir *d;
+
+                d = g_dir_open(dir, 0, NULL);
+                if (!d)
+                        continue;
+
+                while ((name = g_dir_read_name(d))) {
+                        g_autoptr(GKeyFile) keyfile = NULL;
+                        _cleanup_free_ char *path = NULL;
+                        gchar *busname;
+
+                        if (!endswith(name, ".service"))
+                                continue;
+
+                        if (asprintf(&path, "%s/%s", dir, name) < 0)
+                                continue;
+
+                        keyfile = g_key_file_new();
+                        if (!g_key_file_load_from_file(keyfile, path, G_KEY_FILE_NONE, NULL))
+                                continue;
+
+                        busname = g_key_file_get_string(keyfile, "D-BUS Service", "Name", NULL);
+                        if (busname)
+                                g_hash_table_add(names, busname);
+                }
+
+                g_dir_close(d);
+        }
+
+        return names;
+}
+
+static int busactctl_analyze(int argc, char *argv[]) {
+        enum {
+                ARG_MAX_RULES = 0x100,
+                ARG_MAX_DUPLICATES,
+                ARG_MAX_SUBSUMED,
+                ARG_MAX_BROAD,
+                ARG_MAX_UNACTIVATABLE,
+                ARG_MAX_COST,
+        };
+
+        static const struct option options[] = {
+                { "services-dir",       required_argument, NULL, 's'                    },
+                { "max-rules",          required_argument, NULL, ARG_MAX_RULES          },
+                { "max-duplicates",     required_argument, NULL, ARG_MAX_DUPLICATES     },
+                { "max-subsumed",       required_argument, NULL, ARG_MAX_SUBSUMED       },
+                { "max-broad",          required_argument, NULL, ARG_MAX_BROAD          },
+                { "max-unactivatable",  required_argument, NULL, ARG_MAX_UNACTIVATABLE  },
+                { "max-cost",           required_argument, NULL, ARG_MAX_COST           },
+                { "help",               no_argument,       NULL, 'h'                    },
+                { NULL,                 0,                 NULL, 0                      }
+        };
+
+        GHashTable *rules, *services;
+        long counts[_THRESHOLD_MAX] = {};
+        unsigned int n_listeners = 0, n_subscriptions = 0, n_unrestricted = 0;
+        bool exceeded = false;
+        GList *l_list;
+        int c, i;
+
+        arg.services_dirs = g_ptr_array_new();
+
+        while ((c = getopt_long(argc, argv, "s:h", options, NULL)) >= 0) {
+
+                switch (c) {
+
+                case 's':
+                        g_ptr_array_add(arg.services_dirs, optarg);
+                        break;
+
+                case ARG_MAX_RULES ... ARG_MAX_COST:
+                        arg.thresholds[c - ARG_MAX_RULES] = strtol(optarg, NULL, 10);
+                        break;
+
+                case 'h':
+                        busactctl_show_help();
+                        exit(EXIT_SUCCESS);
+
+                default:
+                        busactctl_show_help();
+                        return -EINVAL;
+                }
+        }
+
+        if (optind >= argc) {
+                fprintf(stderr, "No directory to analyze given.\n");
+                return -EINVAL;
+        }
+
+        if (!arg.services_dirs->len) {
+                g_ptr_array_add(arg.services_dirs, DBUS_SERVICE_DIR);
+                g_ptr_array_add(arg.services_dirs, DBUS_SYSTEM_SERVICE_DIR);
+        }
+
+        for (i = optind; i < argc; i++)
+                if (nftw(argv[i], busactctl_analyze_file, 16, FTW_PHYS) < 0) {
+                        fprintf(stderr, "Failed to walk %s: %m\n", argv[i]);
+                        return -errno;
+                }
+
+        rules = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+        services = busactctl_load_service_names();
+
+        FOREACH_G_LIST(l_list, analyze_busactd.listener_list) {
+                struct busactd_listener *listener = l_list->data;
+                GList *a, *b;
+
+                n_listeners++;
+
+                if (!g_hash_table_contains(services, listener->busname)) {
+                        printf("no activation file:  %s\n", listener->busname);
+                        counts[THRESHOLD_UNACTIVATABLE]++;
+                }
+
+                FOREACH_G_LIST(a, listener->match_list) {
+                        struct busactd_match *match = a->data;
+                        g_autofree char *rule = busactctl_match_rule(match);
+
+                        n_subscriptions++;
+
+                        if (!match->sender)
+                                n_unrestricted++;
+
+                        if (!match->interface && !match->member) {
+                                printf("broad:               %s %s\n", listener->busname, rule);
+                                counts[THRESHOLD_BROAD]++;
+                        }
+
+                        if (!g_hash_table_contains(rules, rule))
+                                g_hash_table_add(rules, g_strdup(rule));
+
+                        FOREACH_G_LIST(b, listener->match_list) {
+                                struct busactd_match *other = b->data;
+                                bool covers, covered;
+
+                                if (a == b)
+                                        continue;
+
+                                covers = busactctl_match_covers(other, match);
+                                covered = busactctl_match_covers(match, other);
+
+                                /* report a duplicate once, on its second copy */
+                                if (covers && covered) {
+                                        if (g_list_position(listener->match_list, b) < g_list_position(listener->match_list, a)) {
+                                                printf("duplicate:           %s %s\n", listener->busname, rule);
+                                                counts[THRESHOLD_DUPLICATES]++;
+                                                break;
+                                        }
+                                } else if (covers) {
+                                        g_autofree char *broader = busactctl_match_rule(other);
+
+                                        printf("subsumed:            %s %s by %s\n", listener->busname, rule, broader);
+                                        counts[THRESHOLD_SUBSUMED]++;
+                                        break;
+                                }
+                        }
+                }
+        }
+
+        /* GDBus installs one rule per distinct subscription and one
+         * NameOwnerChanged rule per listener. The daemon tests a
+         * broadcast against each of them, and GDBus tests it again
+         * against the subscriptions not bound to a sender. */
+        counts[THRESHOLD_RULES] = g_hash_table_size(rules) + n_listeners;
+        counts[THRESHOLD_COST] = counts[THRESHOLD_RULES] + n_unrestricted;
+
+        printf("\n");
+        printf("listeners:                          %u\n", n_listeners);
+        printf("subscriptions:                      %u\n", n_subscriptions);
+        for (i = 0; i < _THRESHOLD_MAX; i++) {
+                printf("%-36s%ld", threshold_names[i], counts[i]);
+
+                if (arg.thresholds[i] >= 0 && counts[i] > arg.thresholds[i]) {
+                        printf(" (exceeds %ld)", arg.thresholds[i]);
+                        exceeded = true;
+                }
+
+                printf("\n");
+        }
+
+        g_hash_table_destroy(services);
+        g_hash_table_destroy(rules);
+
+        return exceeded ? EXIT_THRESHOLD : 0;
+}
+
+/* Copies a consistent snapshot of the statistics file. On failure
+ * returns NULL and sets *error, -EAGAIN if the file got replaced and
+ * has to be opened again. */
+static struct busactd_shm_stats *busactctl_stats_snapshot(const struct busactd_shm_stats *map, size_t size, int *error) {
+        struct busactd_shm_stats *s;
+        unsigned int tries;
+
+        s = malloc(size);
+        if (!s) {
+                *error = -ENOMEM;
+                return NULL;
+        }
+
+        for (tries = 0; tries < 1000; tries++) {
+                uint32_t seq;
+
+                if (__atomic_load_n(&map->replaced, __ATOMIC_ACQUIRE)) {
+                        *error = -EAGAIN;
+                        goto on_error;
+                }
+
+                seq = busactd_shm_read_begin(map);
+                memcpy(s, map, size);
+                if (busactd_shm_read_end(map, seq))
+                        return s;
+
+                usleep(100);
+        }
+
+        *error = -EBUSY;
+
+on_error:
+        free(s);
+        return NULL;
+}
+
+static int busactctl_stats_open(struct busactd_shm_stats **ret, size_t *ret_size) {
+        struct busactd_shm_stats *map;
+        struct stat st;
+        int fd, r = 0;
+
+        fd = open(arg.stats_path, O_RDONLY | O_CLOEXEC);
+        if (fd < 0)
+                return -errno;
+
+        if (fstat(fd, &st) < 0) {
+                r = -errno;
+                goto finish;
+        }
+
+        if ((size_t) st.st_size < sizeof(struct busactd_shm_stats)) {
+                r = -EBADMSG;
+                goto finish;
+        }
+
+        map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        if (map == MAP_FAILED) {
+                r = -errno;
+                goto finish;
+        }
+
+        if (map->magic != BUSACTD_SHM_STATS_MAGIC ||
+            map->version != BUSACTD_SHM_STATS_VERSION ||
+            map->size != (uint64_t) st.st_size) {
+                munmap(map, st.st_size);
+                r = -EPROTO;
+                goto finish;
+        }
+
+        *ret = map;
+        *ret_size = st.st_size;
+
+finish:
+        close(fd);
+        return r;
+}
+
+static guint64 busactctl_top_previous(GHashTable *previous, const char *busname) {
+        guint64 *v = g_hash_table_lookup(previous, busname);
+
+        return v ? *v : 0;
+}
+
+/* Busiest since the last update first */
+static gint busactctl_top_compare(gconstpointer a, gconstpointer b, gpointer user_data) {
+        const struct busactd_shm_listener *x = *(void * const *) a, *y = *(void * const *) b;
+        GHashTable *previous = user_data;
+        guint64 dx, dy;
+
+        dx = x->signals_forwarded - busactctl_top_previous(previous, x->busname);
+        dy = y->signals_forwarded - busactctl_top_previous(previous, y->busname);
+        if (dx != dy)
+                return dx > dy ? -1 : 1;
+
+        return strcmp(x->busname, y->busname);
+}
+
+static void busactctl_top_print(struct busactd_shm_stats *s, GHashTable *previous) {
+        GPtrArray *listeners;
+        unsigned int i;
+
+        printf("busactd: %u listeners, updated %.1fs ago\n\n",
+               s->n_listeners, (g_get_real_time() - s->updated) / 1e6);
+
+        for (i = 0; i < s->n_counters && i < BUSACTD_SHM_COUNTERS_MAX; i++) {
+                s->counters[i].name[BUSACTD_SHM_NAME_MAX - 1] = '\0';
+
+                if (s->counters[i].value)
+                        printf("%-36s%" PRIu64 "\n", s->counters[i].name, s->counters[i].value);
+        }
+
+        listeners = g_ptr_array_new();
+        for (i = 0; i < s->n_listeners && i < s->listener_capacity; i++) {
+                s->listeners[i].busname[BUSACTD_SHM_BUSNAME_MAX - 1] = '\0';
+                g_ptr_array_add(listeners, &s->listeners[i]);
+        }
+
+        g_ptr_array_sort_with_data(listeners, busactctl_top_compare, previous);
+
+        printf("\n%-48s %5s %7s %8s %12s %8s\n", "LISTENER", "OWNER", "MATCHES", "FWD/INT", "FORWARDED", "FAILED");
+        for (i = 0; i < listeners->len; i++) {
+                struct busactd_shm_listener *l = g_ptr_array_index(listeners, i);
+
+                printf("%-48s %5s %7u %8" PRIu64 " %12" PRIu64 " %8" PRIu64 "\n",
+                       l->busname,
+                       l->has_owner ? "yes" : "no",
+                       l->n_matches,
+                       l->signals_forwarded - busactctl_top_previous(previous, l->busname),
+                       l->signals_forwarded,
+                       l->signals_forward_failed);
+        }
+
+        g_hash_table_remove_all(previous);
+        for (i = 0; i < listeners->len; i++) {
+                struct busactd_shm_listener *l = g_ptr_array_index(listeners, i);
+                guint64 *v = g_new(guint64, 1);
+
+                *v = l->signals_forwarded;
+                g_hash_table_insert(previous, g_strdup(l->busname), v);
+        }
+
+        g_ptr_array_free(listeners, TRUE);
+}
+
+static int busactctl_top(int argc, char *argv[]) {
+        static const struct option options[] = {
+                { "path",               required_argument, NULL, 'p'    },
+                { "delay",              required_argument, NULL, 'd'    },
+                { "iterations",         required_argument, NULL, 'n'    },
+                { "batch",              no_argument,       NULL, 'b'    },
+                { "help",               no_argument,       NULL, 'h'    },
+                { NULL,                 0,                 NULL, 0      }
+        };
+
+        struct busactd_shm_stats *map = NULL;
+        GHashTable *previous;
+        size_t size = 0;
+        unsigned int n;
+        int c, r = 0;
+
+        while ((c = getopt_long(argc, argv, "p:d:n:bh", options, NULL)) >= 0) {
+
+                switch (c) {
+
+                case 'p':
+                        arg.stats_path = optarg;
+                        break;
+
+                case 'd':
+                        arg.delay = strtoul(optarg, NULL, 10);
+                        break;
+
+                case 'n':
+                        arg.iterations = strtoul(optarg, NULL, 10);
+                        break;
+
+                case 'b':
+                        arg.batch = true;
+                        break;
+
+                case 'h':
+                        busactctl_show_help();
+                        exit(EXIT_SUCCESS);
+
+                default:
+                        busactctl_show_help();
+                        return -EINVAL;
+                }
+        }
+
+        if (!isatty(STDOUT_FILENO))
+                arg.batch = true;
+
+        previous = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+
+        for (n = 0; !arg.iterations || n < arg.iterations; n++) {
+                struct busactd_shm_stats *s;
+
+                if (n > 0)
+                        sleep(arg.delay);
+
+                if (!map) {
+                        r = busactctl_stats_open(&map, &size);
+                        if (r < 0) {
+                                fprintf(stderr, "Failed to open %s: %s\n", arg.stats_path, strerror(-r));
+                                break;
+                        }
+                }
+
+                s = busactctl_stats_snapshot(map, size, &r);
+                if (!s) {
+                        munmap(map, size);
+                        map = NULL;
+
+                        if (r == -EAGAIN) {
+                                /* replaced by a bigger one, this turn does not count */
+                                n--;
+                                continue;
+                        }
+
+                        fprintf(stderr, "Failed to read %s: %s\n", arg.stats_path, strerror(-r));
+                        break;
+                }
+
+                if (!arg.batch)
+                        printf("\033[H\033[2J");
+                else if (n > 0)
+                        printf("\n");
+
+                busactctl_top_print(s, previous);
+                fflush(stdout);
+                free(s);
+                r = 0;
+        }
+
+        if (map)
+                munmap(map, size);
+        g_hash_table_destroy(previous);
+
+        return r;
+}
+
+int main(int argc, char *argv[]) {
+        int r;
+
+        if (argc < 2 || streq(argv[1], "-h") || streq(argv[1], "--help")) {
+                busactctl_show_help();
+                return argc < 2 ? EXIT_FAILURE : EXIT_SUCCESS;
+        }
+
+        if (streq(argv[1], "analyze"))
+                r = busactctl_analyze(argc - 1, argv + 1);
+        else if (streq(argv[1], "top"))
+                r = busactctl_top(argc - 1, argv + 1);
+        else {
+                fprintf(stderr, "Unknown command '%s'.\n", argv[1]);
+                busactctl_show_help();
+                return EXIT_FAILURE;
+        }
+
+        if (r < 0)
+                return EXIT_FAILURE;
+
+        return r;
+}
@@ -0,0 +1,240 @@
+/*-*- Mode: C; c-basic-offset: 8; indent-tabs-mode: nil -*-*/
+
+/*
+ * busactd
+ *
+ * Copyright (c) 2016 Samsung Electronics Co., Ltd.
+ *
+ * Licensed under the Apache License, Version 2.0 (the License);
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <assert.h>
+#include <glib.h>
+#include <gio/gio.h>
+#include <libsystem/libsystem.h>
+#include <libsystem/glib-util.h>
+
+#include "busactd.h"
+#include "activation.h"
+#include "queue.h"
+#include "log.h"
+
+#define BUSACTD_ACTIVATION_TIMEOUT_SLACK_USEC   G_USEC_PER_SEC
+
+static void busactd_activation_grant(struct busactd *busactd);
+
+static gint busactd_activation_compare(gconstpointer a, gconstpointer b, gpointer user_data) {
+        const struct busactd_listener *x = a, *y = b;
+
+        if (x->activation.priority != y->activation.priority)
+                return x->activation.priority < y->activation.priority ? -1 : 1;
+
+        if (x->activation.cost != y->activation.cost)
+                return x->activation.cost < y->activation.cost ? -1 : 1;
+
+        return 0;
+}
+
+/* 'started' tells whether the activation got anywhere, only then it
+ * counts towards the cost of the listener */
+static void busactd_activation_release(struct busactd_listener *listener, bool started) {
+        struct busactd *busactd = listener->busactd;
+        struct busactd_listener_activation *a = &listener->activation;
+        gint64 cost;
+
+        if (!a->in_flight)
+                return;
+
+        if (started) {
+                cost = g_get_monotonic_time() - a->start;
+                a->cost = a->cost ? (3 * a->cost + cost) / 4 : cost;
+        }
+
+        a->in_flight = false;
+        busactd_timer_disarm(&a->timeout);
+
+        busactd->activation.in_flight--;
+        busactd->stats.activations_in_flight = busactd->activation.in_flight;
+
+        busactd_activation_grant(busactd);
+}
+
+static void busactd_activation_timeout(struct busactd_timer *timer, void *userdata) {
+        struct busactd_listener *listener = userdata;
+
+        assert(listener);
+
+        log_info("Activation of %s timed out", listener->busname);
+
+        listener->busactd->stats.activations_timed_out++;
+        busactd_activation_release(listener, true);
+}
+
+static void busactd_activation_take(struct busactd_listener *listener) {
+        struct busactd *busactd = listener->busactd;
+        struct busactd_listener_activation *a = &listener->activation;
+
+        assert(!a->in_flight);
+
+        a->in_flight = true;
+        a->start = g_get_monotonic_time();
+        if (busactd->settings.activation_timeout_sec > 0) {
+                /* not armed while no slot is held */
+                busactd_timer_init(&a->timeout, busactd_activation_timeout, listener);
+                busactd_timer_arm(&a->timeout,
+                                  (gint64) busactd->settings.activation_timeout_sec * G_USEC_PER_SEC,
+                                  BUSACTD_ACTIVATION_TIMEOUT_SLACK_USEC);
+        }
+
+        busactd->activation.in_flight++;
+        busactd->stats.activations_started++;
+        busactd->stats.activations_in_flight = busactd->activation.in_flight;
+}
+
+/* Hands free slots to the waiting listeners and forwards what they
+ * have been holding. */
+static void busactd_activation_grant(struct busactd *busactd) {
+        struct busactd_stats *stats = &busactd->stats;
+
+        /* a forward failing below releases its slot and gets here */
+        if (busactd->activation.granting)
+                return;
+
+        busactd->activation.granting = true;
+
+        while (busactd->activation.n_waiting &&
+               busactd->activation.in_flight < (unsigned int) busactd->settings.activation_max_in_flight) {
+                GSequenceIter *first = g_sequence_get_begin_iter(busactd->activation.waiting);
+                struct busactd_listener *listener = g_sequence_get(first);
+                struct busactd_queue_item *item;
+
+                g_sequence_remove(first);
+                busactd->activation.n_waiting--;
+                listener->activation.waiting = NULL;
+
+                busactd_activation_take(listener);
+
+                while ((item = g_queue_pop_head(&listener->activation.items))) {
+                        gint64 wait = g_get_monotonic_time() - item->deferred;
+
+                        stats->activation_wait_usec_sum += wait;
+                        if ((guint64) wait > stats->activation_wait_usec_max)
+                                stats->activation_wait_usec_max = wait;
+
+                        busactd_queue_item_account(item);
+                        busactd_queue_item_forward(item);
+                        busactd_queue_item_free(item);
+                }
+        }
+
+        busactd->activation.granting = false;
+        stats->activations_waiting = busactd->activation.n_waiting;
+}
+
+/* Returns true if the signal can be forwarded now. Otherwise the item
+ * is taken over and forwarded once the listener got a slot. */
+bool busactd_activation_admit(struct busactd_queue_item *item) {
+        struct busactd_listener *listener;
+        struct busactd_listener_activation *a;
+        struct busactd *busactd;
+
+        assert(item);
+        listener = item->listener;
+        assert(listener);
+        busactd = listener->busactd;
+        a = &listener->activation;
+
+        if (busactd->settings.activation_max_in_flight <= 0)
+                return true;
+
+        /* running, or being started already */
+        if (listener->name_has_owner == NAME_HAS_OWNER_TRUE || a->in_flight)
+                return true;
+
+        if (!busactd->activation.n_waiting &&
+            busactd->activation.in_flight < (unsigned int) busactd->settings.activation_max_in_flight) {
+                busactd_activation_take(listener);
+                return true;
+        }
+
+        item->deferred = g_get_monotonic_time();
+        g_queue_push_tail(&a->items, item);
+        busactd->stats.activation_signals_deferred++;
+
+        if (!busactd->activation.waiting)
+                busactd->activation.waiting = g_sequence_new(NULL);
+
+        if (!a->waiting) {
+                a->priority = item->priority;
+                a->waiting = g_sequence_insert_sorted(busactd->activation.waiting, listener,
+                                                      busactd_activation_compare, NULL);
+                busactd->activation.n_waiting++;
+        } else if (item->priority < a->priority) {
+                a->priority = item->priority;
+                g_sequence_sort_changed(a->waiting, busactd_activation_compare, NULL);
+        }
+
+        busactd->stats.activations_waiting = busactd->activation.n_waiting;
+
+        return false;
+}
+
+void busactd_activation_owner_changed(struct busactd_listener *listener) {
+
+        assert(listener);
+
+        if (listener->name_has_owner != NAME_HAS_OWNER_TRUE || !listener->activation.in_flight)
+                return;
+
+        listener->busactd->stats.activations_completed++;
+        busactd_activation_release(listener, true);
+}
+
+/* Nothing reached the bus to start the listener, so its slot is free
+ * again right away instead of once the activation timed out. */
+void busactd_activation_forward_failed(struct busactd_listener *listener) {
+
+        assert(listener);
+
+        if (!listener->activation.in_flight)
+                return;
+
+        listener->busactd->stats.activations_failed++;
+        busactd_activation_release(listener, false);
+}
+
+/* Called before the listener goes away, the signals it held are lost. */
+void busactd_activation_drop_listener(struct busactd_listener *listener) {
+        struct busactd *busactd;
+        struct busactd_listener_activation *a;
+
+        assert(listener);
+        busactd = listener->busactd;
+        a = &listener->activation;
+
+        if (a->waiting) {
+                g_sequence_remove(a->waiting);
+                a->waiting = NULL;
+                busactd->activation.n_waiting--;
+                busactd->stats.activations_waiting = busactd->activation.n_waiting;
+        }
+
+        g_queue_foreach(&a->items, (GFunc) busactd_queue_item_free, NULL);
+        g_queue_clear(&a->items);
+
+        busactd_activation_release(listener, false);
+}
@@ -0,0 +1,62 @@
+/*-*- Mode: C; c-basic-offset: 8; indent-tabs-mode: nil -*-*/
+
+/*
+ * busactd
+ *
+ * Copyright (c) 2016 Samsung Electronics Co., Ltd.
+ *
+ * Licensed under the Apache License, Version 2.0 (the License);
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#pragma once
+
+#include <stdbool.h>
+#include <glib.h>
+
+#include "queue.h"
+#include "timer.h"
+
+struct busactd;
+struct busactd_listener;
+struct busactd_queue_item;
+
+/* Activation state of one listener. A slot is held from forwarding the
+ * first signal to a listener without owner until its owner appears,
+ * forwarding fails or the activation times out. */
+struct busactd_listener_activation {
+        bool in_flight;
+        /* in busactd->activation.waiting, NULL if not waiting */
+        GSequenceIter *waiting;
+        gint64 start;
+        struct busactd_timer timeout;
+        /* moving average of past activations, in usec */
+        gint64 cost;
+        /* signals held back while no slot is free */
+        GQueue items;
+        enum busactd_priority priority;
+};
+
+/* Listeners waiting for a slot, most urgent and cheapest first */
+struct busactd_activation {
+        unsigned int in_flight;
+        GSequence *waiting;
+        unsigned int n_waiting;
+        /* slots freed meanwhile are handed out by the running grant */
+        bool granting;
+};
+
+bool busactd_activation_admit(struct busactd_queue_item *item);
+void busactd_activation_owner_changed(struct busactd_listener *listener);
+void busactd_activation_forward_failed(struct busactd_listener *listener);
+void busactd_activation_drop_listener(struct busactd_listener *listener);
@@ -19,6 +19,9 @@
  */
 
 #include <stdlib.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
 #include <stdbool.h>
 #include <errno.h>
 #include <assert.h>
@@ -29,6 +32,160 @@
 
 #include "busactd.h"
 #include "log.h"
+#include "trace.h"
+
+/* D-Bus names are at most 255 bytes, one of each, ':' and NUL */
+#define BUSACTD_SIGNAL_INDEX_KEY_MAX    (255 + 1 + 255 + 1)
+
+void busactd_bump_generation(struct busactd *busactd) {
+
+        assert(busactd);
+
+        busactd->generation++;
+}
+
+/* A listener or match entered or left listener_list */
+static void busactd_registry_changed(struct busactd *busactd) {
+
+        assert(busactd);
+
+        busactd->registry_generation++;
+        busactd_bump_generation(busactd);
+}
+
+/* Key of 'interface' and 'member' in signal_index, a NULL one is
+ * empty, which no valid name is */
+static void busactd_signal_index_key(char key[BUSACTD_SIGNAL_INDEX_KEY_MAX], const char *interface, const char *member) {
+        snprintf(key, BUSACTD_SIGNAL_INDEX_KEY_MAX, "%s:%s",
+                 interface ? interface : "",
+                 member ? member : "");
+}
+
+static int busactd_signal_index_add(struct busactd *busactd, struct busactd_match *match) {
+        char key[BUSACTD_SIGNAL_INDEX_KEY_MAX];
+        GPtrArray *matches;
+
+        /* signals dispatched have no sender */
+        if (match->sender)
+                return 0;
+
+        if (!busactd->signal_index) {
+                busactd->signal_index = g_hash_table_new_full(g_str_hash, g_str_equal, free,
+                                                              (GDestroyNotify) g_ptr_array_unref);
+                if (!busactd->signal_index)
+                        return -ENOMEM;
+        }
+
+        busactd_signal_index_key(key, match->interface, match->member);
+        matches = g_hash_table_lookup(busactd->signal_index, key);
+        if (!matches) {
+                char *k = strdup(key);
+
+                if (!k)
+                        return -ENOMEM;
+
+                matches = g_ptr_array_new();
+                g_hash_table_insert(busactd->signal_index, k, matches);
+        }
+
+        g_ptr_array_add(matches, match);
+
+        return 0;
+}
+
+static void busactd_signal_index_remove(struct busactd *busactd, struct busactd_match *match) {
+        char key[BUSACTD_SIGNAL_INDEX_KEY_MAX];
+        GPtrArray *matches;
+
+        if (match->sender || !busactd->signal_index)
+                return;
+
+        busactd_signal_index_key(key, match->interface, match->member);
+        matches = g_hash_table_lookup(busactd->signal_index, key);
+        if (!matches)
+                return;
+
+        g_ptr_array_remove(matches, match);
+        if (!matches->len)
+                g_hash_table_remove(busactd->signal_index, key);
+}
+
+/* Gives 'match' its id on entering the registry of 'busactd' */
+static void busactd_match_enter(struct busactd *busactd, struct busactd_match *match) {
+
+        assert(busactd);
+        assert(match);
+
+        if (!++busactd->last_match_id)
+                busactd->last_match_id++;
+
+        match->id = busactd->last_match_id;
+        busactd_memory_account_match(match, 1);
+
+        if (busactd_signal_index_add(busactd, match) < 0)
+                log_err("Failed to index match of %s", match->listener->busname);
+}
+
+/* 'match' leaves the registry of 'busactd' */
+static void busactd_match_leave(struct busactd *busactd, struct busactd_match *match) {
+
+        assert(busactd);
+        assert(match);
+
+        busactd_memory_account_match(match, -1);
+        busactd_signal_index_remove(busactd, match);
+}
+
+/* The template of several buses keeps the parsed listeners, but it is
+ * only busy while one of the buses has some. */
+bool busactd_is_idle(struct busactd *busactd) {
+        GList *l;
+
+        assert(busactd);
+
+        if (busactd->load.running)
+                return false;
+
+        if (!busactd->instances)
+                return !busactd->listener_list;
+
+        FOREACH_G_LIST(l, busactd->instances) {
+                struct busactd *instance = l->data;
+
+                if (instance->listener_list || instance->load.running)
+                        return false;
+        }
+
+        return true;
+}
+
+/* Exiting when idle is decided on listener changes, not polled */
+void busactd_idle_update(struct busactd *busactd) {
+
+        assert(busactd);
+
+        if (busactd->template)
+                busactd = busactd->template;
+
+        if (!busactd->idle_timer.func)
+                return;
+
+        if (!busactd_is_idle(busactd))
+                busactd_timer_disarm(&busactd->idle_timer);
+        else if (!busactd->idle_timer.armed)
+                busactd_timer_arm(&busactd->idle_timer,
+                                  BUSACTD_IDLE_TIMEOUT_SEC * G_USEC_PER_SEC,
+                                  BUSACTD_IDLE_TIMEOUT_SEC * G_USEC_PER_SEC / 2);
+}
+
+void busactd_startup_account(struct busactd *busactd, enum busactd_startup_phase phase, gint64 since) {
+
+        assert(busactd);
+        assert(phase >= 0 && phase < _BUSACTD_STARTUP_PHASE_MAX);
+
+        busactd->startup.usec[phase] += g_get_monotonic_time() - since;
+        busactd->startup.count[phase]++;
+}
 
 struct busactd_listener *busactd_listener_new(struct busactd *busactd) {
         struct busactd_listener *listener;
@@ -39,6 +196,8 @@ struct busactd_listener *busactd_listener_new(struct busactd *busactd) {
 
         listener->busactd = busactd;
         listener->name_has_owner = NAME_HAS_OWNER_UNDECIDED;
+        listener->priority = BUSACTD_PRIORITY_NORMAL;
+        listener->load_phase = _BUSACTD_PRIORITY_INVALID;
         listener->ref_count++;
         listener->l_id = 0;
 
@@ -74,6 +233,19 @@ int busactd_listener_busname_compare_func(struct busactd_listener *listener, con
         return strcmp(listener->busname, busname);
 }
 
+struct busactd_listener *busactd_find_listener(struct busactd *busactd, const char *busname) {
+        GList *list;
+
+        assert(busactd);
+        assert(busname);
+
+        list = g_list_find_custom(busactd->listener_list,
+                                  busname,
+                                  (GCompareFunc) busactd_listener_busname_compare_func);
+
+        return list ? list->data : NULL;
+}
+
 struct busactd_listener *busactd_listener_get(struct busactd *busactd, const char *busname) {
         struct busactd_listener *listener;
         GList *list;
@@ -97,6 +269,44 @@ struct busactd_listener *busactd_listener_get(struct busactd *busactd, const cha
         return listener;
 }
 
+struct busactd_rule *busactd_rule_new(const char *string) {
+        struct busactd_rule *rule;
+        size_t len;
+
+        assert(string);
+
+        len = strlen(string);
+        rule = malloc(sizeof(struct busactd_rule) + len + 1);
+        if (!rule)
+                return NULL;
+
+        rule->n_ref = 1;
+        rule->filter = NULL;
+        rule->size = len + 1;
+        memcpy(rule->string, string, len + 1);
+
+        return rule;
+}
+
+struct busactd_rule *busactd_rule_ref(struct busactd_rule *rule) {
+
+        if (rule)
+                g_atomic_int_inc(&rule->n_ref);
+
+        return rule;
+}
+
+void busactd_rule_unref(struct busactd_rule *rule) {
+
+        if (!rule)
+                return;
+
+        if (g_atomic_int_dec_and_test(&rule->n_ref)) {
+                busactd_filter_free(rule->filter);
+                free(rule);
+        }
+}
+
 struct busactd_match *busactd_match_new(struct busactd_listener *listener) {
         struct busactd_match *match;
 
@@ -107,20 +317,83 @@ struct busactd_match *busactd_match_new(struct busactd_listener *listener) {
                 return NULL;
 
         match->listener = listener;
+        match->uid = BUSACTD_UID_INVALID;
+        match->priority = _BUSACTD_PRIORITY_INVALID;
 
         return match;
 }
 
+/* The copy shares the parsed rule with the original, only the runtime
+ * state (subscription, owner) is its own. */
+struct busactd_match *busactd_match_clone(struct busactd_match *match, struct busactd_listener *listener) {
+        struct busactd_match *m;
+
+        assert(match);
+        assert(listener);
+        assert(!match->client);
+
+        m = busactd_match_new(listener);
+        if (!m)
+                return NULL;
+
+        m->type = match->type;
+        m->flags = match->flags;
+        m->priority = match->priority;
+        m->rule = busactd_rule_ref(match->rule);
+        m->sender = match->sender;
+        m->path = match->path;
+        m->interface = match->interface;
+        m->member = match->member;
+        m->arg = match->arg;
+        m->filter = match->filter;
+
+        return m;
+}
+
+struct busactd_listener *busactd_listener_clone(struct busactd_listener *listener, struct busactd *busactd) {
+        struct busactd_listener *l;
+        GList *list;
+
+        assert(listener);
+        assert(busactd);
+
+        l = busactd_listener_new(busactd);
+        if (!l)
+                return NULL;
+
+        l->priority = listener->priority;
+        l->load_phase = listener->load_phase;
+        l->busname = strdup(listener->busname);
+        if (!l->busname)
+                goto on_error;
+
+        FOREACH_G_LIST(list, listener->match_list) {
+                struct busactd_match *m;
+
+                m = busactd_match_clone(list->data, l);
+                if (!m)
+                        goto on_error;
+
+                l->match_list = g_list_prepend(l->match_list, m);
+        }
+
+        l->match_list = g_list_reverse(l->match_list);
+
+        return l;
+
+on_error:
+        busactd_listener_free(l);
+
+        return NULL;
+}
+
 void busactd_match_free(struct busactd_match *match) {
 
         if (!match)
                 return;
 
-        free(match->sender);
-        free(match->path);
-        free(match->interface);
-        free(match->member);
-        free(match->arg);
+        free(match->client);
+        busactd_rule_unref(match->rule);
         free(match);
 }
 
@@ -129,11 +402,15 @@ static int busactd_listener_update_name_has_owner(struct busactd_listener *liste
         g_autoptr(GError) error = NULL;
         g_autoptr(GVariant) gvar = NULL;
         bool has_owner;
+        gint64 start;
 
         assert(listener);
         busactd = listener->busactd;
         assert(busactd);
 
+        start = g_get_monotonic_time();
+        busactd_lag_enter("NameHasOwner call");
+
         gvar = g_dbus_connection_call_sync(busactd->bus->connection,
                                            "org.freedesktop.DBus",
                                            "/org/freedesktop/DBus",
@@ -147,6 +424,9 @@ static int busactd_listener_update_name_has_owner(struct busactd_listener *liste
                                            NULL,
                                            &error);
 
+        busactd_lag_leave();
+        busactd_startup_account(busactd, BUSACTD_STARTUP_OWNERSHIP_QUERY, start);
+
         g_variant_get(gvar, "(b)", &has_owner);
 
         listener->name_has_owner = has_owner ? NAME_HAS_OWNER_TRUE : NAME_HAS_OWNER_FALSE;
@@ -165,6 +445,7 @@ static void busactd_dbus_name_owner_changed_callback(
 
         _cleanup_free_ const char *arg_0 = NULL, *arg_1 = NULL, *arg_2 = NULL;
         struct busactd_listener *listener = user_data;
+        IsNameHasOwner has_owner;
 
         assert(user_data);
 
@@ -182,29 +463,45 @@ static void busactd_dbus_name_owner_changed_callback(
 
         assert(streq(listener->busname, arg_0));
 
-        if (isempty(arg_2))
-                listener->name_has_owner = NAME_HAS_OWNER_FALSE;
-        else
-                listener->name_has_owner = NAME_HAS_OWNER_TRUE;
+        has_owner = isempty(arg_2) ? NAME_HAS_OWNER_FALSE : NAME_HAS_OWNER_TRUE;
+        if (listener->name_has_owner == has_owner)
+                return;
+
+        listener->name_has_owner = has_owner;
+        trace_owner_changed(listener->busname, has_owner);
+        busactd_timer_activity();
 
+        busactd_lag_enter("NameOwnerChanged");
         busactd_register_listener(listener);
+        busactd_predict_owner_changed(listener);
+        busactd_activation_owner_changed(listener);
+        busactd_lag_leave();
+
+        busactd_dbus_queue_change(listener->busactd,
+                                  BUSACTD_CHANGE_LISTENER_OWNER_CHANGED,
+                                  listener,
+                                  NULL);
 }
 
-static void busactd_dbus_subscribe_signal_callback(
-                GDBusConnection *connection,
-                const gchar *sender_name,
-                const gchar *object_path,
-                const gchar *interface_name,
-                const gchar *signal_name,
-                GVariant *parameters,
-                void *userdata) {
+bool busactd_listener_forward_signal(struct busactd_listener *listener,
+                                           const char *sender_name,
+                                           const char *object_path,
+                                           const char *interface_name,
+                                           const char *signal_name,
+                                           GVariant *parameters) {
 
-        struct busactd_listener *listener = userdata;
+        struct busactd *busactd;
         g_autoptr(GError) error = NULL;
+        GDBusConnection *connection;
 
         assert(listener);
+        busactd = listener->busactd;
+
+        trace_emit_start(listener->busname, signal_name);
 
-        if (!g_dbus_connection_emit_signal(connection,
+        connection = busactd_listener_get_connection(listener);
+        if (!connection ||
+            !g_dbus_connection_emit_signal(connection,
                                            listener->busname,
                                            object_path,
                                            interface_name,
@@ -213,14 +510,177 @@ static void busactd_dbus_subscribe_signal_callback(
                                            &error)) {
                 log_err("Failed to emit signal"
                         "(busname(%s), path(%s), interface(%s), signal(%s)): %s\n",
-                        listener->busname, object_path, interface_name, signal_name, error->message);
-
-                return;
+                        listener->busname, object_path, interface_name, signal_name,
+                        error ? error->message : "not connected");
+                busactd->stats.signals_forward_failed++;
+                listener->signals_forward_failed++;
+                trace_emit_end(listener->busname, signal_name, 0);
+                busactd_activation_forward_failed(listener);
+
+                return false;
         }
 
+        busactd->stats.signals_forwarded++;
+        listener->signals_forwarded++;
+        trace_emit_end(listener->busname, signal_name, 1);
+        busactd_predict_trigger(listener);
+
         log_dbg("emit signal:"
                 "busname(%s), sender(%s), object(%s), interface(%s), signal(%s)",
                 listener->busname, sender_name, object_path, interface_name, signal_name);
+
+        return true;
+}
+
+/* Whether the body of a signal passes the filter of the match */
+static bool busactd_match_filter(struct busactd_match *match, GVariant *parameters) {
+        struct busactd_stats *stats;
+        unsigned int steps = 0;
+        bool pass;
+
+        assert(match);
+
+        if (!match->rule || !match->rule->filter)
+                return true;
+
+        pass = busactd_filter_eval(match->rule->filter, parameters, &steps);
+
+        stats = &match->listener->busactd->stats;
+        stats->filter_evaluations++;
+        stats->filter_steps += steps;
+        if (!pass)
+                stats->filter_dropped++;
+
+        return pass;
+}
+
+static void busactd_dbus_subscribe_signal_callback(
+                GDBusConnection *connection,
+                const gchar *sender_name,
+                const gchar *object_path,
+                const gchar *interface_name,
+                const gchar *signal_name,
+                GVariant *parameters,
+                void *userdata) {
+
+        struct busactd_match *match = userdata;
+
+        assert(match);
+
+        busactd_timer_activity();
+
+        if (!busactd_match_filter(match, parameters))
+                return;
+
+        trace_match_hit(match->listener->busname, match->id);
+
+        (void) busactd_queue_signal(match->listener, busactd_match_get_priority(match),
+                                    sender_name, object_path, interface_name, signal_name,
+                                    parameters);
+}
+
+static bool busactd_match_test_signal(struct busactd_match *match,
+                                      const char *object_path,
+                                      const char *interface_name,
+                                      const char *signal_name,
+                                      GVariant *parameters) {
+
+        g_autoptr(GVariant) arg0 = NULL;
+
+        assert(match);
+
+        /* Signals arriving without a bus have no sender to match. */
+        if (match->sender)
+                return false;
+
+        if (match->path && !streq_ptr(match->path, object_path))
+                return false;
+
+        if (match->interface && !streq_ptr(match->interface, interface_name))
+                return false;
+
+        if (match->member && !streq_ptr(match->member, signal_name))
+                return false;
+
+        if (!match->arg)
+                return busactd_match_filter(match, parameters);
+
+        if (!parameters || g_variant_n_children(parameters) < 1)
+                return false;
+
+        arg0 = g_variant_get_child_value(parameters, 0);
+        if (!g_variant_is_of_type(arg0, G_VARIANT_TYPE_STRING) &&
+            !g_variant_is_of_type(arg0, G_VARIANT_TYPE_OBJECT_PATH))
+                return false;
+
+        return streq(match->arg, g_variant_get_string(arg0, NULL)) &&
+               busactd_match_filter(match, parameters);
+}
+
+/* Forwards a signal which did not come through the bus, e.g. from a
+ * peer to peer connection, to every listener having a matching rule.
+ * Unlike signals seen on the bus, the target never got it itself, so it
+ * is forwarded whether the listener is running or not. Only the rules
+ * naming the interface and member of the signal, or leaving them out,
+ * are tested, the most specific ones first. */
+unsigned int busactd_dispatch_signal(struct busactd *busactd,
+                                     const char *object_path,
+                                     const char *interface_name,
+                                     const char *signal_name,
+                                     GVariant *parameters) {
+
+        const char *keys[][2] = {
+                { interface_name, signal_name },
+                { interface_name, NULL },
+                { NULL, signal_name },
+                { NULL, NULL },
+        };
+        unsigned int i, j, n = 0;
+        guint64 serial;
+
+        assert(busactd);
+
+        if (!busactd->signal_index)
+                return 0;
+
+        serial = ++busactd->dispatch_serial;
+
+        for (i = 0; i < G_N_ELEMENTS(keys); i++) {
+                char key[BUSACTD_SIGNAL_INDEX_KEY_MAX];
+                GPtrArray *matches;
+
+                /* without an interface the first two are the last two */
+                if (!interface_name && i < 2)
+                        continue;
+
+                busactd_signal_index_key(key, keys[i][0], keys[i][1]);
+                matches = g_hash_table_lookup(busactd->signal_index, key);
+                if (!matches)
+                        continue;
+
+                for (j = 0; j < matches->len; j++) {
+                        struct busactd_match *match = g_ptr_array_index(matches, j);
+                        struct busactd_listener *listener = match->listener;
+
+                        /* once per listener */
+                        if (listener->dispatch_serial == serial)
+                                continue;
+
+                        if (!busactd_match_test_signal(match, object_path, interface_name,
+                                                       signal_name, parameters))
+                                continue;
+
+                        listener->dispatch_serial = serial;
+                        trace_match_hit(listener->busname, match->id);
+
+                        if (busactd_queue_signal(listener, busactd_match_get_priority(match),
+                                                 NULL, object_path, interface_name, signal_name,
+                                                 parameters) >= 0)
+                                n++;
+                }
+        }
+
+        return n;
 }
 
 static void busactd_listener_subscribe_signal(struct busactd_listener *listener) {
@@ -234,9 +694,12 @@ static void busactd_listener_subscribe_signal(struct busactd_listener *listener)
         FOREACH_G_LIST(list, listener->match_list) {
                 struct busactd_match *match = list->data;
 
+                gint64 start;
+
                 if (match->m_id)
                         continue;
 
+                start = g_get_monotonic_time();
                 match->m_id = g_dbus_connection_signal_subscribe(busactd->bus->connection,
                                                                  match->sender ? match->sender : NULL,
                                                                  match->interface ? match->interface : NULL,
@@ -245,43 +708,58 @@ static void busactd_listener_subscribe_signal(struct busactd_listener *listener)
                                                                  match->arg ? match->arg : NULL,
                                                                  G_DBUS_SIGNAL_FLAGS_NONE,
                                                                  busactd_dbus_subscribe_signal_callback,
-                                                                 listener,
+                                                                 match,
                                                                  NULL);
+                busactd_startup_account(busactd, BUSACTD_STARTUP_ADD_MATCH, start);
+
                 if (!match->m_id)
                         log_dbg("Failed to subscribe signal:"
                                 "sender(%s), path(%s), interface(%s), member(%s), arg(%s)",
                                 match->sender, match->path, match->interface, match->member, match->arg);
-                else
+                else {
+                        busactd_memory_account_subscription(listener, match, 1);
+                        trace_subscribe(listener->busname, match->m_id);
                         log_dbg("Start subscribe signal:"
                                 "sender(%s), path(%s), interface(%s), member(%s), arg(%s)",
                                 match->sender, match->path, match->interface, match->member, match->arg);
+                }
         }
 }
 
-static void busactd_listener_unsubscribe_signal(struct busactd_listener *listener) {
-        struct busactd *busactd;
-        GList *list;
+/* The subscription carries the match as user data, so it has to go
+ * before the match is freed. */
+static void busactd_match_unsubscribe(struct busactd_match *match) {
+        struct busactd_listener *listener;
+        GDBusConnection *connection;
 
+        assert(match);
+        listener = match->listener;
         assert(listener);
-        busactd = listener->busactd;
-        assert(busactd);
 
-        FOREACH_G_LIST(list, listener->match_list) {
-                struct busactd_match *match = list->data;
+        if (!match->m_id)
+                return;
 
-                if (!match->m_id)
-                        continue;
+        log_dbg("Stop subscribe signal:"
+                "sender(%s), path(%s), interface(%s), member(%s), arg(%s)",
+                match->sender, match->path, match->interface, match->member, match->arg);
 
-                log_dbg("Stop subscribe signal:"
-                        "sender(%s), path(%s), interface(%s), member(%s), arg(%s)",
-                        match->sender, match->path, match->interface, match->member, match->arg);
+        trace_unsubscribe(listener->busname, match->m_id);
 
-                g_dbus_connection_signal_unsubscribe(
-                        busactd->bus->connection,
-                        match->m_id);
+        connection = busactd_listener_get_connection(listener);
+        if (connection)
+                g_dbus_connection_signal_unsubscribe(connection, match->m_id);
 
-                match->m_id = 0;
-        }
+        busactd_memory_account_subscription(listener, match, -1);
+        match->m_id = 0;
+}
+
+static void busactd_listener_unsubscribe_signal(struct busactd_listener *listener) {
+        GList *list;
+
+        assert(listener);
+
+        FOREACH_G_LIST(list, listener->match_list)
+                busactd_match_unsubscribe(list->data);
 }
 
 void busactd_register_listener(struct busactd_listener *listener) {
@@ -291,12 +769,17 @@ void busactd_register_listener(struct busactd_listener *listener) {
         busactd = listener->busactd;
         assert(busactd);
 
+        assert(busactd->bus);
+        assert(busactd->bus->connection);
+
+        busactd_bump_generation(busactd);
+
         if (listener->name_has_owner == NAME_HAS_OWNER_UNDECIDED)
                 busactd_listener_update_name_has_owner(listener);
 
         /* If already subscribe for this listener then do not
          * subscribe NameOwnerChanged signal more. */
-        if (!listener->l_id)
+        if (!listener->l_id) {
                 listener->l_id = g_dbus_connection_signal_subscribe(
                         busactd->bus->connection,                       // connection
                         "org.freedesktop.DBus",                         // sender name
@@ -308,6 +791,9 @@ void busactd_register_listener(struct busactd_listener *listener) {
                         busactd_dbus_name_owner_changed_callback,       // callback function
                         listener,                                       // user data
                         NULL);                                          // function to free user data
+                if (listener->l_id)
+                        busactd_memory_account_subscription(listener, NULL, 1);
+        }
 
         switch (listener->name_has_owner) {
         case NAME_HAS_OWNER_FALSE:
@@ -323,6 +809,36 @@ void busactd_register_listener(struct busactd_listener *listener) {
         }
 }
 
+/* Drops every subscription of 'listener' */
+void busactd_unregister_listener(struct busactd_listener *listener) {
+        GDBusConnection *connection;
+
+        assert(listener);
+
+        busactd_listener_unsubscribe_signal(listener);
+
+        /* NameOwnerChanged carries the listener as user data */
+        connection = busactd_listener_get_connection(listener);
+        if (listener->l_id && connection)
+                g_dbus_connection_signal_unsubscribe(connection, listener->l_id);
+
+        if (listener->l_id)
+                busactd_memory_account_subscription(listener, NULL, -1);
+
+        listener->l_id = 0;
+}
+
+/* The bus connection of 'listener', NULL while there is none */
+GDBusConnection *busactd_listener_get_connection(struct busactd_listener *listener) {
+
+        assert(listener);
+
+        return listener->busactd->bus ? listener->busactd->bus->connection : NULL;
+}
+
+/* Only enters 'listener' into the registry, merging it with the one of
+ * the same busname. Nothing is subscribed on the bus before
+ * busactd_register_listener() is called on the result. */
 struct busactd_listener *busactd_add_listener(struct busactd_listener *listener) {
         struct busactd *busactd = listener->busactd;
         struct busactd_listener *l;
@@ -336,7 +852,14 @@ struct busactd_listener *busactd_add_listener(struct busactd_listener *listener)
                                   (GCompareFunc) busactd_listener_busname_compare_func);
         if (!list) {
                 busactd->listener_list = g_list_append(busactd->listener_list, listener);
-                busactd_register_listener(listener);
+                listener->in_registry = true;
+
+                busactd_memory_account_listener(listener, 1);
+                FOREACH_G_LIST(list, listener->match_list)
+                        busactd_match_enter(busactd, list->data);
+
+                busactd_registry_changed(busactd);
+                busactd_idle_update(busactd);
 
                 return listener;
         }
@@ -346,24 +869,48 @@ struct busactd_listener *busactd_add_listener(struct busactd_listener *listener)
         assert(l);
 
         if (l != listener) {
+                /* Several files for one name, the highest priority wins */
+                if (listener->priority < l->priority)
+                        l->priority = listener->priority;
+
+                FOREACH_G_LIST(list, listener->match_list) {
+                        struct busactd_match *match = list->data;
+
+                        match->listener = l;
+                        busactd_match_enter(busactd, match);
+                }
+
                 l->match_list = g_list_concat(l->match_list, listener->match_list);
                 free(listener->busname);
                 free(listener);
+                busactd_registry_changed(busactd);
         }
 
-        busactd_register_listener(l);
-
         return l;
 }
 
 void busactd_remove_listener(struct busactd_listener *listener) {
         struct busactd *busactd = listener->busactd;
+        GList *list;
 
         if (!listener)
                 return;
 
         busactd->listener_list = g_list_remove(busactd->listener_list, listener);
+        listener->in_registry = false;
+
+        busactd_memory_account_listener(listener, -1);
+        FOREACH_G_LIST(list, listener->match_list)
+                busactd_match_leave(busactd, list->data);
+        busactd_memory_released(busactd, busactd_memory_listener_size(listener));
+
+        busactd_unregister_listener(listener);
+
+        busactd_queue_drop_listener(busactd, listener);
+        busactd_activation_drop_listener(listener);
         busactd_listener_free(listener);
+        busactd_registry_changed(busactd);
+        busactd_idle_update(busactd);
 }
 
 int busactd_match_compare_func(struct busactd_match *a, struct busactd_match *b) {
@@ -371,17 +918,22 @@ int busactd_match_compare_func(struct busactd_match *a, struct busactd_match *b)
         assert(a);
         assert(b);
 
-        if (streq_ptr(a->sender, b->sender) &&
+        if (streq_ptr(a->client, b->client) &&
+            streq_ptr(a->sender, b->sender) &&
             streq_ptr(a->path, b->path) &&
             streq_ptr(a->interface, b->interface) &&
             streq_ptr(a->member, b->member) &&
-            streq_ptr(a->arg, b->arg))
+            streq_ptr(a->arg, b->arg) &&
+            streq_ptr(a->filter, b->filter))
                 return 0;
 
         return 1;
 }
 
-struct busactd_match *busactd_add_match(struct busactd_match *match) {
+/* Enters 'match' into the registry like busactd_add_listener(). Returns
+ * the equal match already there instead, freeing 'match'; 'added' tells
+ * which one it is. */
+struct busactd_match *busactd_add_match(struct busactd_match *match, bool *added) {
         struct busactd_listener *listener;
         struct busactd_match *m;
         GList *list;
@@ -393,9 +945,24 @@ struct busactd_match *busactd_add_match(struct busactd_match *match) {
         list = g_list_find_custom(listener->match_list,
                                   match,
                                   (GCompareFunc) busactd_match_compare_func);
+        if (added)
+                *added = !list;
+
         if (!list) {
+                if (match->type == BUSACTD_MATCH_TYPE_RUNTIME) {
+                        busactd_client_account_match(match, 1);
+                        listener->busactd->stats.subscriptions_added++;
+                }
+
+                /* a new listener gets its matches entered with it */
+                if (listener->in_registry) {
+                        busactd_match_enter(listener->busactd, match);
+                        busactd_registry_changed(listener->busactd);
+                }
+
                 listener->match_list = g_list_append(listener->match_list, match);
-                busactd_add_listener(listener);
+                (void) busactd_add_listener(listener);
+
                 return match;
         }
 
@@ -417,8 +984,21 @@ void busactd_remove_match(struct busactd_match *match) {
 
         assert(listener);
 
+        busactd_dbus_queue_change(listener->busactd,
+                                  BUSACTD_CHANGE_SUBSCRIPTION_REMOVED,
+                                  listener,
+                                  match);
+
+        busactd_client_account_match(match, -1);
+        listener->busactd->stats.subscriptions_removed++;
+
+        busactd_match_unsubscribe(match);
+
         listener->match_list = g_list_remove(listener->match_list, match);
+        busactd_match_leave(listener->busactd, match);
+        busactd_memory_released(listener->busactd, busactd_memory_match_size(match));
         busactd_match_free(match);
+        busactd_registry_changed(listener->busactd);
 
         if (g_list_length(listener->match_list))
                 return;
@@ -426,6 +1006,33 @@ void busactd_remove_match(struct busactd_match *match) {
         busactd_remove_listener(listener);
 }
 
+void busactd_remove_client_matches(struct busactd *busactd, const char *client) {
+        GList *l_list, *matches = NULL, *list;
+
+        assert(busactd);
+        assert(client);
+
+        FOREACH_G_LIST(l_list, busactd->listener_list) {
+                struct busactd_listener *listener = l_list->data;
+                GList *m_list;
+
+                FOREACH_G_LIST(m_list, listener->match_list) {
+                        struct busactd_match *match = m_list->data;
+
+                        if (match->flags & BUSACTD_SUBSCRIPTION_FLAG_KEEP)
+                                continue;
+
+                        if (streq_ptr(match->client, client))
+                                matches = g_list_prepend(matches, match);
+                }
+        }
+
+        FOREACH_G_LIST(list, matches)
+                busactd_remove_match(list->data);
+
+        g_list_free(matches);
+}
+
 struct busactd_match *busactd_find_match_by_id(struct busactd *busactd, unsigned int id) {
         GList *l_list;
 
@@ -443,7 +1050,7 @@ struct busactd_match *busactd_find_match_by_id(struct busactd *busactd, unsigned
                 FOREACH_G_LIST(m_list, listener->match_list) {
                         struct busactd_match *match = m_list->data;
 
-                        if (match->m_id == id)
+                        if (match->id == id)
                                 return match;
                 }
         }
@@ -451,10 +1058,255 @@ struct busactd_match *busactd_find_match_by_id(struct busactd *busactd, unsigned
         return NULL;
 }
 
-int busactd_match_new_from_string(struct busactd_listener *listener, const char *string, struct busactd_match **match) {
+static const char * const busactd_match_type_table[_BUSACTD_MATCH_TYPE_MAX] = {
+        [BUSACTD_MATCH_TYPE_PERSISTENT] = "PERSISTENT",
+        [BUSACTD_MATCH_TYPE_RUNTIME]    = "RUNTIME",
+};
+
+const char *busactd_match_type_to_string(enum busactd_match_type type) {
+
+        if (type < 0 || type >= _BUSACTD_MATCH_TYPE_MAX)
+                return NULL;
+
+        return busactd_match_type_table[type];
+}
+
+enum busactd_match_type busactd_match_type_from_string(const char *s) {
+        int i;
+
+        if (!s)
+                return _BUSACTD_MATCH_TYPE_INVALID;
+
+        for (i = 0; i < _BUSACTD_MATCH_TYPE_MAX; i++)
+                if (strcaseeq(busactd_match_type_table[i], s))
+                        return i;
+
+        return _BUSACTD_MATCH_TYPE_INVALID;
+}
+
+static const char * const busactd_priority_table[_BUSACTD_PRIORITY_MAX] = {
+        [BUSACTD_PRIORITY_HIGH]         = "high",
+        [BUSACTD_PRIORITY_NORMAL]       = "normal",
+        [BUSACTD_PRIORITY_LOW]          = "low",
+};
+
+const char *busactd_priority_to_string(enum busactd_priority priority) {
+
+        if (priority < 0 || priority >= _BUSACTD_PRIORITY_MAX)
+                return NULL;
+
+        return busactd_priority_table[priority];
+}
+
+enum busactd_priority busactd_priority_from_string(const char *s) {
+        int i;
+
+        if (!s)
+                return _BUSACTD_PRIORITY_INVALID;
+
+        for (i = 0; i < _BUSACTD_PRIORITY_MAX; i++)
+                if (strcaseeq(busactd_priority_table[i], s))
+                        return i;
+
+        return _BUSACTD_PRIORITY_INVALID;
+}
+
+enum busactd_priority busactd_match_get_priority(struct busactd_match *match) {
+
+        assert(match);
+        assert(match->listener);
+
+        if (match->priority != _BUSACTD_PRIORITY_INVALID)
+                return match->priority;
+
+        return match->listener->priority;
+}
+
+enum busactd_priority busactd_listener_get_load_phase(struct busactd_listener *listener) {
+
+        assert(listener);
+
+        if (listener->load_phase != _BUSACTD_PRIORITY_INVALID)
+                return listener->load_phase;
+
+        return listener->priority;
+}
+
+static const struct {
+        const char *key;
+        size_t offset;
+        gboolean (*is_valid)(const gchar *string);
+} busactd_match_keys[] = {
+        { "sender",     offsetof(struct busactd_match, sender),    g_dbus_is_name           },
+        { "path",       offsetof(struct busactd_match, path),      g_variant_is_object_path },
+        { "interface",  offsetof(struct busactd_match, interface), g_dbus_is_interface_name },
+        { "member",     offsetof(struct busactd_match, member),    g_dbus_is_member_name    },
+        { "arg0",       offsetof(struct busactd_match, arg),       NULL                     },
+        /* deprecated spelling of arg0 */
+        { "arg",        offsetof(struct busactd_match, arg),       NULL                     },
+};
+
+static int busactd_match_parse_error(struct busactd_parse_error *error, const char *buf, const char *at, const char *reason) {
+
+        if (error) {
+                error->column = at - buf + 1;
+                error->reason = reason;
+        }
+
+        return -EINVAL;
+}
+
+/* Parses key=value pairs separated by whitespace in place. A value may
+ * be quoted with ' or " in whole or in parts, and a backslash escapes
+ * the next character. Unescaped values are written back over the input
+ * and terminated, so the match fields simply point into 'buf'. Only
+ * type='signal' is accepted, as busactd subscribes signals only,
+ * priority= overrides the priority of the listener for this rule and
+ * filter= is an expression over the signal body, see filter.c. */
+static int busactd_match_parse(struct busactd_match *m, char *buf, struct busactd_parse_error *error) {
+        bool has_type = false;
+        char *p = buf;
+
+        assert(m);
+        assert(buf);
+
+        assert(m->priority == _BUSACTD_PRIORITY_INVALID);
+
+        for (;;) {
+                char *key, *value, *w, **field = NULL;
+                _cleanup_free_ unsigned int *origin = NULL;
+                gboolean (*is_valid)(const gchar *string) = NULL;
+                bool is_priority = false, is_filter = false;
+                unsigned int i;
+
+                p += strspn(p, WHITESPACE);
+                if (!*p)
+                        break;
+
+                key = p;
+                while (*p && *p != '=' && !strchr(WHITESPACE, *p))
+                        p++;
+
+                if (*p != '=')
+                        return busactd_match_parse_error(error, buf, p, "expected '='");
+
+                if (p == key)
+                        return busactd_match_parse_error(error, buf, key, "empty key");
+
+                *p++ = '\0';
+
+                if (strcaseeq(key, "type")) {
+                        if (has_type)
+                                return busactd_match_parse_error(error, buf, key, "duplicate key");
+                        has_type = true;
+                } else if (strcaseeq(key, "priority")) {
+                        if (m->priority != _BUSACTD_PRIORITY_INVALID)
+                                return busactd_match_parse_error(error, buf, key, "duplicate key");
+                        is_priority = true;
+                } else if (strcaseeq(key, "filter")) {
+                        if (m->filter)
+                                return busactd_match_parse_error(error, buf, key, "duplicate key");
+                        is_filter = true;
+                } else {
+                        for (i = 0; i < G_N_ELEMENTS(busactd_match_keys); i++)
+                                if (strcaseeq(key, busactd_match_keys[i].key))
+                                        break;
+
+                        if (i == G_N_ELEMENTS(busactd_match_keys))
+                                return busactd_match_parse_error(error, buf, key, "unknown key");
+
+                        field = (char **) ((uint8_t *) m + busactd_match_keys[i].offset);
+                        if (*field)
+                                return busactd_match_parse_error(error, buf, key, "duplicate key");
+
+                        is_valid = busactd_match_keys[i].is_valid;
+                }
+
+                /* Where each character of a filter was in 'buf', its
+                 * errors are about the unescaped value */
+                if (is_filter) {
+                        origin = new0(unsigned int, strlen(p) + 1);
+                        if (!origin)
+                                return -ENOMEM;
+                }
+
+                value = w = p;
+                while (*p && !strchr(WHITESPACE, *p)) {
+                        if (*p == '\'' || *p == '"') {
+                                /* the quote itself may get overwritten */
+                                char *start = p, quote = *p++;
+
+                                while (*p != quote) {
+                                        if (*p == '\\')
+                                                p++;
+                                        if (!*p)
+                                                return busactd_match_parse_error(error, buf, start, "unterminated quote");
+                                        if (origin)
+                                                origin[w - value] = p - buf;
+                                        *w++ = *p++;
+                                }
+                                p++;
+                        } else {
+                                if (*p == '\\' && !*++p)
+                                        return busactd_match_parse_error(error, buf, p - 1, "trailing backslash");
+                                if (origin)
+                                        origin[w - value] = p - buf;
+                                *w++ = *p++;
+                        }
+                }
+
+                /* errors at the end of a filter point past its value */
+                if (origin)
+                        origin[w - value] = p - buf;
+
+                /* w trails p, so the separator may be consumed before
+                 * the value gets terminated */
+                if (*p)
+                        p++;
+                *w = '\0';
+
+                if (w == value)
+                        return busactd_match_parse_error(error, buf, value, "empty value");
+
+                if (is_priority) {
+                        m->priority = busactd_priority_from_string(value);
+                        if (m->priority == _BUSACTD_PRIORITY_INVALID)
+                                return busactd_match_parse_error(error, buf, value, "unknown priority");
+                        continue;
+                }
+
+                if (is_filter) {
+                        struct busactd_parse_error e = {};
+                        int r;
+
+                        r = busactd_filter_compile(value, &m->rule->filter, &e);
+                        if (r == -EINVAL)
+                                return busactd_match_parse_error(error, buf, buf + origin[e.column - 1], e.reason);
+                        if (r < 0)
+                                return r;
+
+                        m->filter = value;
+                        continue;
+                }
+
+                if (!field) {
+                        if (!streq(value, "signal"))
+                                return busactd_match_parse_error(error, buf, value, "only type='signal' is supported");
+                        continue;
+                }
+
+                if (is_valid && !is_valid(value))
+                        return busactd_match_parse_error(error, buf, value, "invalid value");
+
+                *field = value;
+        }
+
+        return 0;
+}
+
+int busactd_match_new_from_string(struct busactd_listener *listener, const char *string, struct busactd_match **match, struct busactd_parse_error *error) {
         struct busactd_match *m;
-        char *word, *state;
-        size_t len;
+        int r;
 
         assert(listener);
         assert(match);
@@ -464,42 +1316,14 @@ int busactd_match_new_from_string(struct busactd_listener *listener, const char
         if (!m)
                 goto on_error;
 
-        FOREACH_WORD(word, len, string, state) {
-                _cleanup_free_ char *t = NULL;
-                char *val;
-                size_t e;
-
-                t = strndup(word, len);
-                if (!t)
-                        goto on_error;
-
-                e = strcspn(t, "=");
-                val = t + e + 1;
-                if (isempty(val))
-                        continue;
+        m->rule = busactd_rule_new(string);
+        if (!m->rule)
+                goto on_error;
 
-                if (strncaseeq(t, "sender", e)) {
-                        m->sender = strdup_unquote(val, QUOTES);
-                        if (!m->sender)
-                                goto on_error;
-                } else if (strncaseeq(t, "path", e)) {
-                        m->path = strdup_unquote(val, QUOTES);
-                        if (!m->path)
-                                goto on_error;
-                } else if (strncaseeq(t, "interface", e)) {
-                        m->interface = strdup_unquote(val, QUOTES);
-                        if (!m->interface)
-                                goto on_error;
-                } else if (strncaseeq(t, "member", e)) {
-                        m->member = strdup_unquote(val, QUOTES);
-                        if (!m->member)
-                                goto on_error;
-                } else if (strncaseeq(t, "arg", e)) {
-                        m->arg = strdup_unquote(val, QUOTES);
-                        if (!m->arg)
-                                goto on_error;
-                } else
-                        log_dbg("Undefined signal property: %s", t);
+        r = busactd_match_parse(m, m->rule->string, error);
+        if (r < 0) {
+                busactd_match_free(m);
+                return r;
         }
 
         *match = m;
@@ -21,13 +21,26 @@
 #pragma once
 
 #include <limits.h>
+#include <stdbool.h>
 #include <glib.h>
 #include <gio/gio.h>
 
 #include "dbus.h"
+#include "client.h"
+#include "p2p.h"
+#include "queue.h"
+#include "predict.h"
+#include "activation.h"
+#include "shmstats.h"
+#include "lag.h"
+#include "filter.h"
+#include "timer.h"
+#include "memory.h"
 
 #define BUSACTD                 "busactd"
 #define BUSACTD_RUNTIME_DIR     "/run/" BUSACTD
+/* exit after that long without listeners */
+#define BUSACTD_IDLE_TIMEOUT_SEC        10
 
 enum busactd_type {
         BUSACTD_TYPE_SYSTEM,
@@ -44,17 +57,48 @@ typedef enum {
 enum busactd_match_type {
         BUSACTD_MATCH_TYPE_PERSISTENT,
         BUSACTD_MATCH_TYPE_RUNTIME,
+        _BUSACTD_MATCH_TYPE_MAX,
+        _BUSACTD_MATCH_TYPE_INVALID = -1,
+};
+
+enum {
+        /* Keep a RUNTIME subscription after its requester left the bus */
+        BUSACTD_SUBSCRIPTION_FLAG_KEEP = 1 << 0,
+};
+
+/* A subscription string, parsed in place. Immutable once parsed, so the
+ * matches cloned for several buses share it. */
+struct busactd_rule {
+        int n_ref;
+        /* compiled filter= of the rule, NULL if it has none */
+        struct busactd_filter *filter;
+        /* of 'string' as allocated */
+        unsigned int size;
+        char string[];
 };
 
 struct busactd_match {
+        /* Of the bus subscription, 0 while not subscribed */
         unsigned int m_id;
+        /* Given on entering the registry, unique on this bus and never
+         * 0. The SubscriptionID of the D-Bus API. */
+        unsigned int id;
         enum busactd_match_type type;
         struct busactd_listener *listener;
+        /* Unique name and uid of the peer which added a RUNTIME match */
+        char *client;
+        uid_t uid;
+        unsigned int flags;
+        /* _BUSACTD_PRIORITY_INVALID to use the one of the listener */
+        enum busactd_priority priority;
+        /* The fields below point into it */
+        struct busactd_rule *rule;
         char *sender;
         char *path;
         char *interface;
         char *member;
         char *arg;
+        char *filter;
 };
 
 struct busactd_listener {
@@ -62,8 +106,18 @@ struct busactd_listener {
         char *busname;
         unsigned int l_id;
         unsigned int ref_count;
+        /* entered into busactd->listener_list */
+        bool in_registry;
         IsNameHasOwner name_has_owner;
+        enum busactd_priority priority;
+        /* order of arming at startup, _INVALID follows priority */
+        enum busactd_priority load_phase;
         GList *match_list;
+        struct busactd_listener_activation activation;
+        guint64 signals_forwarded;
+        guint64 signals_forward_failed;
+        /* busactd->dispatch_serial of the last signal dispatched to it */
+        guint64 dispatch_serial;
 };
 
 enum {
@@ -73,25 +127,196 @@ enum {
         BUSACTD_LOAD_MAX,
 };
 
+struct busactd_settings {
+        /* [Limits], 0 or less means unlimited */
+        int subscriptions_per_client;
+        int subscriptions_per_user;
+        int call_rate_per_client;
+        int call_rate_per_user;
+        /* [P2P] */
+        bool p2p_enabled;
+        char **p2p_allowed_users;
+        /* [Predict] */
+        bool predict_enabled;
+        int predict_confidence;
+        int predict_starts_per_minute;
+        int predict_max_pending;
+        /* [Activation] */
+        int activation_max_in_flight;
+        int activation_timeout_sec;
+        /* [Queue], 0 or less means unlimited */
+        int queue_max_depth;
+        int queue_max_age_msec;
+        /* [Load] */
+        int load_slice_usec;
+        /* [Stats] */
+        bool shm_stats_enabled;
+        /* [Monitor] */
+        int stall_msec;
+        /* [Memory], 0 or less means unlimited or never */
+        int memory_budget_kib;
+        int memory_trim_threshold_kib;
+};
+
+struct busactd_stats {
+        guint64 signals_forwarded;
+        guint64 signals_forward_failed;
+        guint64 subscriptions_added;
+        guint64 subscriptions_removed;
+        guint64 subscriptions_rejected_client_quota;
+        guint64 subscriptions_rejected_user_quota;
+        guint64 subscriptions_rejected_client_rate;
+        guint64 subscriptions_rejected_user_rate;
+        guint64 subscriptions_rejected_memory;
+        guint64 clients_vanished;
+        guint64 p2p_signals_received;
+        guint64 p2p_peers_rejected;
+        guint64 predictions_started;
+        guint64 predictions_hit;
+        guint64 predictions_missed;
+        guint64 predictions_skipped;
+        guint64 predictions_failed;
+        guint64 activations_started;
+        guint64 activations_completed;
+        guint64 activations_timed_out;
+        guint64 activations_failed;
+        guint64 activations_in_flight;
+        guint64 activations_waiting;
+        guint64 activation_signals_deferred;
+        guint64 activation_wait_usec_sum;
+        guint64 activation_wait_usec_max;
+        guint64 loop_lag_usec;
+        guint64 loop_lag_usec_max;
+        guint64 loop_lag_hist[BUSACTD_LAG_BUCKETS];
+        guint64 filter_evaluations;
+        guint64 filter_dropped;
+        guint64 filter_steps;
+        guint64 main_loop_wakeups;
+        guint64 wakeups_last_hour;
+        guint64 timer_wakeups;
+        guint64 memory_trims;
+        struct busactd_queue_stats queues[_BUSACTD_PRIORITY_MAX];
+};
+
+enum busactd_startup_phase {
+        BUSACTD_STARTUP_BUS_ACQUISITION,
+        BUSACTD_STARTUP_DIRECTORY_SCAN,
+        BUSACTD_STARTUP_FILE_PARSE,
+        BUSACTD_STARTUP_REGISTER,
+        BUSACTD_STARTUP_OWNERSHIP_QUERY,
+        /* subscribing locally, AddMatch is sent without waiting */
+        BUSACTD_STARTUP_ADD_MATCH,
+        /* until the bus answered after the last AddMatch */
+        BUSACTD_STARTUP_MATCH_INSTALL,
+        _BUSACTD_STARTUP_PHASE_MAX,
+};
+
+/* Listener loading at startup, done in slices of at most
+ * load_slice_usec between main loop iterations. Listeners of the first
+ * phase are registered while the files are parsed, the others phase
+ * by phase afterwards. */
+struct busactd_load {
+        /* config file paths not parsed yet */
+        GQueue files;
+        /* parsed listeners not registered yet, per load phase */
+        GQueue pending[_BUSACTD_PRIORITY_MAX];
+        /* number of phases completely armed */
+        unsigned int n_ready;
+        bool running;
+};
+
+/* Time spent per startup phase in usec, accumulated over all calls,
+ * relative to the monotonic 'start'. */
+struct busactd_startup {
+        gint64 start;
+        gint64 ready;
+        gint64 usec[_BUSACTD_STARTUP_PHASE_MAX];
+        unsigned int count[_BUSACTD_STARTUP_PHASE_MAX];
+};
+
 struct busactd {
         enum busactd_type type;
         GMainLoop *loop;
         struct busactd_dbus *bus;
+        /* In multi-bus mode, the instance the persistent listeners of
+         * this bus are cloned from */
+        struct busactd *template;
+        /* Of the template, the instances serving one bus each */
+        GList *instances;
+        struct busactd_p2p *p2p;
+        struct busactd_predict *predict;
+        struct busactd_shm *shm;
+        struct busactd_queue queues[_BUSACTD_PRIORITY_MAX];
+        struct busactd_activation activation;
+        struct busactd_memory memory;
         GList *listener_list;
-        GSource *idle_timeout_source;
+        /* Peers calling AddSubscription, keyed by unique name */
+        GHashTable *clients;
+        unsigned int clients_watch_id;
+        /* Per uid accounting of those peers, keyed by uid */
+        GHashTable *users;
+        struct busactd_settings settings;
+        struct busactd_stats stats;
+        struct busactd_startup startup;
+        struct busactd_load load;
+        /* Bumped on every listener/match change, used to invalidate
+         * cached replies built from listener_list. */
+        guint64 generation;
+        /* Bumped only when a listener or match enters or leaves
+         * listener_list, which is what invalidates list cursors. */
+        guint64 registry_generation;
+        unsigned int last_match_id;
+        /* Matches without sender in the registry, keyed by
+         * "interface:member", empty for an unset field, for
+         * busactd_dispatch_signal() */
+        GHashTable *signal_index;
+        guint64 dispatch_serial;
+        /* armed while there is no listener and nothing is loading,
+         * only for the instance which may exit, the template in
+         * multi-bus mode */
+        struct busactd_timer idle_timer;
+        /* called once connected to the bus */
+        void (*connected)(struct busactd *busactd);
         char config_dirs[BUSACTD_LOAD_MAX][PATH_MAX];
 };
 
+void busactd_bump_generation(struct busactd *busactd);
+bool busactd_is_idle(struct busactd *busactd);
+void busactd_idle_update(struct busactd *busactd);
+void busactd_startup_account(struct busactd *busactd, enum busactd_startup_phase phase, gint64 since);
 struct busactd_listener *busactd_listener_new(struct busactd *busactd);
 void busactd_listener_free(struct busactd_listener *listener);
 void busactd_listener_unref(struct busactd_listener *listener);
+struct busactd_listener *busactd_find_listener(struct busactd *busactd, const char *busname);
 struct busactd_listener *busactd_listener_get(struct busactd *busactd, const char *busname);
+struct busactd_listener *busactd_listener_clone(struct busactd_listener *listener, struct busactd *busactd);
+struct busactd_rule *busactd_rule_new(const char *string);
+struct busactd_rule *busactd_rule_ref(struct busactd_rule *rule);
+void busactd_rule_unref(struct busactd_rule *rule);
 struct busactd_match *busactd_match_new(struct busactd_listener *listener);
+struct busactd_match *busactd_match_clone(struct busactd_match *match, struct busactd_listener *listener);
 void busactd_match_free(struct busactd_match *match);
 void busactd_register_listener(struct busactd_listener *listener);
+void busactd_unregister_listener(struct busactd_listener *listener);
+GDBusConnection *busactd_listener_get_connection(struct busactd_listener *listener);
 struct busactd_listener *busactd_add_listener(struct busactd_listener *listener);
 void busactd_remove_listener(struct busactd_listener *listener);
-struct busactd_match *busactd_add_match(struct busactd_match *match);
+struct busactd_match *busactd_add_match(struct busactd_match *match, bool *added);
 void busactd_remove_match(struct busactd_match *match);
+void busactd_remove_client_matches(struct busactd *busactd, const char *client);
+bool busactd_listener_forward_signal(struct busactd_listener *listener, const char *sender_name, const char *object_path, const char *interface_name, const char *signal_name, GVariant *parameters);
+unsigned int busactd_dispatch_signal(struct busactd *busactd, const char *object_path, const char *interface_name, const char *signal_name, GVariant *parameters);
 struct busactd_match *busactd_find_match_by_id(struct busactd *busactd, unsigned int id);
-int busactd_match_new_from_string(struct busactd_listener *listener, const char *string, struct busactd_match **match);
+const char *busactd_match_type_to_string(enum busactd_match_type type);
+enum busactd_match_type busactd_match_type_from_string(const char *s);
+const char *busactd_priority_to_string(enum busactd_priority priority);
+enum busactd_priority busactd_priority_from_string(const char *s);
+enum busactd_priority busactd_match_get_priority(struct busactd_match *match);
+enum busactd_priority busactd_listener_get_load_phase(struct busactd_listener *listener);
+/* Where and why a subscription string was rejected, column is 1-based */
+struct busactd_parse_error {
+        unsigned int column;
+        const char *reason;
+};
+
+int busactd_match_new_from_string(struct busactd_listener *listener, const char *string, struct busactd_match **match, struct busactd_parse_error *error);
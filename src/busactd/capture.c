@@ -0,0 +1,214 @@
+/*-*- Mode: C; c-basic-offset: 8; indent-tabs-mode: nil -*-*/
+
+/*
+ * busactd
+ *
+ * Copyright (c) 2016 Samsung Electronics Co., Ltd.
+ *
+ * Licensed under the Apache License, Version 2.0 (the License);
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <assert.h>
+#include <glib.h>
+#include <gio/gio.h>
+#include <libsystem/libsystem.h>
+
+#include "capture.h"
+#include "log.h"
+
+/* Records waiting for the writer, beyond that the disk does not keep
+ * up and they are dropped */
+#define BUSACTD_CAPTURE_QUEUED_MAX 4096
+
+struct busactd_capture_item {
+        struct busactd_capture_record record;
+        guchar *blob;
+};
+
+/* The GDBus worker thread only queues records, the writer thread owns
+ * the file and the counters of what it wrote. */
+static struct {
+        GMutex lock;
+        FILE *f;
+        char *path;
+        GAsyncQueue *queue;
+        GThread *writer;
+        guint64 captured;
+        guint64 failed;
+        guint64 dropped;
+} capture;
+
+/* Queued last, stops the writer */
+static struct busactd_capture_item busactd_capture_stop;
+
+static bool busactd_capture_is_trigger(GDBusMessage *message) {
+
+        /* broadcast signals only, the bus driver's cannot be replayed */
+        return g_dbus_message_get_message_type(message) == G_DBUS_MESSAGE_TYPE_SIGNAL &&
+                !g_dbus_message_get_destination(message) &&
+                !g_dbus_message_get_unix_fd_list(message) &&
+                !streq_ptr(g_dbus_message_get_sender(message), "org.freedesktop.DBus");
+}
+
+static GDBusMessage *busactd_capture_filter(GDBusConnection *connection,
+                                            GDBusMessage *message,
+                                            gboolean incoming,
+                                            gpointer user_data) {
+
+        struct busactd_capture_item *item;
+        guchar *blob;
+        gsize size;
+        gint64 now;
+
+        if (!incoming || !capture.queue || !busactd_capture_is_trigger(message))
+                return message;
+
+        now = g_get_real_time();
+
+        blob = g_dbus_message_to_blob(message, &size, G_DBUS_CAPABILITY_FLAGS_NONE, NULL);
+        if (!blob)
+                return message;
+
+        item = g_new(struct busactd_capture_item, 1);
+        item->record.ts_sec = now / G_USEC_PER_SEC;
+        item->record.ts_usec = now % G_USEC_PER_SEC;
+        item->record.incl_len = item->record.orig_len = size;
+        item->blob = blob;
+
+        g_mutex_lock(&capture.lock);
+        if (capture.queue) {
+                if (g_async_queue_length(capture.queue) < BUSACTD_CAPTURE_QUEUED_MAX) {
+                        g_async_queue_push(capture.queue, item);
+                        item = NULL;
+                } else
+                        capture.dropped++;
+        }
+        g_mutex_unlock(&capture.lock);
+
+        if (item) {
+                g_free(item->blob);
+                g_free(item);
+        }
+
+        return message;
+}
+
+static gpointer busactd_capture_writer(gpointer data) {
+        GAsyncQueue *queue = data;
+        struct busactd_capture_item *item;
+
+        for (;;) {
+                item = g_async_queue_pop(queue);
+                if (item == &busactd_capture_stop)
+                        break;
+
+                if (fwrite(&item->record, sizeof(item->record), 1, capture.f) == 1 &&
+                    fwrite(item->blob, 1, item->record.incl_len, capture.f) == item->record.incl_len)
+                        capture.captured++;
+                else
+                        capture.failed++;
+
+                g_free(item->blob);
+                g_free(item);
+        }
+
+        return NULL;
+}
+
+int busactd_capture_open(const char *path) {
+        struct busactd_capture_header header = {
+                .magic          = BUSACTD_CAPTURE_MAGIC,
+                .version_major  = BUSACTD_CAPTURE_VERSION_MAJOR,
+                .version_minor  = BUSACTD_CAPTURE_VERSION_MINOR,
+                .snaplen        = BUSACTD_CAPTURE_SNAPLEN,
+                .linktype       = BUSACTD_CAPTURE_LINKTYPE,
+        };
+        FILE *f;
+        int r;
+
+        assert(path);
+        assert(!capture.f);
+
+        f = fopen(path, "we");
+        if (!f) {
+                r = -errno;
+                log_err("Failed to open %s: %m", path);
+                return r;
+        }
+
+        if (fwrite(&header, sizeof(header), 1, f) != 1) {
+                log_err("Failed to write %s: %m", path);
+                fclose(f);
+                return -EIO;
+        }
+
+        capture.path = strdup(path);
+        if (!capture.path) {
+                fclose(f);
+                return -ENOMEM;
+        }
+
+        g_mutex_init(&capture.lock);
+        capture.f = f;
+        capture.queue = g_async_queue_new();
+        capture.writer = g_thread_new("busactd-capture", busactd_capture_writer, capture.queue);
+
+        log_info("Capturing trigger signals to %s", path);
+
+        return 0;
+}
+
+void busactd_capture_connection(GDBusConnection *connection) {
+
+        assert(connection);
+
+        if (!capture.f)
+                return;
+
+        g_dbus_connection_add_filter(connection, busactd_capture_filter, NULL, NULL);
+}
+
+/* The filters stay in place, they find no queue any longer. The writer
+ * gets what was queued before written out. */
+void busactd_capture_close(void) {
+        GAsyncQueue *queue;
+
+        if (!capture.f)
+                return;
+
+        g_mutex_lock(&capture.lock);
+        queue = capture.queue;
+        capture.queue = NULL;
+        g_async_queue_push(queue, &busactd_capture_stop);
+        g_mutex_unlock(&capture.lock);
+
+        g_thread_join(capture.writer);
+        capture.writer = NULL;
+        g_async_queue_unref(queue);
+
+        if (fclose(capture.f) < 0)
+                capture.failed++;
+        capture.f = NULL;
+
+        log_info("Captured %" G_GUINT64_FORMAT " signals to %s, %" G_GUINT64_FORMAT " failed, %" G_GUINT64_FORMAT " dropped",
+                 capture.captured, capture.path, capture.failed, capture.dropped);
+
+        free(capture.path);
+        capture.path = NULL;
+}
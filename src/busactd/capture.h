@@ -0,0 +1,65 @@
+/*-*- Mode: C; c-basic-offset: 8; indent-tabs-mode: nil -*-*/
+
+/*
+ * busactd
+ *
+ * Copyright (c) 2016 Samsung Electronics Co., Ltd.
+ *
+ * Licensed under the Apache License, Version 2.0 (the License);
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#pragma once
+
+#include <stdint.h>
+#include <gio/gio.h>
+
+/* Layout of the trace written with --capture: the pcap format also
+ * written by "dbus-monitor --pcap", so both can be replayed by
+ * bench-busactd-replay and read by the usual pcap tools. Each record
+ * holds one trigger signal busactd received, marshalled as it came off
+ * the bus, fields in host byte order. */
+
+#define BUSACTD_CAPTURE_MAGIC           0xa1b2c3d4U
+#define BUSACTD_CAPTURE_MAGIC_SWAPPED   0xd4c3b2a1U
+#define BUSACTD_CAPTURE_VERSION_MAJOR   2
+#define BUSACTD_CAPTURE_VERSION_MINOR   4
+/* LINKTYPE_DBUS */
+#define BUSACTD_CAPTURE_LINKTYPE        231
+/* the longest message D-Bus allows */
+#define BUSACTD_CAPTURE_SNAPLEN         (128U * 1024 * 1024)
+
+struct busactd_capture_header {
+        uint32_t magic;
+        uint16_t version_major;
+        uint16_t version_minor;
+        int32_t thiszone;
+        uint32_t sigfigs;
+        uint32_t snaplen;
+        uint32_t linktype;
+};
+
+struct busactd_capture_record {
+        /* CLOCK_REALTIME of receiving */
+        uint32_t ts_sec;
+        uint32_t ts_usec;
+        uint32_t incl_len;
+        uint32_t orig_len;
+};
+
+/* Writer side, in busactd. Signals are captured from the GDBus worker
+ * thread, before dispatching, and written out by a thread of their
+ * own. */
+int busactd_capture_open(const char *path);
+void busactd_capture_connection(GDBusConnection *connection);
+void busactd_capture_close(void);
@@ -0,0 +1,481 @@
+/*-*- Mode: C; c-basic-offset: 8; indent-tabs-mode: nil -*-*/
+
+/*
+ * busactd
+ *
+ * Copyright (c) 2016 Samsung Electronics Co., Ltd.
+ *
+ * Licensed under the Apache License, Version 2.0 (the License);
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <assert.h>
+#include <glib.h>
+#include <gio/gio.h>
+#include <libsystem/libsystem.h>
+#include <libsystem/glib-util.h>
+
+#include "busactd.h"
+#include "client.h"
+#include "log.h"
+
+static const char * const busactd_admission_table[_BUSACTD_ADMISSION_MAX] = {
+        [BUSACTD_ADMISSION_OK]           = "admitted",
+        [BUSACTD_ADMISSION_CLIENT_QUOTA] = "too many subscriptions for this client",
+        [BUSACTD_ADMISSION_USER_QUOTA]   = "too many subscriptions for this user",
+        [BUSACTD_ADMISSION_CLIENT_RATE]  = "call rate exceeded for this client",
+        [BUSACTD_ADMISSION_USER_RATE]    = "call rate exceeded for this user",
+        [BUSACTD_ADMISSION_MEMORY_BUDGET] = "memory budget of busactd reached",
+};
+
+const char *busactd_admission_to_string(enum busactd_admission admission) {
+
+        if (admission < 0 || admission >= _BUSACTD_ADMISSION_MAX)
+                return NULL;
+
+        return busactd_admission_table[admission];
+}
+
+struct busactd_client_call {
+        struct busactd *busactd;
+        char *name;
+};
+
+static struct busactd_client_call *busactd_client_call_new(struct busactd_client *client) {
+        struct busactd_client_call *call;
+
+        assert(client);
+
+        call = new0(struct busactd_client_call, 1);
+        if (!call)
+                return NULL;
+
+        call->busactd = client->busactd;
+        call->name = strdup(client->name);
+        if (!call->name) {
+                free(call);
+                return NULL;
+        }
+
+        return call;
+}
+
+static void busactd_client_call_free(struct busactd_client_call *call) {
+
+        if (!call)
+                return;
+
+        free(call->name);
+        free(call);
+}
+
+/* Accounted to BUSACTD_MEMORY_CLIENTS, pending calls and users apart */
+static gsize busactd_client_size(struct busactd_client *client) {
+        return sizeof(struct busactd_client) + strlen(client->name) + 1;
+}
+
+static void busactd_client_free(struct busactd_client *client) {
+        GList *list;
+
+        if (!client)
+                return;
+
+        busactd_memory_account(client->busactd, BUSACTD_MEMORY_CLIENTS,
+                               busactd_client_size(client) +
+                               g_list_length(client->pending_calls) * sizeof(GList),
+                               -1);
+
+        FOREACH_G_LIST(list, client->pending_calls)
+                g_dbus_method_invocation_return_error_literal(
+                        list->data,
+                        G_DBUS_ERROR,
+                        G_DBUS_ERROR_SERVICE_UNKNOWN,
+                        "Client left the bus.");
+
+        g_list_free(client->pending_calls);
+        free(client->name);
+        free(client);
+}
+
+static void busactd_client_vanished(struct busactd *busactd, const char *name) {
+
+        assert(busactd);
+        assert(name);
+
+        log_dbg("Client %s left the bus, removing its subscriptions", name);
+
+        busactd_remove_client_matches(busactd, name);
+
+        g_hash_table_remove(busactd->clients, name);
+        busactd->stats.clients_vanished++;
+
+        if (g_hash_table_size(busactd->clients) || !busactd->clients_watch_id)
+                return;
+
+        g_dbus_connection_signal_unsubscribe(busactd->bus->connection,
+                                             busactd->clients_watch_id);
+        busactd->clients_watch_id = 0;
+}
+
+static void busactd_dbus_client_name_owner_changed_callback(
+                GDBusConnection *connection,
+                const gchar *sender_name,
+                const gchar *object_path,
+                const gchar *interface_name,
+                const gchar *signal_name,
+                GVariant *parameters,
+                void *user_data) {
+
+        const char *name, *old_owner, *new_owner;
+        struct busactd *busactd = user_data;
+
+        assert(user_data);
+
+        g_variant_get(parameters, "(&s&s&s)", &name, &old_owner, &new_owner);
+
+        /* Only a unique name going away is interesting here, they are
+         * never handed over to another connection. */
+        if (name[0] != ':' || !isempty(new_owner))
+                return;
+
+        if (!g_hash_table_contains(busactd->clients, name))
+                return;
+
+        busactd_client_vanished(busactd, name);
+}
+
+static void busactd_client_check_callback(GObject *source, GAsyncResult *res, gpointer user_data) {
+        struct busactd_client_call *call = user_data;
+        g_autoptr(GError) error = NULL;
+        g_autoptr(GVariant) gvar = NULL;
+
+        gvar = g_dbus_connection_call_finish(G_DBUS_CONNECTION(source), res, &error);
+        if (!gvar && g_hash_table_contains(call->busactd->clients, call->name))
+                busactd_client_vanished(call->busactd, call->name);
+
+        busactd_client_call_free(call);
+}
+
+static void busactd_client_watch(struct busactd_client *client) {
+        struct busactd *busactd;
+        struct busactd_client_call *call;
+
+        assert(client);
+        busactd = client->busactd;
+        assert(busactd);
+
+        if (!busactd->bus || !busactd->bus->connection)
+                return;
+
+        /* One watch on NameOwnerChanged serves every client. */
+        if (!busactd->clients_watch_id)
+                busactd->clients_watch_id = g_dbus_connection_signal_subscribe(
+                        busactd->bus->connection,
+                        "org.freedesktop.DBus",
+                        "org.freedesktop.DBus",
+                        "NameOwnerChanged",
+                        "/org/freedesktop/DBus",
+                        NULL,
+                        G_DBUS_SIGNAL_FLAGS_NONE,
+                        busactd_dbus_client_name_owner_changed_callback,
+                        busactd,
+                        NULL);
+
+        /* The client may have left before the watch was in place. */
+        call = busactd_client_call_new(client);
+        if (!call)
+                return;
+
+        g_dbus_connection_call(busactd->bus->connection,
+                               "org.freedesktop.DBus",
+                               "/org/freedesktop/DBus",
+                               "org.freedesktop.DBus",
+                               "GetNameOwner",
+                               g_variant_new("(s)", client->name),
+                               G_VARIANT_TYPE("(s)"),
+                               G_DBUS_CALL_FLAGS_NONE,
+                               -1,
+                               NULL,
+                               busactd_client_check_callback,
+                               call);
+}
+
+/* The bus went away, and with it every client and their pending calls */
+void busactd_client_drop_all(struct busactd *busactd) {
+
+        assert(busactd);
+
+        if (busactd->clients_watch_id && busactd->bus && busactd->bus->connection)
+                g_dbus_connection_signal_unsubscribe(busactd->bus->connection,
+                                                     busactd->clients_watch_id);
+        busactd->clients_watch_id = 0;
+
+        g_clear_pointer(&busactd->clients, g_hash_table_destroy);
+
+        if (busactd->users)
+                busactd_memory_account(busactd, BUSACTD_MEMORY_CLIENTS,
+                                       g_hash_table_size(busactd->users) * sizeof(struct busactd_user), -1);
+        g_clear_pointer(&busactd->users, g_hash_table_destroy);
+}
+
+struct busactd_client *busactd_client_get(struct busactd *busactd, const char *name) {
+        struct busactd_client *client;
+
+        assert(busactd);
+        assert(name);
+
+        if (!busactd->clients) {
+                busactd->clients = g_hash_table_new_full(g_str_hash,
+                                                         g_str_equal,
+                                                         NULL,
+                                                         (GDestroyNotify) busactd_client_free);
+                if (!busactd->clients)
+                        return NULL;
+        }
+
+        client = g_hash_table_lookup(busactd->clients, name);
+        if (client)
+                return client;
+
+        client = new0(struct busactd_client, 1);
+        if (!client)
+                return NULL;
+
+        client->busactd = busactd;
+        client->uid = BUSACTD_UID_INVALID;
+        client->name = strdup(name);
+        if (!client->name) {
+                free(client);
+                return NULL;
+        }
+
+        g_hash_table_insert(busactd->clients, client->name, client);
+        busactd_memory_account(busactd, BUSACTD_MEMORY_CLIENTS, busactd_client_size(client), 1);
+
+        busactd_client_watch(client);
+
+        return client;
+}
+
+/* Clients whose uid could not be looked up share the user of
+ * BUSACTD_UID_INVALID, they must not escape the per user limits. */
+static struct busactd_user *busactd_user_get(struct busactd *busactd, uid_t uid) {
+        struct busactd_user *user;
+
+        assert(busactd);
+
+        if (!busactd->users) {
+                busactd->users = g_hash_table_new_full(g_direct_hash,
+                                                       g_direct_equal,
+                                                       NULL,
+                                                       free);
+                if (!busactd->users)
+                        return NULL;
+        }
+
+        user = g_hash_table_lookup(busactd->users, GUINT_TO_POINTER(uid));
+        if (user)
+                return user;
+
+        user = new0(struct busactd_user, 1);
+        if (!user)
+                return NULL;
+
+        user->uid = uid;
+        g_hash_table_insert(busactd->users, GUINT_TO_POINTER(uid), user);
+        busactd_memory_account(busactd, BUSACTD_MEMORY_CLIENTS, sizeof(struct busactd_user), 1);
+
+        return user;
+}
+
+static void busactd_client_uid_callback(GObject *source, GAsyncResult *res, gpointer user_data) {
+        struct busactd_client_call *call = user_data;
+        struct busactd_client *client;
+        g_autoptr(GError) error = NULL;
+        g_autoptr(GVariant) gvar = NULL;
+        GList *pending, *list;
+
+        gvar = g_dbus_connection_call_finish(G_DBUS_CONNECTION(source), res, &error);
+
+        /* Pending calls were already answered if the client is gone. */
+        client = g_hash_table_lookup(call->busactd->clients, call->name);
+        if (!client)
+                goto finish;
+
+        if (gvar)
+                g_variant_get(gvar, "(u)", &client->uid);
+        else
+                log_err("Failed to get uid of %s, accounting it as unknown user: %s",
+                        client->name, error->message);
+
+        client->uid_resolved = true;
+
+        pending = client->pending_calls;
+        client->pending_calls = NULL;
+        busactd_memory_account(call->busactd, BUSACTD_MEMORY_CLIENTS,
+                               g_list_length(pending) * sizeof(GList), -1);
+
+        FOREACH_G_LIST(list, pending)
+                busactd_dbus_resume_method_call(call->busactd, list->data);
+
+        g_list_free(pending);
+
+finish:
+        busactd_client_call_free(call);
+}
+
+bool busactd_client_resolve_uid(struct busactd_client *client, GDBusMethodInvocation *invocation) {
+        struct busactd *busactd;
+        struct busactd_client_call *call;
+
+        assert(client);
+        assert(invocation);
+        busactd = client->busactd;
+        assert(busactd);
+
+        if (client->uid_resolved)
+                return true;
+
+        /* The uid is only needed for per user accounting. */
+        if (busactd->settings.subscriptions_per_user <= 0 &&
+            busactd->settings.call_rate_per_user <= 0)
+                return true;
+
+        if (client->pending_calls) {
+                client->pending_calls = g_list_append(client->pending_calls, invocation);
+                busactd_memory_account(busactd, BUSACTD_MEMORY_CLIENTS, sizeof(GList), 1);
+                return false;
+        }
+
+        call = busactd_client_call_new(client);
+        if (!call)
+                return true;
+
+        client->pending_calls = g_list_append(client->pending_calls, invocation);
+        busactd_memory_account(busactd, BUSACTD_MEMORY_CLIENTS, sizeof(GList), 1);
+
+        g_dbus_connection_call(busactd->bus->connection,
+                               "org.freedesktop.DBus",
+                               "/org/freedesktop/DBus",
+                               "org.freedesktop.DBus",
+                               "GetConnectionUnixUser",
+                               g_variant_new("(s)", client->name),
+                               G_VARIANT_TYPE("(u)"),
+                               G_DBUS_CALL_FLAGS_NONE,
+                               -1,
+                               NULL,
+                               busactd_client_uid_callback,
+                               call);
+
+        return false;
+}
+
+static void busactd_rate_refill(struct busactd_rate *rate, int limit, gint64 now) {
+
+        assert(rate);
+
+        if (!rate->last) {
+                rate->tokens = limit;
+                rate->last = now;
+                return;
+        }
+
+        rate->tokens += (double) (now - rate->last) * limit / G_USEC_PER_SEC;
+        if (rate->tokens > limit)
+                rate->tokens = limit;
+        rate->last = now;
+}
+
+enum busactd_admission busactd_client_admit(struct busactd_client *client) {
+        struct busactd_settings *settings;
+        struct busactd_stats *stats;
+        struct busactd_user *user;
+        gint64 now;
+
+        assert(client);
+        assert(client->busactd);
+
+        settings = &client->busactd->settings;
+        stats = &client->busactd->stats;
+        user = busactd_user_get(client->busactd, client->uid);
+
+        if (busactd_memory_over_budget(client->busactd)) {
+                stats->subscriptions_rejected_memory++;
+                return BUSACTD_ADMISSION_MEMORY_BUDGET;
+        }
+
+        if (settings->subscriptions_per_client > 0 &&
+            client->n_matches >= (unsigned int) settings->subscriptions_per_client) {
+                stats->subscriptions_rejected_client_quota++;
+                return BUSACTD_ADMISSION_CLIENT_QUOTA;
+        }
+
+        if (user && settings->subscriptions_per_user > 0 &&
+            user->n_matches >= (unsigned int) settings->subscriptions_per_user) {
+                stats->subscriptions_rejected_user_quota++;
+                return BUSACTD_ADMISSION_USER_QUOTA;
+        }
+
+        now = g_get_monotonic_time();
+
+        if (settings->call_rate_per_client > 0) {
+                busactd_rate_refill(&client->rate, settings->call_rate_per_client, now);
+                if (client->rate.tokens < 1) {
+                        stats->subscriptions_rejected_client_rate++;
+                        return BUSACTD_ADMISSION_CLIENT_RATE;
+                }
+        }
+
+        if (user && settings->call_rate_per_user > 0) {
+                busactd_rate_refill(&user->rate, settings->call_rate_per_user, now);
+                if (user->rate.tokens < 1) {
+                        stats->subscriptions_rejected_user_rate++;
+                        return BUSACTD_ADMISSION_USER_RATE;
+                }
+
+                user->rate.tokens--;
+        }
+
+        if (settings->call_rate_per_client > 0)
+                client->rate.tokens--;
+
+        return BUSACTD_ADMISSION_OK;
+}
+
+void busactd_client_account_match(struct busactd_match *match, int delta) {
+        struct busactd *busactd;
+        struct busactd_client *client = NULL;
+        struct busactd_user *user;
+
+        assert(match);
+        assert(match->listener);
+        busactd = match->listener->busactd;
+        assert(busactd);
+
+        if (match->client && busactd->clients)
+                client = g_hash_table_lookup(busactd->clients, match->client);
+        if (client && (delta > 0 || client->n_matches))
+                client->n_matches += delta;
+
+        /* configured matches belong to no user */
+        if (!match->client)
+                return;
+
+        user = busactd_user_get(busactd, match->uid);
+        if (user && (delta > 0 || user->n_matches))
+                user->n_matches += delta;
+}
@@ -0,0 +1,73 @@
+/*-*- Mode: C; c-basic-offset: 8; indent-tabs-mode: nil -*-*/
+
+/*
+ * busactd
+ *
+ * Copyright (c) 2016 Samsung Electronics Co., Ltd.
+ *
+ * Licensed under the Apache License, Version 2.0 (the License);
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#pragma once
+
+#include <stdbool.h>
+#include <sys/types.h>
+#include <glib.h>
+#include <gio/gio.h>
+
+#define BUSACTD_UID_INVALID     ((uid_t) -1)
+
+struct busactd;
+struct busactd_match;
+
+enum busactd_admission {
+        BUSACTD_ADMISSION_OK,
+        BUSACTD_ADMISSION_CLIENT_QUOTA,
+        BUSACTD_ADMISSION_USER_QUOTA,
+        BUSACTD_ADMISSION_CLIENT_RATE,
+        BUSACTD_ADMISSION_USER_RATE,
+        BUSACTD_ADMISSION_MEMORY_BUDGET,
+        _BUSACTD_ADMISSION_MAX,
+};
+
+/* Token bucket refilled at the configured rate, holding at most one
+ * second worth of calls. */
+struct busactd_rate {
+        double tokens;
+        gint64 last;
+};
+
+struct busactd_user {
+        uid_t uid;
+        unsigned int n_matches;
+        struct busactd_rate rate;
+};
+
+struct busactd_client {
+        struct busactd *busactd;
+        char *name;
+        uid_t uid;
+        bool uid_resolved;
+        unsigned int n_matches;
+        struct busactd_rate rate;
+        /* Method calls waiting for the uid lookup */
+        GList *pending_calls;
+};
+
+struct busactd_client *busactd_client_get(struct busactd *busactd, const char *name);
+void busactd_client_drop_all(struct busactd *busactd);
+bool busactd_client_resolve_uid(struct busactd_client *client, GDBusMethodInvocation *invocation);
+enum busactd_admission busactd_client_admit(struct busactd_client *client);
+const char *busactd_admission_to_string(enum busactd_admission admission);
+void busactd_client_account_match(struct busactd_match *match, int delta);
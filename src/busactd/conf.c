@@ -0,0 +1,180 @@
+/*-*- Mode: C; c-basic-offset: 8; indent-tabs-mode: nil -*-*/
+
+/*
+ * busactd
+ *
+ * Copyright (c) 2016 Samsung Electronics Co., Ltd.
+ *
+ * Licensed under the Apache License, Version 2.0 (the License);
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <assert.h>
+#include <glib.h>
+#include <gio/gio.h>
+#include <libsystem/libsystem.h>
+#include <libsystem/config-parser.h>
+
+#include "busactd.h"
+#include "conf.h"
+#include "log.h"
+#include "trace.h"
+
+static int busactd_config_parse_dbus_signal(
+                const char *filename,
+                unsigned line,
+                const char *section,
+                const char *lvalue,
+                int ltype,
+                const char *rvalue,
+                void *userdata) {
+
+        struct busactd_listener *listener = userdata;
+        struct busactd_match *match = NULL;
+        struct busactd_parse_error error = {};
+        int r;
+
+        assert(filename);
+        assert(lvalue);
+        assert(rvalue);
+        assert(userdata);
+
+        if (isempty(rvalue)) {
+                log_dbg("%s has no vaild data on %d, just skipped.", filename, line);
+                return 0;
+        }
+
+        r = busactd_match_new_from_string(listener, rvalue, &match, &error);
+        if (r == -EINVAL) {
+                log_err("%s:%u:%u: Invalid %s, %s, ignoring.", filename, line, error.column, lvalue, error.reason);
+                return 0;
+        } else if (r < 0)
+                return r;
+
+        match->type = BUSACTD_MATCH_TYPE_PERSISTENT;
+
+        listener->match_list = g_list_append(listener->match_list, match);
+
+        return 0;
+}
+
+static int busactd_config_parse_priority(
+                const char *filename,
+                unsigned line,
+                const char *section,
+                const char *lvalue,
+                int ltype,
+                const char *rvalue,
+                void *userdata) {
+
+        enum busactd_priority *p = userdata;
+        enum busactd_priority priority;
+
+        assert(filename);
+        assert(lvalue);
+        assert(rvalue);
+        assert(userdata);
+
+        priority = busactd_priority_from_string(rvalue);
+        if (priority == _BUSACTD_PRIORITY_INVALID) {
+                log_err("%s:%u: Unknown %s '%s', ignoring.", filename, line, lvalue, rvalue);
+                return 0;
+        }
+
+        *p = priority;
+
+        return 0;
+}
+
+static int busactd_get_busname_from_name(const char *path, char **busname) {
+        char *name = NULL, *b = NULL;
+
+        assert(path);
+        assert(busname);
+
+        name = basename(path);
+        b = strndup(name, strlen(name) - strlen(BUSACTD_CONF_EXT));
+        if (!b)
+                return -ENOMEM;
+
+        *busname = b;
+
+        return 0;
+}
+
+/* Parses one listener config. On success *listener is the new listener,
+ * not added to busactd yet, or NULL if the file subscribes nothing. */
+int busactd_config_parse_listener(struct busactd *busactd, const char *path, struct busactd_listener **ret) {
+        struct busactd_listener *listener;
+        gint64 start;
+        int r;
+
+        assert(busactd);
+        assert(path);
+        assert(ret);
+
+        *ret = NULL;
+
+        if (!endswith(path, BUSACTD_CONF_EXT)) {
+                log_dbg("file '%s' has no '%s' extension.", path, BUSACTD_CONF_EXT);
+                return -EINVAL;
+        }
+
+        listener = busactd_listener_new(busactd);
+        if (!listener)
+                return -ENOMEM;
+
+        ConfigTableItem items[] = {
+                { "BusAct",     "BusName",      config_parse_string,            0,      &listener->busname      },
+                { "BusAct",     "Subscribe",    busactd_config_parse_dbus_signal, 0,    listener                },
+                { "BusAct",     "Priority",     busactd_config_parse_priority,  0,      &listener->priority     },
+                { "BusAct",     "LoadPhase",    busactd_config_parse_priority,  0,      &listener->load_phase   },
+                { NULL,         NULL,           NULL,                           0,      NULL                    }
+        };
+
+        start = g_get_monotonic_time();
+        r = config_parse(path, (void *)items);
+        busactd_startup_account(busactd, BUSACTD_STARTUP_FILE_PARSE, start);
+        if (r < 0) {
+                log_err("Failed to parse configuration file: %s", strerror(-r));
+                goto on_error;
+        }
+
+        if (!listener->busname) {
+                r = busactd_get_busname_from_name(path, &listener->busname);
+                if (r < 0) {
+                        log_err("Failed to get busname from file name: %s", strerror(-r));
+                        goto on_error;
+                }
+        }
+
+        if (!listener->match_list) {
+                log_dbg("Nothing to subscribe signal: %s", path);
+                trace_config_parsed(path, NULL);
+                busactd_listener_free(listener);
+                return 0;
+        }
+
+        trace_config_parsed(path, listener->busname);
+        *ret = listener;
+
+        return 0;
+
+on_error:
+        busactd_listener_free(listener);
+        return r;
+}
@@ -19,6 +19,10 @@
  */
 
 #include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <stddef.h>
+#include <stdbool.h>
 #include <errno.h>
 #include <assert.h>
 
@@ -30,7 +34,43 @@
 
 #include "busactd.h"
 #include "dbus.h"
+#include "capture.h"
 #include "log.h"
+#include "trace.h"
+
+/* Upper bound of entries returned by one ListListenersFiltered call,
+ * so a single poll never blocks the main loop for long. */
+#define BUSACTD_LIST_LIMIT_MAX  1024
+
+/* Changes queued within this window are sent as one signal. */
+#define BUSACTD_CHANGES_DELAY_USEC      (100 * 1000)
+#define BUSACTD_CHANGES_SLACK_USEC      (50 * 1000)
+/* Beyond this many queued changes a single Resync entry is sent
+ * instead, listeners of the signal then call ListListeners again. */
+#define BUSACTD_CHANGES_MAX             1024
+
+#define BUSACTD_DBUS_NAME       "org.tizen.busactd"
+#define BUSACTD_DBUS_PATH       "/Org/Tizen/BusActD"
+#define BUSACTD_DBUS_INTERFACE  "org.tizen.busactd"
+
+/* Returned for a cursor which expired or outlived a registry change,
+ * the listing has to start over from cursor 0. */
+#define BUSACTD_DBUS_ERROR_CURSOR_EXPIRED       BUSACTD_DBUS_INTERFACE ".Error.CursorExpired"
+
+struct busactd_change {
+        enum busactd_change_event event;
+        char *busname;
+        unsigned int id;
+        enum busactd_match_type type;
+        bool has_owner;
+};
+
+static const char * const busactd_change_event_table[_BUSACTD_CHANGE_MAX] = {
+        [BUSACTD_CHANGE_SUBSCRIPTION_ADDED]     = "SubscriptionAdded",
+        [BUSACTD_CHANGE_SUBSCRIPTION_REMOVED]   = "SubscriptionRemoved",
+        [BUSACTD_CHANGE_LISTENER_OWNER_CHANGED] = "ListenerOwnerChanged",
+        [BUSACTD_CHANGE_RESYNC]                 = "Resync",
+};
 
 static const gchar busactd_introspection_xml[] =
         "<node>"
@@ -38,19 +78,282 @@ static const gchar busactd_introspection_xml[] =
         "    <method name='ListListeners'>"
         "      <arg type='a{sa{ua{sv}}}' name='return' direction='out'/>"
         "    </method>"
+        "    <method name='ListListenersFiltered'>"
+        "      <arg type='s' name='BusNamePrefix' direction='in'/>"
+        "      <arg type='s' name='Type' direction='in'/>"
+        "      <arg type='u' name='Cursor' direction='in'/>"
+        "      <arg type='u' name='Limit' direction='in'/>"
+        "      <arg type='a(sususssss)' name='Listeners' direction='out'/>"
+        "      <arg type='u' name='NextCursor' direction='out'/>"
+        "    </method>"
         "    <method name='AddSubscription'>"
         "      <arg type='s' name='BusName' direction='in'/>"
         "      <arg type='s' name='Subscribe' direction='in'/>"
         "      <arg type='u' name='SubcriptionID' direction='out'/>"
         "    </method>"
+        "    <method name='AddSubscriptionWithFlags'>"
+        "      <arg type='s' name='BusName' direction='in'/>"
+        "      <arg type='s' name='Subscribe' direction='in'/>"
+        "      <arg type='u' name='Flags' direction='in'/>"
+        "      <arg type='u' name='SubcriptionID' direction='out'/>"
+        "    </method>"
         "    <method name='RemoveSubscription'>"
         "      <arg type='u' name='SubcriptionID' direction='in'/>"
         "      <arg type='s' name='Result' direction='out'/>"
         "    </method>"
+        "    <method name='GetStatistics'>"
+        "      <arg type='a{st}' name='Statistics' direction='out'/>"
+        "    </method>"
+        "    <method name='GetMemoryStats'>"
+        "      <arg type='a{st}' name='Memory' direction='out'/>"
+        "    </method>"
+        "    <signal name='SubscriptionAdded'>"
+        "      <arg type='s' name='BusName'/>"
+        "      <arg type='u' name='SubcriptionID'/>"
+        "      <arg type='s' name='Type'/>"
+        "    </signal>"
+        "    <signal name='SubscriptionRemoved'>"
+        "      <arg type='s' name='BusName'/>"
+        "      <arg type='u' name='SubcriptionID'/>"
+        "      <arg type='s' name='Type'/>"
+        "    </signal>"
+        "    <signal name='ListenerOwnerChanged'>"
+        "      <arg type='s' name='BusName'/>"
+        "      <arg type='b' name='HasOwner'/>"
+        "    </signal>"
+        "    <signal name='ListenersChanged'>"
+        "      <arg type='a(ssusb)' name='Changes'/>"
+        "    </signal>"
+        "    <property type='as' name='LoadedPhases' access='read'/>"
         "  </interface>"
         "</node>";
 
-static void busactd_dbus_handle_method_call_list_listeners(
+static void busactd_change_free(struct busactd_change *change) {
+
+        if (!change)
+                return;
+
+        free(change->busname);
+        free(change);
+}
+
+static void busactd_dbus_emit_change(struct busactd_dbus *bus, struct busactd_change *change) {
+        g_autoptr(GError) error = NULL;
+        GVariant *parameters;
+
+        assert(bus);
+        assert(change);
+
+        if (change->event == BUSACTD_CHANGE_LISTENER_OWNER_CHANGED)
+                parameters = g_variant_new("(sb)",
+                                           change->busname,
+                                           change->has_owner);
+        else
+                parameters = g_variant_new("(sus)",
+                                           change->busname,
+                                           change->id,
+                                           busactd_match_type_to_string(change->type));
+
+        if (!g_dbus_connection_emit_signal(bus->connection,
+                                           NULL,
+                                           BUSACTD_DBUS_PATH,
+                                           BUSACTD_DBUS_INTERFACE,
+                                           busactd_change_event_table[change->event],
+                                           parameters,
+                                           &error))
+                log_err("Failed to emit %s: %s",
+                        busactd_change_event_table[change->event], error->message);
+}
+
+static void busactd_dbus_flush_changes(struct busactd_timer *timer, void *userdata) {
+        struct busactd_dbus *bus = userdata;
+        g_autoptr(GError) error = NULL;
+        GVariantBuilder builder;
+        GList *list;
+
+        assert(bus);
+
+        g_variant_builder_init(&builder, G_VARIANT_TYPE("a(ssusb)"));
+
+        if (bus->pending_resync) {
+                g_variant_builder_add(&builder,
+                                      "(ssusb)",
+                                      busactd_change_event_table[BUSACTD_CHANGE_RESYNC],
+                                      "", 0, "", FALSE);
+                goto emit;
+        }
+
+        if (g_queue_is_empty(&bus->pending_changes)) {
+                g_variant_builder_clear(&builder);
+                return;
+        }
+
+        /* A lone change is sent as its own signal, a burst is
+         * coalesced into a single ListenersChanged. */
+        if (g_queue_get_length(&bus->pending_changes) == 1) {
+                g_variant_builder_clear(&builder);
+                busactd_dbus_emit_change(bus, g_queue_peek_head(&bus->pending_changes));
+                goto finish;
+        }
+
+        FOREACH_G_LIST(list, bus->pending_changes.head) {
+                struct busactd_change *change = list->data;
+
+                g_variant_builder_add(&builder,
+                                      "(ssusb)",
+                                      busactd_change_event_table[change->event],
+                                      change->busname,
+                                      change->id,
+                                      busactd_match_type_to_string(change->type),
+                                      change->has_owner);
+        }
+
+emit:
+        if (!g_dbus_connection_emit_signal(bus->connection,
+                                           NULL,
+                                           BUSACTD_DBUS_PATH,
+                                           BUSACTD_DBUS_INTERFACE,
+                                           "ListenersChanged",
+                                           g_variant_new("(a(ssusb))", &builder),
+                                           &error))
+                log_err("Failed to emit ListenersChanged: %s", error->message);
+
+finish:
+        g_queue_clear_full(&bus->pending_changes, (GDestroyNotify) busactd_change_free);
+        bus->pending_resync = false;
+}
+
+void busactd_dbus_queue_change(struct busactd *busactd,
+                               enum busactd_change_event event,
+                               struct busactd_listener *listener,
+                               struct busactd_match *match) {
+
+        struct busactd_dbus *bus;
+        struct busactd_change *change;
+
+        assert(busactd);
+        assert(listener);
+
+        bus = busactd->bus;
+        if (!bus || !bus->connection)
+                return;
+
+        if (bus->pending_resync)
+                return;
+
+        if (g_queue_get_length(&bus->pending_changes) >= BUSACTD_CHANGES_MAX) {
+                g_queue_clear_full(&bus->pending_changes, (GDestroyNotify) busactd_change_free);
+                bus->pending_resync = true;
+                return;
+        }
+
+        change = new0(struct busactd_change, 1);
+        if (!change)
+                goto on_error;
+
+        change->event = event;
+        change->busname = strdup(listener->busname);
+        if (!change->busname)
+                goto on_error;
+
+        change->has_owner = listener->name_has_owner == NAME_HAS_OWNER_TRUE;
+        if (match) {
+                change->id = match->id;
+                change->type = match->type;
+        } else
+                change->type = BUSACTD_MATCH_TYPE_PERSISTENT;
+
+        g_queue_push_tail(&bus->pending_changes, change);
+
+        if (!bus->pending_changes_timer.armed)
+                busactd_timer_arm(&bus->pending_changes_timer,
+                                  BUSACTD_CHANGES_DELAY_USEC,
+                                  BUSACTD_CHANGES_SLACK_USEC);
+
+        return;
+
+on_error:
+        log_err("Failed to allocate change notification");
+        busactd_change_free(change);
+}
+
+#define BUSACTD_STAT(name, field) { name, offsetof(struct busactd_stats, field) }
+#define BUSACTD_QUEUE_STATS(name, priority)                                               \
+        BUSACTD_STAT("Queue" name "Depth",              queues[priority].depth),            \
+        BUSACTD_STAT("Queue" name "DepthMax",           queues[priority].depth_max),        \
+        BUSACTD_STAT("Queue" name "Dispatched",         queues[priority].dispatched),       \
+        BUSACTD_STAT("Queue" name "Dropped",            queues[priority].dropped),          \
+        BUSACTD_STAT("Queue" name "LatencyUsecSum",     queues[priority].latency_usec_sum), \
+        BUSACTD_STAT("Queue" name "LatencyUsecMax",     queues[priority].latency_usec_max)
+
+static const struct {
+        const char *name;
+        size_t offset;
+} busactd_stats_table[] = {
+        BUSACTD_STAT("SignalsForwarded",                  signals_forwarded),
+        BUSACTD_STAT("SignalsForwardFailed",              signals_forward_failed),
+        BUSACTD_STAT("SubscriptionsAdded",                subscriptions_added),
+        BUSACTD_STAT("SubscriptionsRemoved",              subscriptions_removed),
+        BUSACTD_STAT("SubscriptionsRejectedClientQuota",  subscriptions_rejected_client_quota),
+        BUSACTD_STAT("SubscriptionsRejectedUserQuota",    subscriptions_rejected_user_quota),
+        BUSACTD_STAT("SubscriptionsRejectedClientRate",   subscriptions_rejected_client_rate),
+        BUSACTD_STAT("SubscriptionsRejectedUserRate",     subscriptions_rejected_user_rate),
+        BUSACTD_STAT("SubscriptionsRejectedMemory",       subscriptions_rejected_memory),
+        BUSACTD_STAT("ClientsVanished",                   clients_vanished),
+        BUSACTD_STAT("PeerSignalsReceived",               p2p_signals_received),
+        BUSACTD_STAT("PeersRejected",                     p2p_peers_rejected),
+        BUSACTD_STAT("PredictionsStarted",                predictions_started),
+        BUSACTD_STAT("PredictionsHit",                    predictions_hit),
+        BUSACTD_STAT("PredictionsMissed",                 predictions_missed),
+        BUSACTD_STAT("PredictionsSkipped",                predictions_skipped),
+        BUSACTD_STAT("PredictionsFailed",                 predictions_failed),
+        BUSACTD_STAT("ActivationsStarted",                activations_started),
+        BUSACTD_STAT("ActivationsCompleted",              activations_completed),
+        BUSACTD_STAT("ActivationsTimedOut",               activations_timed_out),
+        BUSACTD_STAT("ActivationsFailed",                 activations_failed),
+        BUSACTD_STAT("ActivationsInFlight",               activations_in_flight),
+        BUSACTD_STAT("ActivationsWaiting",                activations_waiting),
+        BUSACTD_STAT("ActivationSignalsDeferred",         activation_signals_deferred),
+        BUSACTD_STAT("ActivationWaitUsecSum",             activation_wait_usec_sum),
+        BUSACTD_STAT("ActivationWaitUsecMax",             activation_wait_usec_max),
+        BUSACTD_STAT("LoopLagUsec",                       loop_lag_usec),
+        BUSACTD_STAT("LoopLagUsecMax",                    loop_lag_usec_max),
+        BUSACTD_STAT("LoopLagLe1ms",                      loop_lag_hist[0]),
+        BUSACTD_STAT("LoopLagLe4ms",                      loop_lag_hist[1]),
+        BUSACTD_STAT("LoopLagLe16ms",                     loop_lag_hist[2]),
+        BUSACTD_STAT("LoopLagLe64ms",                     loop_lag_hist[3]),
+        BUSACTD_STAT("LoopLagLe250ms",                    loop_lag_hist[4]),
+        BUSACTD_STAT("LoopLagLe1s",                       loop_lag_hist[5]),
+        BUSACTD_STAT("LoopLagLe4s",                       loop_lag_hist[6]),
+        BUSACTD_STAT("LoopLagAbove4s",                    loop_lag_hist[7]),
+        BUSACTD_STAT("MainLoopWakeups",                   main_loop_wakeups),
+        BUSACTD_STAT("WakeupsLastHour",                   wakeups_last_hour),
+        BUSACTD_STAT("TimerWakeups",                      timer_wakeups),
+        BUSACTD_STAT("MemoryTrims",                       memory_trims),
+        BUSACTD_STAT("FilterEvaluations",                 filter_evaluations),
+        BUSACTD_STAT("FilterDropped",                     filter_dropped),
+        BUSACTD_STAT("FilterSteps",                       filter_steps),
+        BUSACTD_QUEUE_STATS("High",                       BUSACTD_PRIORITY_HIGH),
+        BUSACTD_QUEUE_STATS("Normal",                     BUSACTD_PRIORITY_NORMAL),
+        BUSACTD_QUEUE_STATS("Low",                        BUSACTD_PRIORITY_LOW),
+};
+
+/* Returns the name of statistic 'i' and stores its value, or NULL
+ * past the last one. */
+const char *busactd_dbus_get_statistic(struct busactd *busactd, unsigned int i, guint64 *value) {
+
+        assert(busactd);
+        assert(value);
+
+        if (i >= G_N_ELEMENTS(busactd_stats_table))
+                return NULL;
+
+        *value = *(guint64 *) ((char *) &busactd->stats + busactd_stats_table[i].offset);
+
+        return busactd_stats_table[i].name;
+}
+
+static void busactd_dbus_handle_method_call_get_statistics(
                 GDBusConnection *connection,
                 const char *sender,
                 const char *object_path,
@@ -62,7 +365,57 @@ static void busactd_dbus_handle_method_call_list_listeners(
 
         struct busactd *busactd = user_data;
         GVariantBuilder builder;
-        GList *list;
+        const char *name;
+        guint64 value;
+        unsigned int i;
+
+        assert(connection);
+        assert(sender);
+        assert(object_path);
+        assert(interface_name);
+        assert(method_name);
+        assert(parameters);
+        assert(invocation);
+        assert(user_data);
+
+        g_variant_builder_init(&builder, G_VARIANT_TYPE("a{st}"));
+
+        for (i = 0; (name = busactd_dbus_get_statistic(busactd, i, &value)); i++)
+                g_variant_builder_add(&builder, "{st}", name, value);
+
+        g_dbus_method_invocation_return_value(invocation,
+                                              g_variant_new("(a{st})", &builder));
+}
+
+/* Resident set size of the whole process, shared by all buses. */
+static guint64 busactd_dbus_get_rss(void) {
+        _cleanup_free_ char *buf = NULL;
+        unsigned long pages;
+
+        if (!g_file_get_contents("/proc/self/statm", &buf, NULL, NULL))
+                return 0;
+
+        if (sscanf(buf, "%*u %lu", &pages) != 1)
+                return 0;
+
+        return (guint64) pages * sysconf(_SC_PAGESIZE);
+}
+
+static void busactd_dbus_handle_method_call_get_memory_stats(
+                GDBusConnection *connection,
+                const char *sender,
+                const char *object_path,
+                const char *interface_name,
+                const char *method_name,
+                GVariant *parameters,
+                GDBusMethodInvocation *invocation,
+                void *user_data) {
+
+        struct busactd *busactd = user_data;
+        gsize bytes[_BUSACTD_MEMORY_CATEGORY_MAX];
+        GVariantBuilder builder;
+        guint64 total = 0;
+        unsigned int i;
 
         assert(connection);
         assert(sender);
@@ -73,6 +426,32 @@ static void busactd_dbus_handle_method_call_list_listeners(
         assert(invocation);
         assert(user_data);
 
+        busactd_memory_get(busactd, bytes);
+
+        g_variant_builder_init(&builder, G_VARIANT_TYPE("a{st}"));
+
+        for (i = 0; i < _BUSACTD_MEMORY_CATEGORY_MAX; i++) {
+                g_variant_builder_add(&builder, "{st}",
+                                      busactd_memory_category_to_string(i),
+                                      (guint64) bytes[i]);
+                total += bytes[i];
+        }
+
+        g_variant_builder_add(&builder, "{st}", "Total", total);
+        g_variant_builder_add(&builder, "{st}", "Budget",
+                              (guint64) MAX(busactd->settings.memory_budget_kib, 0) * 1024);
+        g_variant_builder_add(&builder, "{st}", "Rss", busactd_dbus_get_rss());
+
+        g_dbus_method_invocation_return_value(invocation,
+                                              g_variant_new("(a{st})", &builder));
+}
+
+static GVariant *busactd_dbus_build_listeners(struct busactd *busactd) {
+        GVariantBuilder builder;
+        GList *list;
+
+        assert(busactd);
+
         g_variant_builder_init(&builder, G_VARIANT_TYPE("a{sa{ua{sv}}}"));
 
         FOREACH_G_LIST(list, busactd->listener_list) {
@@ -125,14 +504,20 @@ static void busactd_dbus_handle_method_call_list_listeners(
                                                       "Arg",
                                                       g_variant_new_string(match->arg));
 
+                        if (match->filter)
+                                g_variant_builder_add(&m_builder,
+                                                      "{sv}",
+                                                      "Filter",
+                                                      g_variant_new_string(match->filter));
+
                         g_variant_builder_add(&m_builder,
                                               "{sv}",
                                               "Type",
-                                              g_variant_new_string(match->type == BUSACTD_MATCH_TYPE_PERSISTENT ? "PERSISTENT" : "RUNTIME"));
+                                              g_variant_new_string(busactd_match_type_to_string(match->type)));
 
                         g_variant_builder_add(&l_builder,
                                               "{u@a{sv}}",
-                                              match->m_id,
+                                              match->id,
                                               g_variant_builder_end(&m_builder));
                 }
 
@@ -142,12 +527,10 @@ static void busactd_dbus_handle_method_call_list_listeners(
                                       g_variant_builder_end(&l_builder));
         }
 
-        g_dbus_method_invocation_return_value(invocation,
-                                              g_variant_new("(a{sa{ua{sv}}})",
-                                                            &builder));
+        return g_variant_new("(a{sa{ua{sv}}})", &builder);
 }
 
-static void busactd_dbus_handle_method_call_add_subscription(
+static void busactd_dbus_handle_method_call_list_listeners(
                 GDBusConnection *connection,
                 const char *sender,
                 const char *object_path,
@@ -157,11 +540,8 @@ static void busactd_dbus_handle_method_call_add_subscription(
                 GDBusMethodInvocation *invocation,
                 void *user_data) {
 
-        _cleanup_free_ char *subscription = NULL, *busname = NULL;
         struct busactd *busactd = user_data;
-        struct busactd_listener *listener;
-        struct busactd_match *match;
-        int r;
+        struct busactd_dbus *bus;
 
         assert(connection);
         assert(sender);
@@ -172,16 +552,214 @@ static void busactd_dbus_handle_method_call_add_subscription(
         assert(invocation);
         assert(user_data);
 
-        g_variant_get(parameters, "(ss)", &busname, &subscription);
-        if (!busname || !subscription) {
+        bus = busactd->bus;
+
+        /* The reply is rebuilt only when the registry has changed
+         * since the last call, otherwise the cached and already
+         * serialized variant is handed out with an extra reference. */
+        if (!bus->listeners_cache ||
+            bus->listeners_cache_generation != busactd->generation) {
+                if (bus->listeners_cache)
+                        g_variant_unref(bus->listeners_cache);
+
+                bus->listeners_cache = g_variant_ref_sink(busactd_dbus_build_listeners(busactd));
+                (void) g_variant_get_data(bus->listeners_cache);
+                bus->listeners_cache_generation = busactd->generation;
+        }
+
+        g_dbus_method_invocation_return_value(invocation, bus->listeners_cache);
+}
+
+/* Returns the cursor 'id', NULL if it expired. */
+static struct busactd_list_cursor *busactd_dbus_find_list_cursor(struct busactd_dbus *bus, unsigned int id) {
+        unsigned int i;
+
+        assert(bus);
+
+        for (i = 0; i < BUSACTD_LIST_CURSORS; i++)
+                if (bus->list_cursors[i].id == id)
+                        return &bus->list_cursors[i];
+
+        return NULL;
+}
+
+/* Returns the slot for a new cursor, the one of the oldest */
+static struct busactd_list_cursor *busactd_dbus_new_list_cursor(struct busactd_dbus *bus) {
+        struct busactd_list_cursor *cursor;
+
+        assert(bus);
+
+        if (!++bus->last_list_cursor_id)
+                bus->last_list_cursor_id++;
+
+        cursor = &bus->list_cursors[bus->last_list_cursor_id % BUSACTD_LIST_CURSORS];
+        cursor->id = bus->last_list_cursor_id;
+
+        return cursor;
+}
+
+/* Pages resume at the match the last one stopped at, kept in a cursor,
+ * so a full listing walks the registry once. Once a listener or match
+ * came or went, the cursor is refused rather than skipping or
+ * repeating entries. */
+static void busactd_dbus_handle_method_call_list_listeners_filtered(
+                GDBusConnection *connection,
+                const char *sender,
+                const char *object_path,
+                const char *interface_name,
+                const char *method_name,
+                GVariant *parameters,
+                GDBusMethodInvocation *invocation,
+                void *user_data) {
+
+        _cleanup_free_ char *prefix = NULL, *type = NULL;
+        struct busactd *busactd = user_data;
+        struct busactd_dbus *bus = busactd->bus;
+        struct busactd_list_cursor *cursor = NULL;
+        enum busactd_match_type match_type = _BUSACTD_MATCH_TYPE_INVALID;
+        unsigned int cursor_id, limit, n = 0, next = 0;
+        GVariantBuilder builder;
+        size_t prefix_len;
+        GList *list, *m_start = NULL;
+
+        assert(connection);
+        assert(sender);
+        assert(object_path);
+        assert(interface_name);
+        assert(method_name);
+        assert(parameters);
+        assert(invocation);
+        assert(user_data);
+
+        g_variant_get(parameters, "(ssuu)", &prefix, &type, &cursor_id, &limit);
+        if (!prefix || !type) {
                 g_dbus_method_invocation_return_error_literal(
                         invocation,
                         G_DBUS_ERROR,
                         G_DBUS_ERROR_NO_MEMORY,
-                        "Failed to get busname or subscription from parameters.");
+                        "Failed to get filter from parameters.");
                 return;
         }
 
+        if (!isempty(type)) {
+                match_type = busactd_match_type_from_string(type);
+                if (match_type == _BUSACTD_MATCH_TYPE_INVALID) {
+                        g_dbus_method_invocation_return_error(
+                                invocation,
+                                G_DBUS_ERROR,
+                                G_DBUS_ERROR_INVALID_ARGS,
+                                "Unknown match type: %s", type);
+                        return;
+                }
+        }
+
+        list = busactd->listener_list;
+        if (cursor_id) {
+                cursor = busactd_dbus_find_list_cursor(bus, cursor_id);
+                if (!cursor) {
+                        g_dbus_method_invocation_return_dbus_error(
+                                invocation,
+                                BUSACTD_DBUS_ERROR_CURSOR_EXPIRED,
+                                "Cursor expired, start over.");
+                        return;
+                }
+
+                if (cursor->registry_generation != busactd->registry_generation) {
+                        cursor->id = 0;
+                        g_dbus_method_invocation_return_dbus_error(
+                                invocation,
+                                BUSACTD_DBUS_ERROR_CURSOR_EXPIRED,
+                                "Listeners changed since the cursor was made, start over.");
+                        return;
+                }
+
+                list = cursor->listener;
+                m_start = cursor->match;
+        }
+
+        if (!limit || limit > BUSACTD_LIST_LIMIT_MAX)
+                limit = BUSACTD_LIST_LIMIT_MAX;
+
+        prefix_len = strlen(prefix);
+
+        g_variant_builder_init(&builder, G_VARIANT_TYPE("a(sususssss)"));
+
+        for (; list; list = list->next, m_start = NULL) {
+                struct busactd_listener *listener = list->data;
+                GList *m_list;
+
+                assert(listener);
+
+                if (prefix_len && strncmp(listener->busname, prefix, prefix_len))
+                        continue;
+
+                for (m_list = m_start ? m_start : listener->match_list; m_list; m_list = m_list->next) {
+                        struct busactd_match *match = m_list->data;
+
+                        if (match_type != _BUSACTD_MATCH_TYPE_INVALID &&
+                            match->type != match_type)
+                                continue;
+
+                        if (n == limit) {
+                                /* a resumed listing keeps its slot */
+                                if (!cursor)
+                                        cursor = busactd_dbus_new_list_cursor(bus);
+
+                                cursor->registry_generation = busactd->registry_generation;
+                                cursor->listener = list;
+                                cursor->match = m_list;
+                                next = cursor->id;
+                                goto finish;
+                        }
+
+                        /* Owner state is reported as IsNameHasOwner + 1:
+                         * 0 undecided, 1 no owner, 2 has owner. */
+                        g_variant_builder_add(&builder,
+                                              "(sususssss)",
+                                              listener->busname,
+                                              match->id,
+                                              busactd_match_type_to_string(match->type),
+                                              (unsigned int) (listener->name_has_owner + 1),
+                                              match->sender ? match->sender : "",
+                                              match->path ? match->path : "",
+                                              match->interface ? match->interface : "",
+                                              match->member ? match->member : "",
+                                              match->arg ? match->arg : "");
+                        n++;
+                }
+        }
+
+        /* done, the cursor is not needed any longer */
+        if (cursor)
+                cursor->id = 0;
+
+finish:
+        g_dbus_method_invocation_return_value(invocation,
+                                              g_variant_new("(a(sususssss)u)",
+                                                            &builder,
+                                                            next));
+}
+
+static void busactd_dbus_add_subscription(
+                struct busactd *busactd,
+                GDBusMethodInvocation *invocation,
+                struct busactd_client *client,
+                const char *busname,
+                const char *subscription,
+                unsigned int flags) {
+
+        struct busactd_listener *listener;
+        struct busactd_match *match;
+        struct busactd_parse_error error = {};
+        bool added;
+        int r;
+
+        assert(busactd);
+        assert(invocation);
+        assert(client);
+        assert(busname);
+        assert(subscription);
+
         listener = busactd_listener_get(busactd, busname);
         if (!listener) {
                 g_dbus_method_invocation_return_error_literal(
@@ -192,8 +770,18 @@ static void busactd_dbus_handle_method_call_add_subscription(
                 return;
         }
 
-        r = busactd_match_new_from_string(listener, subscription, &match);
-        if (r < 0) {
+        r = busactd_match_new_from_string(listener, subscription, &match, &error);
+        if (r == -EINVAL) {
+                g_dbus_method_invocation_return_error(
+                        invocation,
+                        G_DBUS_ERROR,
+                        G_DBUS_ERROR_INVALID_ARGS,
+                        "Invalid subscription at column %u: %s",
+                        error.column,
+                        error.reason);
+                busactd_listener_unref(listener);
+                return;
+        } else if (r < 0) {
                 g_dbus_method_invocation_return_error_literal(
                         invocation,
                         G_DBUS_ERROR,
@@ -204,11 +792,97 @@ static void busactd_dbus_handle_method_call_add_subscription(
         }
 
         match->type = BUSACTD_MATCH_TYPE_RUNTIME;
+        match->flags = flags;
+        match->uid = client->uid;
+        match->client = strdup(client->name);
+        if (!match->client) {
+                g_dbus_method_invocation_return_error_literal(
+                        invocation,
+                        G_DBUS_ERROR,
+                        G_DBUS_ERROR_NO_MEMORY,
+                        "Failed to allocate client name.");
+                busactd_match_free(match);
+                busactd_listener_unref(listener);
+                return;
+        }
 
-        match = busactd_add_match(match);
+        match = busactd_add_match(match, &added);
+        busactd_register_listener(match->listener);
+
+        if (added)
+                busactd_dbus_queue_change(busactd,
+                                          BUSACTD_CHANGE_SUBSCRIPTION_ADDED,
+                                          match->listener,
+                                          match);
 
         g_dbus_method_invocation_return_value(invocation,
-                                              g_variant_new("(u)", match->m_id));
+                                              g_variant_new("(u)", match->id));
+}
+
+static void busactd_dbus_handle_method_call_add_subscription(
+                GDBusConnection *connection,
+                const char *sender,
+                const char *object_path,
+                const char *interface_name,
+                const char *method_name,
+                GVariant *parameters,
+                GDBusMethodInvocation *invocation,
+                void *user_data) {
+
+        _cleanup_free_ char *subscription = NULL, *busname = NULL;
+        struct busactd *busactd = user_data;
+        struct busactd_client *client;
+        enum busactd_admission admission;
+        unsigned int flags = 0;
+
+        assert(connection);
+        assert(sender);
+        assert(object_path);
+        assert(interface_name);
+        assert(method_name);
+        assert(parameters);
+        assert(invocation);
+        assert(user_data);
+
+        if (streq(method_name, "AddSubscriptionWithFlags"))
+                g_variant_get(parameters, "(ssu)", &busname, &subscription, &flags);
+        else
+                g_variant_get(parameters, "(ss)", &busname, &subscription);
+        if (!busname || !subscription) {
+                g_dbus_method_invocation_return_error_literal(
+                        invocation,
+                        G_DBUS_ERROR,
+                        G_DBUS_ERROR_NO_MEMORY,
+                        "Failed to get busname or subscription from parameters.");
+                return;
+        }
+
+        client = busactd_client_get(busactd, sender);
+        if (!client) {
+                g_dbus_method_invocation_return_error_literal(
+                        invocation,
+                        G_DBUS_ERROR,
+                        G_DBUS_ERROR_NO_MEMORY,
+                        "Failed to get client.");
+                return;
+        }
+
+        /* The call is dispatched again once the uid is known. */
+        if (!busactd_client_resolve_uid(client, invocation))
+                return;
+
+        admission = busactd_client_admit(client);
+        if (admission != BUSACTD_ADMISSION_OK) {
+                g_dbus_method_invocation_return_error(
+                        invocation,
+                        G_DBUS_ERROR,
+                        G_DBUS_ERROR_LIMITS_EXCEEDED,
+                        "Subscription rejected: %s",
+                        busactd_admission_to_string(admission));
+                return;
+        }
+
+        busactd_dbus_add_subscription(busactd, invocation, client, busname, subscription, flags);
 }
 
 static void busactd_dbus_handle_method_call_remove_subscription(
@@ -281,6 +955,10 @@ static void busactd_dbus_handle_method_call(
         assert(invocation);
         assert(user_data);
 
+        trace_method_call_start(sender, method_name);
+        busactd_timer_activity();
+        busactd_lag_enter("method call");
+
         if (streq(method_name, "ListListeners"))
                 busactd_dbus_handle_method_call_list_listeners(connection,
                                                                sender,
@@ -290,7 +968,17 @@ static void busactd_dbus_handle_method_call(
                                                                parameters,
                                                                invocation,
                                                                user_data);
-        else if (streq(method_name, "AddSubscription"))
+        else if (streq(method_name, "ListListenersFiltered"))
+                busactd_dbus_handle_method_call_list_listeners_filtered(connection,
+                                                                        sender,
+                                                                        object_path,
+                                                                        interface_name,
+                                                                        method_name,
+                                                                        parameters,
+                                                                        invocation,
+                                                                        user_data);
+        else if (streq(method_name, "AddSubscription") ||
+                 streq(method_name, "AddSubscriptionWithFlags"))
                 busactd_dbus_handle_method_call_add_subscription(connection,
                                                                  sender,
                                                                  object_path,
@@ -308,19 +996,206 @@ static void busactd_dbus_handle_method_call(
                                                                     parameters,
                                                                     invocation,
                                                                     user_data);
+        else if (streq(method_name, "GetStatistics"))
+                busactd_dbus_handle_method_call_get_statistics(connection,
+                                                               sender,
+                                                               object_path,
+                                                               interface_name,
+                                                               method_name,
+                                                               parameters,
+                                                               invocation,
+                                                               user_data);
+        else if (streq(method_name, "GetMemoryStats"))
+                busactd_dbus_handle_method_call_get_memory_stats(connection,
+                                                                 sender,
+                                                                 object_path,
+                                                                 interface_name,
+                                                                 method_name,
+                                                                 parameters,
+                                                                 invocation,
+                                                                 user_data);
         else
                 g_dbus_method_invocation_return_error(invocation,
                                                       G_DBUS_ERROR,
                                                       G_DBUS_ERROR_UNKNOWN_METHOD,
                                                       "Unknown method: %s", method_name);
+
+        busactd_lag_leave();
+        trace_method_call_end(sender, method_name);
+}
+
+void busactd_dbus_resume_method_call(struct busactd *busactd, GDBusMethodInvocation *invocation) {
+
+        assert(busactd);
+        assert(invocation);
+
+        busactd_dbus_handle_method_call(g_dbus_method_invocation_get_connection(invocation),
+                                        g_dbus_method_invocation_get_sender(invocation),
+                                        g_dbus_method_invocation_get_object_path(invocation),
+                                        g_dbus_method_invocation_get_interface_name(invocation),
+                                        g_dbus_method_invocation_get_method_name(invocation),
+                                        g_dbus_method_invocation_get_parameters(invocation),
+                                        invocation,
+                                        busactd);
+}
+
+static GVariant *busactd_dbus_get_loaded_phases(struct busactd *busactd) {
+        GVariantBuilder builder;
+        unsigned int i;
+
+        g_variant_builder_init(&builder, G_VARIANT_TYPE("as"));
+
+        for (i = 0; i < busactd->load.n_ready; i++)
+                g_variant_builder_add(&builder, "s", busactd_priority_to_string(i));
+
+        return g_variant_builder_end(&builder);
+}
+
+static GVariant *busactd_dbus_handle_get_property(
+                GDBusConnection *connection,
+                const char *sender,
+                const char *object_path,
+                const char *interface_name,
+                const char *property_name,
+                GError **error,
+                void *user_data) {
+
+        struct busactd *busactd = user_data;
+
+        assert(property_name);
+        assert(user_data);
+
+        if (streq(property_name, "LoadedPhases"))
+                return busactd_dbus_get_loaded_phases(busactd);
+
+        g_set_error(error, G_DBUS_ERROR, G_DBUS_ERROR_UNKNOWN_PROPERTY,
+                    "Unknown property: %s", property_name);
+
+        return NULL;
+}
+
+static void busactd_dbus_ping_bus_reply(GObject *source, GAsyncResult *result, void *user_data) {
+        g_autoptr(GError) error = NULL;
+        g_autoptr(GVariant) gvar = NULL;
+        struct busactd *busactd = user_data;
+        struct busactd_dbus *bus = busactd->bus;
+
+        gvar = g_dbus_connection_call_finish(G_DBUS_CONNECTION(source), result, &error);
+        if (!gvar)
+                log_err("Failed to call GetId: %s", error->message);
+
+        assert(bus->sync_pending > 0);
+        if (--bus->sync_pending)
+                return;
+
+        busactd_startup_account(busactd, BUSACTD_STARTUP_MATCH_INSTALL, bus->sync_start);
+        bus->synced(busactd);
+}
+
+/* Calls GetId on 'connection' without waiting for the reply, which
+ * comes after everything sent on it before was handled by the bus. */
+static void busactd_dbus_ping_bus(struct busactd *busactd, GDBusConnection *connection) {
+
+        g_dbus_connection_call(connection,
+                               "org.freedesktop.DBus",
+                               "/org/freedesktop/DBus",
+                               "org.freedesktop.DBus",
+                               "GetId",
+                               NULL,
+                               G_VARIANT_TYPE("(s)"),
+                               G_DBUS_CALL_FLAGS_NONE,
+                               -1,
+                               NULL,
+                               busactd_dbus_ping_bus_reply,
+                               busactd);
+        busactd->bus->sync_pending++;
+}
+
+/* Subscribing sends AddMatch without waiting for it. The bus handles
+ * the messages of a connection in order, so once it answered a call
+ * sent afterwards, all rules are installed and 'synced' is called. */
+void busactd_dbus_sync(struct busactd *busactd, void (*synced)(struct busactd *busactd)) {
+        struct busactd_dbus *bus;
+
+        assert(busactd);
+        assert(synced);
+        bus = busactd->bus;
+
+        if (!bus || !bus->connection) {
+                synced(busactd);
+                return;
+        }
+
+        /* a sync still running finishes with the new callback */
+        if (!bus->sync_pending)
+                bus->sync_start = g_get_monotonic_time();
+        bus->synced = synced;
+
+        busactd_dbus_ping_bus(busactd, bus->connection);
+}
+
+/* Sends PropertiesChanged for LoadedPhases after a load phase got
+ * armed. */
+void busactd_dbus_load_phase_changed(struct busactd *busactd) {
+        g_autoptr(GError) error = NULL;
+        GVariantBuilder builder;
+
+        assert(busactd);
+
+        if (!busactd->bus || !busactd->bus->connection)
+                return;
+
+        g_variant_builder_init(&builder, G_VARIANT_TYPE("a{sv}"));
+        g_variant_builder_add(&builder, "{sv}", "LoadedPhases", busactd_dbus_get_loaded_phases(busactd));
+
+        if (!g_dbus_connection_emit_signal(busactd->bus->connection,
+                                           NULL,
+                                           BUSACTD_DBUS_PATH,
+                                           "org.freedesktop.DBus.Properties",
+                                           "PropertiesChanged",
+                                           g_variant_new("(sa{sv}as)", BUSACTD_DBUS_INTERFACE, &builder, NULL),
+                                           &error))
+                log_err("Failed to emit PropertiesChanged: %s", error->message);
 }
 
 static const GDBusInterfaceVTable busactd_dbus_interface_vtable = {
         .method_call = busactd_dbus_handle_method_call,
-        .get_property = NULL,
+        .get_property = busactd_dbus_handle_get_property,
         .set_property = NULL,
 };
 
+#ifdef HAVE_USDT
+/* Runs on the GDBus worker thread once per message, the subscription
+ * callbacks run once per matching rule. Without a tracer attached it
+ * only tests the semaphore. */
+static GDBusMessage *busactd_dbus_trace_filter(GDBusConnection *connection,
+                                               GDBusMessage *message,
+                                               gboolean incoming,
+                                               gpointer user_data) {
+
+        if (!trace_enabled(signal_received) || !incoming ||
+            g_dbus_message_get_message_type(message) != G_DBUS_MESSAGE_TYPE_SIGNAL)
+                return message;
+
+        trace_signal_received(g_dbus_message_get_sender(message),
+                              g_dbus_message_get_path(message),
+                              g_dbus_message_get_interface(message),
+                              g_dbus_message_get_member(message));
+
+        return message;
+}
+#endif
+
+static void busactd_dbus_add_filters(GDBusConnection *connection) {
+
+        assert(connection);
+
+        busactd_capture_connection(connection);
+#ifdef HAVE_USDT
+        g_dbus_connection_add_filter(connection, busactd_dbus_trace_filter, NULL, NULL);
+#endif
+}
+
 static void busactd_dbus_on_bus_accquired(GDBusConnection *connection,
                                           const gchar *name,
                                           gpointer user_data) {
@@ -333,6 +1208,8 @@ static void busactd_dbus_on_bus_accquired(GDBusConnection *connection,
         assert(user_data);
 
         busactd->bus->connection = connection;
+        busactd_startup_account(busactd, BUSACTD_STARTUP_BUS_ACQUISITION, busactd->startup.start);
+        busactd_dbus_add_filters(connection);
 
         busactd->bus->node_info = g_dbus_node_info_new_for_xml(busactd_introspection_xml, &error);
         if (error) {
@@ -341,7 +1218,7 @@ static void busactd_dbus_on_bus_accquired(GDBusConnection *connection,
         }
 
         g_dbus_connection_register_object(connection,
-                                          "/Org/Tizen/BusActD",
+                                          BUSACTD_DBUS_PATH,
                                           busactd->bus->node_info->interfaces[0],
                                           &busactd_dbus_interface_vtable,
                                           busactd,
@@ -351,6 +1228,62 @@ static void busactd_dbus_on_bus_accquired(GDBusConnection *connection,
                 log_err("Failed to register objects: %s", error->message);
                 assert(false);
         }
+
+        if (busactd->connected)
+                busactd->connected(busactd);
+}
+
+static void busactd_dbus_on_closed(GDBusConnection *connection,
+                                   gboolean remote_peer_vanished,
+                                   GError *error,
+                                   gpointer user_data) {
+
+        struct busactd *busactd = user_data;
+
+        assert(busactd);
+
+        log_info("Connection to %s closed, dropping its listeners", busactd->bus->address);
+
+        while (busactd->listener_list)
+                busactd_remove_listener(busactd->listener_list->data);
+
+        busactd_client_drop_all(busactd);
+
+        busactd_timer_disarm(&busactd->bus->pending_changes_timer);
+        g_queue_clear_full(&busactd->bus->pending_changes, (GDestroyNotify) busactd_change_free);
+        busactd->bus->pending_resync = false;
+
+        busactd->bus->connection = NULL;
+        g_object_unref(connection);
+}
+
+static void busactd_dbus_on_connected(GObject *source,
+                                      GAsyncResult *result,
+                                      gpointer user_data) {
+
+        struct busactd *busactd = user_data;
+        g_autoptr(GError) error = NULL;
+        GDBusConnection *connection;
+
+        assert(busactd);
+
+        connection = g_dbus_connection_new_for_address_finish(result, &error);
+        if (!connection) {
+                log_err("Failed to connect to %s: %s", busactd->bus->address, error->message);
+                return;
+        }
+
+        g_signal_connect(connection, "closed", G_CALLBACK(busactd_dbus_on_closed), busactd);
+
+        busactd_dbus_on_bus_accquired(connection, BUSACTD_DBUS_NAME, busactd);
+
+        busactd->bus->own_id = g_bus_own_name_on_connection(connection,
+                                                            BUSACTD_DBUS_NAME,
+                                                            G_BUS_NAME_OWNER_FLAGS_NONE,
+                                                            NULL,
+                                                            NULL,
+                                                            NULL,
+                                                            NULL);
 }
 
 int busactd_dbus_initialize(void *busactd_data) {
@@ -359,8 +1292,21 @@ int busactd_dbus_initialize(void *busactd_data) {
         assert(busactd);
         assert(busactd->bus);
 
+        busactd_timer_init(&busactd->bus->pending_changes_timer, busactd_dbus_flush_changes, busactd->bus);
+
+        if (busactd->bus->address) {
+                g_dbus_connection_new_for_address(busactd->bus->address,
+                                                  G_DBUS_CONNECTION_FLAGS_AUTHENTICATION_CLIENT |
+                                                  G_DBUS_CONNECTION_FLAGS_MESSAGE_BUS_CONNECTION,
+                                                  NULL,
+                                                  NULL,
+                                                  busactd_dbus_on_connected,
+                                                  busactd);
+                return 0;
+        }
+
         busactd->bus->own_id = g_bus_own_name(busactd->type == BUSACTD_TYPE_SYSTEM ? G_BUS_TYPE_SYSTEM : G_BUS_TYPE_SESSION,
-                                              "org.tizen.busactd",
+                                              BUSACTD_DBUS_NAME,
                                               G_BUS_NAME_OWNER_FLAGS_NONE,
                                               busactd_dbus_on_bus_accquired,
                                               NULL,
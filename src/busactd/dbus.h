@@ -20,12 +20,61 @@
 
 #pragma once
 
+#include <stdbool.h>
 #include <gio/gio.h>
 
+#include "timer.h"
+
+struct busactd;
+struct busactd_listener;
+struct busactd_match;
+
+enum busactd_change_event {
+        BUSACTD_CHANGE_SUBSCRIPTION_ADDED,
+        BUSACTD_CHANGE_SUBSCRIPTION_REMOVED,
+        BUSACTD_CHANGE_LISTENER_OWNER_CHANGED,
+        /* too many changes, the registry has to be read again */
+        BUSACTD_CHANGE_RESYNC,
+        _BUSACTD_CHANGE_MAX,
+};
+
+/* Where a ListListenersFiltered page ended. The links stay valid only
+ * as long as registry_generation is the one of the bus. */
+struct busactd_list_cursor {
+        unsigned int id;
+        guint64 registry_generation;
+        GList *listener;
+        GList *match;
+};
+
+/* Cursors kept at once, the oldest one expires first */
+#define BUSACTD_LIST_CURSORS    8
+
 struct busactd_dbus {
+        /* NULL for the system or session bus, else the bus to connect */
+        char *address;
         unsigned int own_id;
         GDBusConnection *connection;
         GDBusNodeInfo *node_info;
+        GVariant *listeners_cache;
+        guint64 listeners_cache_generation;
+        struct busactd_list_cursor list_cursors[BUSACTD_LIST_CURSORS];
+        unsigned int last_list_cursor_id;
+        /* GetId replies busactd_dbus_sync() waits for */
+        unsigned int sync_pending;
+        gint64 sync_start;
+        void (*synced)(struct busactd *busactd);
+        GQueue pending_changes;
+        bool pending_resync;
+        struct busactd_timer pending_changes_timer;
 };
 
 int busactd_dbus_initialize(void *busactd_data);
+void busactd_dbus_resume_method_call(struct busactd *busactd, GDBusMethodInvocation *invocation);
+void busactd_dbus_queue_change(struct busactd *busactd,
+                               enum busactd_change_event event,
+                               struct busactd_listener *listener,
+                               struct busactd_match *match);
+void busactd_dbus_load_phase_changed(struct busactd *busactd);
+void busactd_dbus_sync(struct busactd *busactd, void (*synced)(struct busactd *busactd));
+const char *busactd_dbus_get_statistic(struct busactd *busactd, unsigned int i, guint64 *value);
@@ -0,0 +1,691 @@
+/*-*- Mode: C; c-basic-offset: 8; indent-tabs-mode: nil -*-*/
+
+/*
+ * busactd
+ *
+ * Copyright (c) 2016 Samsung Electronics Co., Ltd.
+ *
+ * Licensed under the Apache License, Version 2.0 (the License);
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <assert.h>
+#include <glib.h>
+#include <libsystem/libsystem.h>
+
+#include "busactd.h"
+#include "filter.h"
+
+/* A filter is an expression over the signal body, e.g.
+ *
+ *   arg0 == 'charging' || arg1["Level"] in 0..15 && !arg2.1
+ *
+ * argN is the N-th argument of the signal, '.M' the M-th child of a
+ * struct or array and '["key"]' the entry of a string keyed dictionary.
+ * Operands compare as numbers, strings or booleans; comparing values of
+ * different kinds, or a value missing from the body, is false. A bare
+ * operand is true if it is the boolean true.
+ *
+ * It is compiled into instructions of a stack machine. && and || jump
+ * over their right operand keeping the left one as the result. */
+
+enum {
+        FILTER_OP_ARG,          /* push the value at path 'arg' */
+        FILTER_OP_CONST,        /* push constant 'arg' */
+        FILTER_OP_EQ,
+        FILTER_OP_NE,
+        FILTER_OP_LT,
+        FILTER_OP_LE,
+        FILTER_OP_GT,
+        FILTER_OP_GE,
+        FILTER_OP_NOT,
+        FILTER_OP_AND,          /* false on top: jump to 'arg', else pop */
+        FILTER_OP_OR,           /* true on top: jump to 'arg', else pop */
+};
+
+struct busactd_filter_parser {
+        struct busactd_filter *filter;
+        char *p;
+        unsigned int depth;
+        /* of '!' and '(', the parser recurses on them */
+        unsigned int nesting;
+        const char *reason;
+        const char *at;
+};
+
+static int busactd_filter_fail(struct busactd_filter_parser *parser, const char *at, const char *reason) {
+
+        if (!parser->reason) {
+                parser->reason = reason;
+                parser->at = at;
+        }
+
+        return -EINVAL;
+}
+
+static void busactd_filter_skip(struct busactd_filter_parser *parser) {
+        parser->p += strspn(parser->p, WHITESPACE);
+}
+
+static bool busactd_filter_accept(struct busactd_filter_parser *parser, const char *token) {
+
+        busactd_filter_skip(parser);
+
+        if (!g_str_has_prefix(parser->p, token))
+                return false;
+
+        parser->p += strlen(token);
+
+        return true;
+}
+
+static bool busactd_filter_accept_word(struct busactd_filter_parser *parser, const char *word) {
+        size_t n = strlen(word);
+
+        busactd_filter_skip(parser);
+
+        if (strncmp(parser->p, word, n) != 0 ||
+            isalnum((unsigned char) parser->p[n]) || parser->p[n] == '_')
+                return false;
+
+        parser->p += n;
+
+        return true;
+}
+
+/* Returns the index of the instruction, for jumps to be patched */
+static int busactd_filter_emit(struct busactd_filter_parser *parser, uint8_t op, uint8_t arg) {
+        struct busactd_filter *filter = parser->filter;
+
+        if (filter->n_insns >= BUSACTD_FILTER_INSNS_MAX)
+                return busactd_filter_fail(parser, parser->p, "filter too long");
+
+        switch (op) {
+        case FILTER_OP_ARG:
+        case FILTER_OP_CONST:
+                if (++parser->depth > BUSACTD_FILTER_STACK_MAX)
+                        return busactd_filter_fail(parser, parser->p, "filter nested too deeply");
+                break;
+        case FILTER_OP_NOT:
+                break;
+        default:
+                parser->depth--;
+        }
+
+        filter->insns[filter->n_insns].op = op;
+        filter->insns[filter->n_insns].arg = arg;
+
+        return filter->n_insns++;
+}
+
+static void busactd_filter_patch(struct busactd_filter_parser *parser, int insn) {
+        parser->filter->insns[insn].arg = parser->filter->n_insns;
+}
+
+/* Unescapes a quoted string in place */
+static int busactd_filter_parse_string(struct busactd_filter_parser *parser, const char **ret) {
+        char *start = parser->p, *w = parser->p, quote = *parser->p++;
+
+        while (*parser->p != quote) {
+                if (*parser->p == '\\')
+                        parser->p++;
+                if (!*parser->p)
+                        return busactd_filter_fail(parser, start, "unterminated quote");
+                *w++ = *parser->p++;
+        }
+
+        parser->p++;
+        *w = '\0';
+        *ret = start;
+
+        return 0;
+}
+
+static int busactd_filter_add_const(struct busactd_filter_parser *parser, struct busactd_filter_value *value) {
+        struct busactd_filter *filter = parser->filter;
+
+        if (filter->n_consts >= BUSACTD_FILTER_CONSTS_MAX)
+                return busactd_filter_fail(parser, parser->p, "too many constants");
+
+        filter->consts[filter->n_consts] = *value;
+
+        return busactd_filter_emit(parser, FILTER_OP_CONST, filter->n_consts++);
+}
+
+static int busactd_filter_parse_number(struct busactd_filter_parser *parser) {
+        struct busactd_filter_value value = {};
+        char *start = parser->p, *end, *q = parser->p;
+
+        if (*q == '-')
+                q++;
+        while (isdigit((unsigned char) *q))
+                q++;
+
+        /* '..' is a range, not a fraction */
+        if (*q == '.' && isdigit((unsigned char) q[1])) {
+                value.type = BUSACTD_FILTER_TYPE_DOUBLE;
+                value.d = g_ascii_strtod(start, &end);
+        } else {
+                errno = 0;
+                value.type = BUSACTD_FILTER_TYPE_INT;
+                value.i = g_ascii_strtoll(start, &end, 10);
+                if (errno == ERANGE)
+                        return busactd_filter_fail(parser, start, "number out of range");
+        }
+
+        if (end == start)
+                return busactd_filter_fail(parser, start, "invalid number");
+
+        parser->p = end;
+
+        return busactd_filter_add_const(parser, &value);
+}
+
+static int busactd_filter_parse_arg(struct busactd_filter_parser *parser) {
+        struct busactd_filter *filter = parser->filter;
+        struct busactd_filter_path *path;
+        char *start = parser->p;
+        int r;
+
+        if (filter->n_paths >= BUSACTD_FILTER_PATHS_MAX)
+                return busactd_filter_fail(parser, start, "too many arguments referenced");
+
+        path = &filter->paths[filter->n_paths];
+        path->n_steps = 0;
+
+        /* "arg" is followed by the first index */
+        parser->p += 3;
+
+        do {
+                struct busactd_filter_step *step;
+
+                if (path->n_steps >= BUSACTD_FILTER_DEPTH_MAX)
+                        return busactd_filter_fail(parser, start, "argument nested too deeply");
+
+                step = &path->steps[path->n_steps++];
+                step->key = NULL;
+
+                if (*parser->p == '[') {
+                        parser->p++;
+                        busactd_filter_skip(parser);
+                        if (*parser->p != '\'' && *parser->p != '"')
+                                return busactd_filter_fail(parser, parser->p, "expected quoted key");
+
+                        r = busactd_filter_parse_string(parser, &step->key);
+                        if (r < 0)
+                                return r;
+
+                        if (!busactd_filter_accept(parser, "]"))
+                                return busactd_filter_fail(parser, parser->p, "expected ']'");
+                } else {
+                        char *end;
+                        long index;
+
+                        if (path->n_steps > 1)
+                                parser->p++;
+
+                        if (!isdigit((unsigned char) *parser->p))
+                                return busactd_filter_fail(parser, parser->p, "expected index");
+
+                        errno = 0;
+                        index = strtol(parser->p, &end, 10);
+                        if (errno == ERANGE || index > G_MAXUINT16)
+                                return busactd_filter_fail(parser, parser->p, "index out of range");
+
+                        step->index = index;
+                        parser->p = end;
+                }
+        } while (*parser->p == '[' || (*parser->p == '.' && isdigit((unsigned char) parser->p[1])));
+
+        return busactd_filter_emit(parser, FILTER_OP_ARG, filter->n_paths++);
+}
+
+static int busactd_filter_parse_operand(struct busactd_filter_parser *parser) {
+        struct busactd_filter_value value = {};
+        int r;
+
+        busactd_filter_skip(parser);
+
+        if (g_str_has_prefix(parser->p, "arg") && isdigit((unsigned char) parser->p[3]))
+                return busactd_filter_parse_arg(parser);
+
+        if (*parser->p == '\'' || *parser->p == '"') {
+                value.type = BUSACTD_FILTER_TYPE_STRING;
+                r = busactd_filter_parse_string(parser, &value.s);
+                if (r < 0)
+                        return r;
+
+                return busactd_filter_add_const(parser, &value);
+        }
+
+        if (isdigit((unsigned char) *parser->p) ||
+            (*parser->p == '-' && isdigit((unsigned char) parser->p[1])))
+                return busactd_filter_parse_number(parser);
+
+        value.type = BUSACTD_FILTER_TYPE_BOOL;
+        if (busactd_filter_accept_word(parser, "true")) {
+                value.b = true;
+                return busactd_filter_add_const(parser, &value);
+        }
+        if (busactd_filter_accept_word(parser, "false"))
+                return busactd_filter_add_const(parser, &value);
+
+        return busactd_filter_fail(parser, parser->p, "expected argument or value");
+}
+
+static int busactd_filter_parse_comparison(struct busactd_filter_parser *parser) {
+        static const struct {
+                const char *token;
+                uint8_t op;
+        } operators[] = {
+                /* longest first */
+                { "==", FILTER_OP_EQ },
+                { "!=", FILTER_OP_NE },
+                { "<=", FILTER_OP_LE },
+                { ">=", FILTER_OP_GE },
+                { "<",  FILTER_OP_LT },
+                { ">",  FILTER_OP_GT },
+        };
+
+        struct busactd_filter_value truth = { .type = BUSACTD_FILTER_TYPE_BOOL, .b = true };
+        struct busactd_filter_insn operand;
+        unsigned int i;
+        int r, jump;
+
+        r = busactd_filter_parse_operand(parser);
+        if (r < 0)
+                return r;
+
+        operand = parser->filter->insns[r];
+
+        for (i = 0; i < G_N_ELEMENTS(operators); i++)
+                if (busactd_filter_accept(parser, operators[i].token))
+                        break;
+
+        if (i < G_N_ELEMENTS(operators)) {
+                r = busactd_filter_parse_operand(parser);
+                if (r < 0)
+                        return r;
+
+                return busactd_filter_emit(parser, operators[i].op, 0);
+        }
+
+        if (!busactd_filter_accept_word(parser, "in")) {
+                r = busactd_filter_add_const(parser, &truth);
+                if (r < 0)
+                        return r;
+
+                return busactd_filter_emit(parser, FILTER_OP_EQ, 0);
+        }
+
+        /* x in lo..hi is x >= lo && x <= hi */
+        r = busactd_filter_parse_operand(parser);
+        if (r < 0)
+                return r;
+
+        if ((r = busactd_filter_emit(parser, FILTER_OP_GE, 0)) < 0 ||
+            (jump = r = busactd_filter_emit(parser, FILTER_OP_AND, 0)) < 0 ||
+            (r = busactd_filter_emit(parser, operand.op, operand.arg)) < 0)
+                return r;
+
+        if (!busactd_filter_accept(parser, ".."))
+                return busactd_filter_fail(parser, parser->p, "expected '..'");
+
+        r = busactd_filter_parse_operand(parser);
+        if (r < 0)
+                return r;
+
+        r = busactd_filter_emit(parser, FILTER_OP_LE, 0);
+        if (r < 0)
+                return r;
+
+        busactd_filter_patch(parser, jump);
+
+        return 0;
+}
+
+static int busactd_filter_parse_or(struct busactd_filter_parser *parser);
+
+static int busactd_filter_parse_not(struct busactd_filter_parser *parser) {
+        int r;
+
+        busactd_filter_skip(parser);
+
+        if ((*parser->p == '!' || *parser->p == '(') && parser->nesting >= BUSACTD_FILTER_STACK_MAX)
+                return busactd_filter_fail(parser, parser->p, "filter nested too deeply");
+
+        if (*parser->p == '!' && parser->p[1] != '=') {
+                parser->p++;
+
+                parser->nesting++;
+                r = busactd_filter_parse_not(parser);
+                parser->nesting--;
+                if (r < 0)
+                        return r;
+
+                return busactd_filter_emit(parser, FILTER_OP_NOT, 0);
+        }
+
+        if (busactd_filter_accept(parser, "(")) {
+                parser->nesting++;
+                r = busactd_filter_parse_or(parser);
+                parser->nesting--;
+                if (r < 0)
+                        return r;
+
+                if (!busactd_filter_accept(parser, ")"))
+                        return busactd_filter_fail(parser, parser->p, "expected ')'");
+
+                return 0;
+        }
+
+        return busactd_filter_parse_comparison(parser);
+}
+
+static int busactd_filter_parse_and(struct busactd_filter_parser *parser) {
+        int r, jump;
+
+        r = busactd_filter_parse_not(parser);
+        if (r < 0)
+                return r;
+
+        while (busactd_filter_accept(parser, "&&")) {
+                jump = busactd_filter_emit(parser, FILTER_OP_AND, 0);
+                if (jump < 0)
+                        return jump;
+
+                r = busactd_filter_parse_not(parser);
+                if (r < 0)
+                        return r;
+
+                busactd_filter_patch(parser, jump);
+        }
+
+        return 0;
+}
+
+static int busactd_filter_parse_or(struct busactd_filter_parser *parser) {
+        int r, jump;
+
+        r = busactd_filter_parse_and(parser);
+        if (r < 0)
+                return r;
+
+        while (busactd_filter_accept(parser, "||")) {
+                jump = busactd_filter_emit(parser, FILTER_OP_OR, 0);
+                if (jump < 0)
+                        return jump;
+
+                r = busactd_filter_parse_and(parser);
+                if (r < 0)
+                        return r;
+
+                busactd_filter_patch(parser, jump);
+        }
+
+        return 0;
+}
+
+int busactd_filter_compile(const char *expression, struct busactd_filter **ret, struct busactd_parse_error *error) {
+        struct busactd_filter_parser parser = {};
+        struct busactd_filter *filter;
+        size_t n;
+        int r;
+
+        assert(expression);
+        assert(ret);
+
+        n = strlen(expression);
+        filter = malloc(sizeof(struct busactd_filter) + n + 1);
+        if (!filter)
+                return -ENOMEM;
+
+        memset(filter, 0, sizeof(struct busactd_filter));
+        memcpy(filter->buf, expression, n + 1);
+
+        parser.filter = filter;
+        parser.p = filter->buf;
+
+        r = busactd_filter_parse_or(&parser);
+        if (r >= 0) {
+                busactd_filter_skip(&parser);
+                if (*parser.p)
+                        r = busactd_filter_fail(&parser, parser.p, "unexpected trailing input");
+        }
+
+        if (r < 0) {
+                if (error) {
+                        error->column = parser.at - filter->buf + 1;
+                        error->reason = parser.reason;
+                }
+
+                free(filter);
+                return r;
+        }
+
+        *ret = filter;
+
+        return 0;
+}
+
+void busactd_filter_free(struct busactd_filter *filter) {
+        free(filter);
+}
+
+/* Returns a reference to the value at 'path', looking through
+ * variants, or NULL if the body has none there. */
+static GVariant *busactd_filter_resolve(const struct busactd_filter_path *path, GVariant *parameters) {
+        GVariant *v;
+        unsigned int i;
+
+        v = g_variant_ref(parameters);
+
+        for (i = 0; i <= path->n_steps; i++) {
+                const struct busactd_filter_step *step;
+                GVariant *child;
+
+                while (g_variant_is_of_type(v, G_VARIANT_TYPE_VARIANT)) {
+                        child = g_variant_get_variant(v);
+                        g_variant_unref(v);
+                        v = child;
+                }
+
+                if (i == path->n_steps)
+                        break;
+
+                step = &path->steps[i];
+
+                if (step->key) {
+                        if (!g_variant_is_of_type(v, G_VARIANT_TYPE("a{s*}")))
+                                child = NULL;
+                        else
+                                child = g_variant_lookup_value(v, step->key, NULL);
+                } else {
+                        if (!g_variant_is_container(v) || (gsize) step->index >= g_variant_n_children(v))
+                                child = NULL;
+                        else
+                                child = g_variant_get_child_value(v, step->index);
+                }
+
+                g_variant_unref(v);
+                v = child;
+                if (!v)
+                        return NULL;
+        }
+
+        return v;
+}
+
+static void busactd_filter_value_from_variant(GVariant *v, struct busactd_filter_value *value) {
+
+        value->type = BUSACTD_FILTER_TYPE_INT;
+
+        switch (g_variant_classify(v)) {
+        case G_VARIANT_CLASS_BOOLEAN:
+                value->type = BUSACTD_FILTER_TYPE_BOOL;
+                value->b = g_variant_get_boolean(v);
+                break;
+        case G_VARIANT_CLASS_BYTE:
+                value->i = g_variant_get_byte(v);
+                break;
+        case G_VARIANT_CLASS_INT16:
+                value->i = g_variant_get_int16(v);
+                break;
+        case G_VARIANT_CLASS_UINT16:
+                value->i = g_variant_get_uint16(v);
+                break;
+        case G_VARIANT_CLASS_INT32:
+                value->i = g_variant_get_int32(v);
+                break;
+        case G_VARIANT_CLASS_UINT32:
+                value->i = g_variant_get_uint32(v);
+                break;
+        case G_VARIANT_CLASS_INT64:
+                value->i = g_variant_get_int64(v);
+                break;
+        case G_VARIANT_CLASS_UINT64:
+                if (g_variant_get_uint64(v) > G_MAXINT64) {
+                        value->type = BUSACTD_FILTER_TYPE_DOUBLE;
+                        value->d = g_variant_get_uint64(v);
+                } else
+                        value->i = g_variant_get_uint64(v);
+                break;
+        case G_VARIANT_CLASS_DOUBLE:
+                value->type = BUSACTD_FILTER_TYPE_DOUBLE;
+                value->d = g_variant_get_double(v);
+                break;
+        case G_VARIANT_CLASS_STRING:
+        case G_VARIANT_CLASS_OBJECT_PATH:
+        case G_VARIANT_CLASS_SIGNATURE:
+                value->type = BUSACTD_FILTER_TYPE_STRING;
+                value->s = g_variant_get_string(v, NULL);
+                break;
+        default:
+                value->type = BUSACTD_FILTER_TYPE_NONE;
+        }
+}
+
+static bool busactd_filter_is_number(const struct busactd_filter_value *v) {
+        return v->type == BUSACTD_FILTER_TYPE_INT || v->type == BUSACTD_FILTER_TYPE_DOUBLE;
+}
+
+static bool busactd_filter_compare(uint8_t op, const struct busactd_filter_value *a, const struct busactd_filter_value *b) {
+        int c;
+
+        if (a->type == BUSACTD_FILTER_TYPE_STRING && b->type == BUSACTD_FILTER_TYPE_STRING)
+                c = strcmp(a->s, b->s);
+        else if (a->type == BUSACTD_FILTER_TYPE_INT && b->type == BUSACTD_FILTER_TYPE_INT)
+                c = (a->i > b->i) - (a->i < b->i);
+        else if (busactd_filter_is_number(a) && busactd_filter_is_number(b)) {
+                double x = a->type == BUSACTD_FILTER_TYPE_INT ? a->i : a->d;
+                double y = b->type == BUSACTD_FILTER_TYPE_INT ? b->i : b->d;
+
+                c = (x > y) - (x < y);
+        } else if (a->type == BUSACTD_FILTER_TYPE_BOOL && b->type == BUSACTD_FILTER_TYPE_BOOL) {
+                /* booleans are not ordered */
+                if (op != FILTER_OP_EQ && op != FILTER_OP_NE)
+                        return false;
+                c = a->b != b->b;
+        } else
+                return false;
+
+        switch (op) {
+        case FILTER_OP_EQ:
+                return c == 0;
+        case FILTER_OP_NE:
+                return c != 0;
+        case FILTER_OP_LT:
+                return c < 0;
+        case FILTER_OP_LE:
+                return c <= 0;
+        case FILTER_OP_GT:
+                return c > 0;
+        case FILTER_OP_GE:
+                return c >= 0;
+        }
+
+        return false;
+}
+
+static bool busactd_filter_truth(const struct busactd_filter_value *v) {
+        return v->type == BUSACTD_FILTER_TYPE_BOOL && v->b;
+}
+
+/* Evaluates 'filter' on a signal body, adding the number of
+ * instructions run to *steps. */
+bool busactd_filter_eval(const struct busactd_filter *filter, GVariant *parameters, unsigned int *steps) {
+        struct busactd_filter_value stack[BUSACTD_FILTER_STACK_MAX];
+        GVariant *refs[BUSACTD_FILTER_INSNS_MAX];
+        unsigned int pc, sp = 0, n_refs = 0;
+        bool result;
+
+        assert(filter);
+
+        for (pc = 0; pc < filter->n_insns; pc++) {
+                const struct busactd_filter_insn *insn = &filter->insns[pc];
+
+                if (steps)
+                        (*steps)++;
+
+                switch (insn->op) {
+
+                case FILTER_OP_ARG: {
+                        GVariant *v = NULL;
+
+                        if (parameters)
+                                v = busactd_filter_resolve(&filter->paths[insn->arg], parameters);
+
+                        if (v) {
+                                refs[n_refs++] = v;
+                                busactd_filter_value_from_variant(v, &stack[sp++]);
+                        } else
+                                stack[sp++].type = BUSACTD_FILTER_TYPE_NONE;
+                        break;
+                }
+
+                case FILTER_OP_CONST:
+                        stack[sp++] = filter->consts[insn->arg];
+                        break;
+
+                case FILTER_OP_NOT:
+                        stack[sp - 1].b = !busactd_filter_truth(&stack[sp - 1]);
+                        stack[sp - 1].type = BUSACTD_FILTER_TYPE_BOOL;
+                        break;
+
+                case FILTER_OP_AND:
+                case FILTER_OP_OR:
+                        if (busactd_filter_truth(&stack[sp - 1]) == (insn->op == FILTER_OP_OR))
+                                pc = insn->arg - 1;
+                        else
+                                sp--;
+                        break;
+
+                default:
+                        sp--;
+                        stack[sp - 1].b = busactd_filter_compare(insn->op, &stack[sp - 1], &stack[sp]);
+                        stack[sp - 1].type = BUSACTD_FILTER_TYPE_BOOL;
+                }
+        }
+
+        result = sp > 0 && busactd_filter_truth(&stack[sp - 1]);
+
+        while (n_refs > 0)
+                g_variant_unref(refs[--n_refs]);
+
+        return result;
+}
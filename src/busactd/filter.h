@@ -0,0 +1,90 @@
+/*-*- Mode: C; c-basic-offset: 8; indent-tabs-mode: nil -*-*/
+
+/*
+ * busactd
+ *
+ * Copyright (c) 2016 Samsung Electronics Co., Ltd.
+ *
+ * Licensed under the Apache License, Version 2.0 (the License);
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <glib.h>
+
+struct busactd_parse_error;
+
+/* Limits keeping a filter small and its evaluation bounded. Jumps only
+ * go forward, so a filter runs at most BUSACTD_FILTER_INSNS_MAX
+ * instructions per signal. BUSACTD_FILTER_STACK_MAX bounds the nesting
+ * of '!' and parentheses as well, the compiler recurses on them. */
+#define BUSACTD_FILTER_INSNS_MAX        64
+#define BUSACTD_FILTER_CONSTS_MAX       32
+#define BUSACTD_FILTER_PATHS_MAX        16
+#define BUSACTD_FILTER_DEPTH_MAX        8
+#define BUSACTD_FILTER_STACK_MAX        16
+
+enum busactd_filter_type {
+        BUSACTD_FILTER_TYPE_NONE,
+        BUSACTD_FILTER_TYPE_BOOL,
+        BUSACTD_FILTER_TYPE_INT,
+        BUSACTD_FILTER_TYPE_DOUBLE,
+        BUSACTD_FILTER_TYPE_STRING,
+};
+
+struct busactd_filter_value {
+        enum busactd_filter_type type;
+        union {
+                bool b;
+                gint64 i;
+                double d;
+                const char *s;
+        };
+};
+
+/* One step into the signal body: a child by index of a struct or
+ * array, or an entry by key of a string keyed dictionary. Variants on
+ * the way are looked through. */
+struct busactd_filter_step {
+        int index;
+        const char *key;
+};
+
+struct busactd_filter_path {
+        unsigned int n_steps;
+        struct busactd_filter_step steps[BUSACTD_FILTER_DEPTH_MAX];
+};
+
+struct busactd_filter_insn {
+        uint8_t op;
+        /* constant, path or jump target */
+        uint8_t arg;
+};
+
+struct busactd_filter {
+        unsigned int n_insns;
+        unsigned int n_consts;
+        unsigned int n_paths;
+        struct busactd_filter_insn insns[BUSACTD_FILTER_INSNS_MAX];
+        struct busactd_filter_value consts[BUSACTD_FILTER_CONSTS_MAX];
+        struct busactd_filter_path paths[BUSACTD_FILTER_PATHS_MAX];
+        /* unescaped copy of the expression, strings above point into it */
+        char buf[];
+};
+
+int busactd_filter_compile(const char *expression, struct busactd_filter **ret, struct busactd_parse_error *error);
+void busactd_filter_free(struct busactd_filter *filter);
+bool busactd_filter_eval(const struct busactd_filter *filter, GVariant *parameters, unsigned int *steps);
@@ -0,0 +1,167 @@
+/*-*- Mode: C; c-basic-offset: 8; indent-tabs-mode: nil -*-*/
+
+/*
+ * busactd
+ *
+ * Copyright (c) 2016 Samsung Electronics Co., Ltd.
+ *
+ * Licensed under the Apache License, Version 2.0 (the License);
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <assert.h>
+#include <glib.h>
+#include <systemd/sd-daemon.h>
+#include <libsystem/libsystem.h>
+
+#include "busactd.h"
+#include "lag.h"
+#include "log.h"
+
+#define BUSACTD_LAG_PROBE_USEC          (500 * 1000)
+
+/* There is one main loop, however many buses are served */
+static struct busactd_lag *lag;
+
+static const gint64 busactd_lag_bounds[BUSACTD_LAG_BUCKETS] = BUSACTD_LAG_BUCKET_BOUNDS;
+
+static gint64 busactd_lag_stall_usec(void) {
+        return (gint64) lag->busactd->settings.stall_msec * 1000;
+}
+
+void busactd_lag_enter(const char *what) {
+
+        assert(what);
+
+        if (!lag)
+                return;
+
+        if (lag->depth < BUSACTD_LAG_DEPTH) {
+                lag->what[lag->depth] = what;
+                lag->since[lag->depth] = g_get_monotonic_time();
+        }
+
+        lag->depth++;
+}
+
+void busactd_lag_leave(void) {
+        gint64 usec;
+
+        if (!lag)
+                return;
+
+        assert(lag->depth > 0);
+
+        if (--lag->depth >= BUSACTD_LAG_DEPTH)
+                return;
+
+        usec = g_get_monotonic_time() - lag->since[lag->depth];
+        if (busactd_lag_stall_usec() <= 0 || usec < busactd_lag_stall_usec())
+                return;
+
+        lag->last_stall = lag->what[lag->depth];
+        log_err("Main loop stalled for %" G_GINT64_FORMAT " ms in %s",
+                usec / 1000, lag->what[lag->depth]);
+}
+
+static void busactd_lag_sample(gint64 usec) {
+        struct busactd_stats *stats;
+        unsigned int i;
+
+        if (!lag)
+                return;
+
+        stats = &lag->busactd->stats;
+        usec = MAX(usec, 0);
+        lag->last_usec = usec;
+        lag->last_at = g_get_monotonic_time();
+
+        stats->loop_lag_usec = usec;
+        if ((guint64) usec > stats->loop_lag_usec_max)
+                stats->loop_lag_usec_max = usec;
+
+        for (i = 0; usec > busactd_lag_bounds[i]; i++)
+                ;
+        stats->loop_lag_hist[i]++;
+
+        if (busactd_lag_stall_usec() > 0 && usec >= busactd_lag_stall_usec())
+                log_err("Main loop lagged %" G_GINT64_FORMAT " ms, last stall in %s",
+                        usec / 1000, lag->last_stall ?: "an unmarked callback");
+}
+
+/* The probe has no slack, any lateness is the main loop's. Other
+ * timers may fire anywhere within their slack and are not sampled. */
+static void busactd_lag_probe(struct busactd_timer *timer, void *userdata) {
+        busactd_lag_sample(timer->late);
+}
+
+static bool busactd_lag_lagging(void) {
+
+        if (busactd_lag_stall_usec() <= 0 || lag->last_usec < busactd_lag_stall_usec())
+                return false;
+
+        /* the probe is only armed on activity, an older sample says
+         * nothing about the main loop now */
+        return g_get_monotonic_time() - lag->last_at < (gint64) lag->watchdog_usec / 2;
+}
+
+static void busactd_lag_watchdog(struct busactd_timer *timer, void *userdata) {
+
+        /* let systemd see it if the loop keeps on lagging */
+        if (!busactd_lag_lagging())
+                (void) sd_notify(0, "WATCHDOG=1");
+
+        busactd_timer_arm(timer, lag->watchdog_usec / 2, lag->watchdog_usec / 8);
+}
+
+int busactd_lag_initialize(struct busactd *busactd) {
+        uint64_t usec = 0;
+
+        assert(busactd);
+        assert(!lag);
+
+        lag = new0(struct busactd_lag, 1);
+        if (!lag)
+                return -ENOMEM;
+
+        lag->busactd = busactd;
+
+        busactd_timer_init(&lag->probe, busactd_lag_probe, NULL);
+        busactd_timer_on_activity(&lag->probe, BUSACTD_LAG_PROBE_USEC, 0);
+
+        busactd_timer_init(&lag->watchdog, busactd_lag_watchdog, NULL);
+        if (sd_watchdog_enabled(0, &usec) > 0) {
+                lag->watchdog_usec = usec;
+                log_info("Watchdog enabled, %" G_GUINT64_FORMAT " ms", lag->watchdog_usec / 1000);
+                busactd_timer_arm(&lag->watchdog, lag->watchdog_usec / 2, lag->watchdog_usec / 8);
+        }
+
+        return 0;
+}
+
+void busactd_lag_finalize(struct busactd *busactd) {
+
+        assert(busactd);
+
+        if (!lag)
+                return;
+
+        busactd_timer_release(&lag->probe);
+        busactd_timer_release(&lag->watchdog);
+
+        free(lag);
+        lag = NULL;
+}
@@ -0,0 +1,65 @@
+/*-*- Mode: C; c-basic-offset: 8; indent-tabs-mode: nil -*-*/
+
+/*
+ * busactd
+ *
+ * Copyright (c) 2016 Samsung Electronics Co., Ltd.
+ *
+ * Licensed under the Apache License, Version 2.0 (the License);
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#pragma once
+
+#include <stdbool.h>
+#include <glib.h>
+
+#include "timer.h"
+
+struct busactd;
+
+/* Upper bounds of the lag histogram buckets in usec, the last bucket
+ * takes everything above. */
+#define BUSACTD_LAG_BUCKETS     8
+#define BUSACTD_LAG_BUCKET_BOUNDS { 1000, 4000, 16000, 64000, 250000, 1000000, 4000000, G_MAXINT64 }
+
+/* Nesting of busactd_lag_enter() tracked */
+#define BUSACTD_LAG_DEPTH       4
+
+/* Main loop lag: how much later than due the probe timer got
+ * dispatched. It has no slack, and is armed on activity so a busy loop
+ * gets sampled while the bus is not quiet. */
+struct busactd_lag {
+        struct busactd *busactd;
+        struct busactd_timer probe;
+        gint64 last_usec;
+        /* when the last sample was taken */
+        gint64 last_at;
+        /* systemd watchdog interval, 0 if not enabled */
+        guint64 watchdog_usec;
+        struct busactd_timer watchdog;
+        /* callbacks running now, innermost last */
+        unsigned int depth;
+        const char *what[BUSACTD_LAG_DEPTH];
+        gint64 since[BUSACTD_LAG_DEPTH];
+        /* the last callback running longer than the stall threshold */
+        const char *last_stall;
+};
+
+int busactd_lag_initialize(struct busactd *busactd);
+void busactd_lag_finalize(struct busactd *busactd);
+
+/* Marks a callback as running, so a stall can be blamed on it. Calls
+ * nest and must be paired. */
+void busactd_lag_enter(const char *what);
+void busactd_lag_leave(void);
@@ -23,20 +23,23 @@
 #include <errno.h>
 #include <assert.h>
 #include <getopt.h>
+#include <unistd.h>
 
 #include <glib.h>
 #include <gio/gio.h>
+#include <systemd/sd-daemon.h>
 
 #include <libsystem/libsystem.h>
 #include <libsystem/config-parser.h>
 #include <libsystem/glib-util.h>
 
 #include "busactd.h"
+#include "conf.h"
 #include "dbus.h"
+#include "capture.h"
 #include "log.h"
 
-#define BUSACT_CONF_EXT ".conf"
-#define BUSACTD_TIMEOUT_SEC     10
+#define BUSACTD_CONF_FILE       BUSACTD ".conf"
 
 static struct busactd_dbus bd_bus;
 static struct busactd _busactd = {
@@ -44,18 +47,49 @@ static struct busactd _busactd = {
         .bus    = &bd_bus,
         .config_dirs[BUSACTD_LOAD_PRESET]    = "/usr/lib/" BUSACTD,
         .config_dirs[BUSACTD_LOAD_SYSCONFIG] = "/etc/" BUSACTD,
+        .settings = {
+                .predict_confidence             = 50,
+                .predict_starts_per_minute      = 6,
+                .predict_max_pending            = 4,
+                .activation_timeout_sec         = 25,
+                .queue_max_depth                = 4096,
+                .queue_max_age_msec             = 1000,
+                .load_slice_usec                = 5000,
+                .shm_stats_enabled              = true,
+                .stall_msec                     = 250,
+                .memory_trim_threshold_kib      = 1024,
+        },
 };
 static struct busactd *busactd = &_busactd;
+static const char *arg_startup_report = NULL;
+static const char *arg_capture = NULL;
+static GPtrArray *arg_addresses = NULL;
 
 static void busactd_show_help(void) {
         printf("Usage: busactd [OPTIONS...]\n");
-        printf("       -u  --user    run busactd for session\n");
-        printf("       -h  --help    show this help\n");
+        printf("       -u  --user              run busactd for session\n");
+        printf("       -c  --config-dir=DIR    load listeners from DIR only\n");
+        printf("       -a  --address=ADDRESS   serve the bus at ADDRESS, may be repeated to\n");
+        printf("                               serve several buses from one process\n");
+        printf("       --startup-report[=FILE] write startup phase timings as JSON to FILE\n");
+        printf("                               or stdout once loaded, then exit\n");
+        printf("       --capture=FILE          write the trigger signals received to FILE,\n");
+        printf("                               in pcap format, for bench-busactd-replay\n");
+        printf("       -h  --help              show this help\n");
 }
 
 static int parse_argv(int argc, char *argv[]) {
+        enum {
+                ARG_STARTUP_REPORT = 0x100,
+                ARG_CAPTURE,
+        };
+
         static const struct option options[] = {
                 { "user",       no_argument,       NULL, 'u'    },
+                { "startup-report", optional_argument, NULL, ARG_STARTUP_REPORT },
+                { "capture",    required_argument, NULL, ARG_CAPTURE    },
+                { "config-dir", required_argument, NULL, 'c'    },
+                { "address",    required_argument, NULL, 'a'    },
                 { "help",       no_argument,       NULL, 'h'    },
                 { NULL,         0,                 NULL, 0      }
         };
@@ -65,7 +99,7 @@ static int parse_argv(int argc, char *argv[]) {
         assert(argc >= 0);
         assert(argv);
 
-        while ((c = getopt_long(argc, argv, "uh", options, NULL)) >= 0) {
+        while ((c = getopt_long(argc, argv, "uc:a:h", options, NULL)) >= 0) {
 
                 switch (c) {
 
@@ -73,6 +107,27 @@ static int parse_argv(int argc, char *argv[]) {
                         busactd->type = BUSACTD_TYPE_USER;
                         break;
 
+                case 'c':
+                        if (snprintf(busactd->config_dirs[BUSACTD_LOAD_PRESET],
+                                     PATH_MAX, "%s", optarg) >= PATH_MAX)
+                                return -ENAMETOOLONG;
+                        busactd->config_dirs[BUSACTD_LOAD_SYSCONFIG][0] = '\0';
+                        break;
+
+                case 'a':
+                        if (!arg_addresses)
+                                arg_addresses = g_ptr_array_new();
+                        g_ptr_array_add(arg_addresses, optarg);
+                        break;
+
+                case ARG_STARTUP_REPORT:
+                        arg_startup_report = optarg ? optarg : "-";
+                        break;
+
+                case ARG_CAPTURE:
+                        arg_capture = optarg;
+                        break;
+
                 case 'h':
                         busactd_show_help();
                         exit(EXIT_SUCCESS);
@@ -89,6 +144,11 @@ static int parse_argv(int argc, char *argv[]) {
                 }
         }
 
+        if (arg_addresses && arg_startup_report) {
+                log_err("--startup-report cannot be combined with --address.");
+                return -EINVAL;
+        }
+
         return 0;
 }
 
@@ -116,6 +176,56 @@ static int busactd_prepare_runtime_dir(struct busactd *busactd) {
         return do_mkdir(busactd->config_dirs[BUSACTD_LOAD_RUNTIME], 0755);
 }
 
+static int busactd_load_settings(struct busactd *busactd) {
+        struct busactd_settings *settings = &busactd->settings;
+        int i, r;
+
+        ConfigTableItem items[] = {
+                { "Limits",     "SubscriptionsPerClient",       config_parse_int,       0,      &settings->subscriptions_per_client     },
+                { "Limits",     "SubscriptionsPerUser",         config_parse_int,       0,      &settings->subscriptions_per_user       },
+                { "Limits",     "CallRatePerClient",            config_parse_int,       0,      &settings->call_rate_per_client         },
+                { "Limits",     "CallRatePerUser",              config_parse_int,       0,      &settings->call_rate_per_user           },
+                { "P2P",        "Enable",                       config_parse_bool,      0,      &settings->p2p_enabled                  },
+                { "P2P",        "AllowedUsers",                 config_parse_strv,      0,      &settings->p2p_allowed_users            },
+                { "Predict",    "Enable",                       config_parse_bool,      0,      &settings->predict_enabled              },
+                { "Predict",    "Confidence",                   config_parse_int,       0,      &settings->predict_confidence           },
+                { "Predict",    "StartsPerMinute",              config_parse_int,       0,      &settings->predict_starts_per_minute    },
+                { "Predict",    "MaxPending",                   config_parse_int,       0,      &settings->predict_max_pending          },
+                { "Activation", "MaxInFlight",                  config_parse_int,       0,      &settings->activation_max_in_flight     },
+                { "Activation", "TimeoutSec",                   config_parse_int,       0,      &settings->activation_timeout_sec       },
+                { "Queue",      "MaxDepth",                     config_parse_int,       0,      &settings->queue_max_depth              },
+                { "Queue",      "MaxAgeMSec",                   config_parse_int,       0,      &settings->queue_max_age_msec           },
+                { "Load",       "SliceUSec",                    config_parse_int,       0,      &settings->load_slice_usec              },
+                { "Stats",      "SharedMemory",                 config_parse_bool,      0,      &settings->shm_stats_enabled            },
+                { "Monitor",    "StallMSec",                    config_parse_int,       0,      &settings->stall_msec                   },
+                { "Memory",     "BudgetKiB",                    config_parse_int,       0,      &settings->memory_budget_kib            },
+                { "Memory",     "TrimThresholdKiB",             config_parse_int,       0,      &settings->memory_trim_threshold_kib    },
+                { NULL,         NULL,                           NULL,                   0,      NULL                                    }
+        };
+
+        assert(busactd);
+
+        /* Later directories override settings of earlier ones. */
+        for (i = 0; i < BUSACTD_LOAD_MAX; i++) {
+                _cleanup_free_ char *path = NULL;
+
+                if (isempty(busactd->config_dirs[i]))
+                        continue;
+
+                if (asprintf(&path, "%s/%s", busactd->config_dirs[i], BUSACTD_CONF_FILE) < 0)
+                        return -ENOMEM;
+
+                if (access(path, F_OK) < 0)
+                        continue;
+
+                r = config_parse(path, (void *)items);
+                if (r < 0)
+                        log_err("Failed to parse %s: %s", path, strerror(-r));
+        }
+
+        return 0;
+}
+
 static void busactd_unregister_listeners(GList *listeners) {
 
         if (!listeners)
@@ -124,113 +234,89 @@ static void busactd_unregister_listeners(GList *listeners) {
         g_list_free_full(listeners, (GDestroyNotify)busactd_listener_free);
 }
 
-static int busactd_config_parse_dbus_signal(
-                const char *filename,
-                unsigned line,
-                const char *section,
-                const char *lvalue,
-                int ltype,
-                const char *rvalue,
-                void *userdata) {
-
-        struct busactd_listener *listener = userdata;
-        struct busactd_match *match = NULL;
-        int r;
-
-        assert(filename);
-        assert(lvalue);
-        assert(rvalue);
-        assert(userdata);
-
-        if (isempty(rvalue)) {
-                log_dbg("%s has no vaild data on %d, just skipped.", filename, line);
-                return 0;
-        }
-
-        r = busactd_match_new_from_string(listener, rvalue, &match);
-        if (r < 0)
-                return r;
+/* Drops what was not loaded yet when quitting in the middle of it */
+static void busactd_load_abort(struct busactd *busactd) {
+        int i;
 
-        match->type = BUSACTD_MATCH_TYPE_PERSISTENT;
+        assert(busactd);
 
-        listener->match_list = g_list_append(listener->match_list, match);
+        g_queue_clear_full(&busactd->load.files, free);
+        for (i = 0; i < _BUSACTD_PRIORITY_MAX; i++)
+                g_queue_clear_full(&busactd->load.pending[i], (GDestroyNotify)busactd_listener_free);
 
-        return 0;
+        busactd->load.running = false;
 }
 
-static int busactd_get_busname_from_name(const char *path, char **busname) {
-        char *name = NULL, *b = NULL;
+static int busactd_queue_config_file(const char *path, void *userdata) {
+        struct busactd *busactd = userdata;
+        char *p;
 
         assert(path);
-        assert(busname);
+        assert(userdata);
 
-        name = basename(path);
-        b = strndup(name, strlen(name) - strlen(BUSACT_CONF_EXT));
-        if (!b)
+        p = strdup(path);
+        if (!p)
                 return -ENOMEM;
 
-        *busname = b;
+        g_queue_push_tail(&busactd->load.files, p);
 
         return 0;
 }
 
-static int busactd_parse_config_file(const char *path, void *userdata) {
-
-        struct busactd_listener *listener = busactd_listener_new(busactd);
-        int r;
-
-        ConfigTableItem items[] = {
-                { "BusAct",     "BusName",      config_parse_string,            0,      &listener->busname      },
-                { "BusAct",     "Subscribe",    busactd_config_parse_dbus_signal, 0,    listener                },
-                { NULL,         NULL,           NULL,                           0,      NULL                    }
+static int busactd_write_startup_report(struct busactd *busactd, const char *path) {
+        static const char * const phase_names[_BUSACTD_STARTUP_PHASE_MAX] = {
+                [BUSACTD_STARTUP_BUS_ACQUISITION] = "bus_acquisition",
+                [BUSACTD_STARTUP_DIRECTORY_SCAN]  = "directory_scan",
+                [BUSACTD_STARTUP_FILE_PARSE]      = "file_parse",
+                [BUSACTD_STARTUP_REGISTER]        = "register",
+                [BUSACTD_STARTUP_OWNERSHIP_QUERY] = "ownership_query",
+                [BUSACTD_STARTUP_ADD_MATCH]       = "add_match",
+                [BUSACTD_STARTUP_MATCH_INSTALL]   = "match_install",
         };
 
+        struct busactd_startup *startup = &busactd->startup;
+        _cleanup_fclose_ FILE *f = NULL;
+        unsigned int n_matches = 0;
+        FILE *out = stdout;
+        GList *list;
+        int i;
+
+        assert(busactd);
         assert(path);
 
-        if (!endswith(path, BUSACT_CONF_EXT)) {
-                log_dbg("file '%s' has no '%s' extension.", path, BUSACT_CONF_EXT);
-                return -EINVAL;
+        if (!streq(path, "-")) {
+                f = fopen(path, "we");
+                if (!f)
+                        return -errno;
+                out = f;
         }
 
-        if (!listener)
-                return -ENOMEM;
+        FOREACH_G_LIST(list, busactd->listener_list) {
+                struct busactd_listener *listener = list->data;
 
-        r = config_parse(path, (void *)items);
-        if (r < 0) {
-                log_err("Failed to parse configuration file: %s", strerror(-r));
-                goto on_error;
+                n_matches += g_list_length(listener->match_list);
         }
 
-        if (!listener->busname) {
-                r = busactd_get_busname_from_name(path, &listener->busname);
-                if (r < 0) {
-                        log_err("Failed to get busname from file name: %s", strerror(-r));
-                        goto on_error;
-                }
-        }
+        fprintf(out, "{\n  \"listeners\": %u,\n  \"matches\": %u,\n  \"phases\": {\n",
+                g_list_length(busactd->listener_list), n_matches);
 
-        if (!listener->match_list) {
-                log_dbg("Nothing to subscribe signal: %s", path);
-                goto on_error;
-        }
+        for (i = 0; i < _BUSACTD_STARTUP_PHASE_MAX; i++)
+                fprintf(out, "    \"%s\": { \"usec\": %" G_GINT64_FORMAT ", \"count\": %u },\n",
+                        phase_names[i], startup->usec[i], startup->count[i]);
 
-        busactd_add_listener(listener);
+        fprintf(out, "    \"ready\": { \"usec\": %" G_GINT64_FORMAT ", \"count\": 1 }\n  }\n}\n",
+                startup->ready);
 
         return 0;
-
-on_error:
-        busactd_listener_free(listener);
-        return r;
 }
 
-static gboolean busactd_load_listeners(gpointer user_data) {
-        struct busactd *busactd = user_data;
+static void busactd_scan_config_dirs(struct busactd *busactd) {
+        gint64 start;
         int i;
 
-        assert(user_data);
+        assert(busactd);
 
-        if (!busactd->bus->connection)
-                return G_SOURCE_CONTINUE;
+        start = g_get_monotonic_time();
 
         for (i = 0; i < BUSACTD_LOAD_MAX; i++) {
                 _cleanup_free_ char *dir = NULL;
@@ -245,41 +331,265 @@ static gboolean busactd_load_listeners(gpointer user_data) {
                         continue;
                 }
 
-                (void) config_parse_dir(dir, busactd_parse_config_file, &busactd->listener_list);
+                (void) config_parse_dir(dir, busactd_queue_config_file, busactd);
         }
 
-        log_info("listeners loading finished!!");
+        busactd_startup_account(busactd, BUSACTD_STARTUP_DIRECTORY_SCAN, start);
+        busactd->load.running = true;
+}
 
-        return G_SOURCE_REMOVE;
+static void busactd_load_phase_ready(struct busactd *busactd) {
+        enum busactd_priority phase = busactd->load.n_ready;
+        unsigned int n = 0;
+        GList *list;
+
+        FOREACH_G_LIST(list, busactd->listener_list)
+                if (busactd_listener_get_load_phase(list->data) == phase)
+                        n++;
+
+        busactd->load.n_ready++;
+
+        log_info("Load phase %s ready, %u listeners", busactd_priority_to_string(phase), n);
+
+        if (!busactd->template)
+                (void) sd_notifyf(0, "STATUS=Load phase %s ready (%u/%u)",
+                                  busactd_priority_to_string(phase),
+                                  busactd->load.n_ready, _BUSACTD_PRIORITY_MAX);
+
+        busactd_dbus_load_phase_changed(busactd);
+}
+
+static void busactd_load_register(struct busactd *busactd, struct busactd_listener *listener) {
+        gint64 start;
+
+        start = g_get_monotonic_time();
+        listener = busactd_add_listener(listener);
+        /* the template of several buses never connects */
+        if (busactd->bus->connection)
+                busactd_register_listener(listener);
+        busactd_startup_account(busactd, BUSACTD_STARTUP_REGISTER, start);
+}
+
+/* Does one slice of listener loading. Returns true once everything is
+ * loaded, a budget of 0 or less loads all at once. */
+static bool busactd_load_step(struct busactd *busactd, gint64 budget) {
+        struct busactd_load *load = &busactd->load;
+        gint64 deadline;
+
+        assert(busactd);
+
+        deadline = budget > 0 ? g_get_monotonic_time() + budget : G_MAXINT64;
+
+        /* The phase of a listener is only known from its file. Those of
+         * the first phase are armed as soon as they are parsed, the
+         * later phases wait until every file is parsed and the phases
+         * before them are complete. */
+        while (!g_queue_is_empty(&load->files)) {
+                _cleanup_free_ char *path = g_queue_pop_head(&load->files);
+                struct busactd_listener *listener = NULL;
+                enum busactd_priority phase;
+
+                if (busactd_config_parse_listener(busactd, path, &listener) >= 0 && listener) {
+                        phase = busactd_listener_get_load_phase(listener);
+
+                        if (phase == (enum busactd_priority) load->n_ready)
+                                busactd_load_register(busactd, listener);
+                        else
+                                g_queue_push_tail(&load->pending[phase], listener);
+                }
+
+                if (g_get_monotonic_time() >= deadline)
+                        return false;
+        }
+
+        while (load->n_ready < _BUSACTD_PRIORITY_MAX) {
+                GQueue *pending = &load->pending[load->n_ready];
+                struct busactd_listener *listener;
+
+                listener = g_queue_pop_head(pending);
+                if (!listener) {
+                        busactd_load_phase_ready(busactd);
+                        continue;
+                }
+
+                busactd_load_register(busactd, listener);
+
+                if (g_get_monotonic_time() >= deadline)
+                        return false;
+        }
+
+        load->running = false;
+
+        return true;
+}
+
+static int busactd_clone_listeners(struct busactd *busactd) {
+        GList *list;
+
+        assert(busactd);
+        assert(busactd->template);
+
+        FOREACH_G_LIST(list, busactd->template->listener_list) {
+                struct busactd_listener *listener;
+
+                listener = busactd_listener_clone(list->data, busactd);
+                if (!listener)
+                        return -ENOMEM;
+
+                busactd_register_listener(busactd_add_listener(listener));
+        }
+
+        return 0;
+}
+
+/* Called once the bus installed the match rules of all listeners */
+static void busactd_listeners_installed(struct busactd *busactd) {
+
+        assert(busactd);
+
+        busactd->startup.ready = g_get_monotonic_time() - busactd->startup.start;
+
+        if (arg_startup_report) {
+                if (busactd_write_startup_report(busactd, arg_startup_report) < 0)
+                        log_err("Failed to write startup report to %s", arg_startup_report);
+
+                g_main_loop_quit(busactd->loop);
+        }
 }
 
-static gboolean busactd_idle_timeout_callback(gpointer user_data) {
-        if (g_list_length(busactd->listener_list))
+static gboolean busactd_load_listeners(gpointer user_data) {
+        struct busactd *busactd = user_data;
+        bool done;
+
+        assert(user_data);
+
+        assert(busactd->bus->connection);
+
+        if (busactd->template) {
+                if (busactd_clone_listeners(busactd) < 0)
+                        log_err("Failed to clone listeners for %s", busactd->bus->address);
+                else
+                        log_info("listeners for %s loaded", busactd->bus->address);
+
+                busactd->load.n_ready = _BUSACTD_PRIORITY_MAX;
+                busactd_dbus_load_phase_changed(busactd);
+
+                return G_SOURCE_REMOVE;
+        }
+
+        if (!busactd->load.running)
+                busactd_scan_config_dirs(busactd);
+
+        busactd_lag_enter("listener loading");
+        done = busactd_load_step(busactd, busactd->settings.load_slice_usec);
+        busactd_lag_leave();
+
+        if (!done)
                 return G_SOURCE_CONTINUE;
 
-        log_info("No listeners, mainloop quitting.");
-        g_main_loop_quit(busactd->loop);
+        busactd_idle_update(busactd);
+        busactd_dbus_sync(busactd, busactd_listeners_installed);
+
+        log_info("listeners loading finished!!");
 
         return G_SOURCE_REMOVE;
 }
 
-static GSource *busactd_add_timeout_sec(guint sec,
-                                        GSourceFunc func,
-                                        gpointer data) {
+/* Loading starts once connected, not before */
+static void busactd_start_loading(struct busactd *busactd) {
 
-        GSource *src = g_timeout_source_new_seconds(sec);
+        assert(busactd);
 
-        g_assert(func);
+        g_idle_add(busactd_load_listeners, busactd);
+}
 
-        g_source_set_callback(src, func, data, NULL);
-        g_source_attach(src, NULL);
+static struct busactd *busactd_instance_new(struct busactd *template, const char *address) {
+        struct busactd *b;
+
+        assert(template);
+        assert(address);
+
+        b = new0(struct busactd, 1);
+        if (!b)
+                return NULL;
+
+        b->bus = new0(struct busactd_dbus, 1);
+        if (!b->bus)
+                goto on_error;
 
-        return src;
+        b->bus->address = strdup(address);
+        if (!b->bus->address)
+                goto on_error;
+
+        b->type = template->type;
+        b->template = template;
+        b->settings = template->settings;
+        b->startup.start = template->startup.start;
+        b->connected = busactd_start_loading;
+
+        return b;
+
+on_error:
+        if (b->bus)
+                free(b->bus->address);
+        free(b->bus);
+        free(b);
+
+        return NULL;
+}
+
+/* Multi-bus mode: the configs are parsed once into 'template', which
+ * never connects, and every bus gets clones of its listeners sharing
+ * the parsed rules. Runtime subscriptions, clients and statistics stay
+ * per bus. */
+static int busactd_start_instances(struct busactd *template) {
+        unsigned int i;
+        int r;
+
+        assert(template);
+        assert(arg_addresses);
+
+        busactd_scan_config_dirs(template);
+        (void) busactd_load_step(template, 0);
+
+        if (template->settings.p2p_enabled)
+                log_info("Peer to peer socket is not supported with several buses, ignoring.");
+
+        for (i = 0; i < arg_addresses->len; i++) {
+                struct busactd *b;
+
+                b = busactd_instance_new(template, g_ptr_array_index(arg_addresses, i));
+                if (!b)
+                        return -ENOMEM;
+
+                template->instances = g_list_append(template->instances, b);
+
+                r = busactd_dbus_initialize(b);
+                if (r < 0)
+                        return r;
+        }
+
+        busactd_idle_update(template);
+
+        return 0;
+}
+
+static void busactd_idle_timeout(struct busactd_timer *timer, void *userdata) {
+        struct busactd *busactd = userdata;
+
+        if (!busactd_is_idle(busactd))
+                return;
+
+        log_info("No listeners, mainloop quitting.");
+        g_main_loop_quit(busactd->loop);
 }
 
 int main(int argc, char *argv[]) {
+        GList *list;
         int r;
 
+        busactd->startup.start = g_get_monotonic_time();
+
         log_dbg("Running busact daemon...");
 
         r = parse_argv(argc, argv);
@@ -290,23 +600,72 @@ int main(int argc, char *argv[]) {
         if (r < 0)
                 goto finish;
 
-        r = busactd_dbus_initialize(busactd);
+        r = busactd_load_settings(busactd);
         if (r < 0)
                 goto finish;
 
-        g_idle_add(busactd_load_listeners, busactd);
+        r = busactd_timer_initialize(busactd);
+        if (r < 0)
+                goto finish;
+
+        r = busactd_lag_initialize(busactd);
+        if (r < 0)
+                goto finish;
 
-        busactd->idle_timeout_source = busactd_add_timeout_sec(BUSACTD_TIMEOUT_SEC,
-                                                               busactd_idle_timeout_callback,
-                                                               NULL);
+        busactd_timer_init(&busactd->idle_timer, busactd_idle_timeout, busactd);
+        busactd_idle_update(busactd);
+
+        if (arg_capture) {
+                r = busactd_capture_open(arg_capture);
+                if (r < 0)
+                        goto finish;
+        }
+
+        if (arg_addresses) {
+                r = busactd_start_instances(busactd);
+                if (r < 0)
+                        goto finish;
+        } else {
+                busactd->connected = busactd_start_loading;
+
+                r = busactd_dbus_initialize(busactd);
+                if (r < 0)
+                        goto finish;
+
+                r = busactd_p2p_initialize(busactd);
+                if (r < 0)
+                        goto finish;
+
+                r = busactd_predict_initialize(busactd);
+                if (r < 0)
+                        goto finish;
+
+                r = busactd_shm_initialize(busactd);
+                if (r < 0)
+                        goto finish;
+        }
 
         busactd->loop = g_main_loop_new(NULL, FALSE);
+        FOREACH_G_LIST(list, busactd->instances)
+                ((struct busactd *) list->data)->loop = busactd->loop;
+
         log_dbg("Enter to main loop...");
         g_main_loop_run(busactd->loop);
 
+        FOREACH_G_LIST(list, busactd->instances)
+                busactd_unregister_listeners(((struct busactd *) list->data)->listener_list);
         busactd_unregister_listeners(busactd->listener_list);
+        busactd_load_abort(busactd);
 
 finish:
+        busactd_lag_finalize(busactd);
+        busactd_shm_finalize(busactd);
+        busactd_predict_finalize(busactd);
+        busactd_p2p_finalize(busactd);
+        busactd_timer_release(&busactd->idle_timer);
+        busactd_timer_finalize(busactd);
+        busactd_capture_close();
+
         log_dbg("Stop busact daemon...");
 
         return r < 0 ? EXIT_FAILURE: EXIT_SUCCESS;
@@ -0,0 +1,253 @@
+/*-*- Mode: C; c-basic-offset: 8; indent-tabs-mode: nil -*-*/
+
+/*
+ * busactd
+ *
+ * Copyright (c) 2016 Samsung Electronics Co., Ltd.
+ *
+ * Licensed under the Apache License, Version 2.0 (the License);
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <assert.h>
+#ifdef HAVE_MALLOC_TRIM
+#include <malloc.h>
+#endif
+#include <glib.h>
+#include <gio/gio.h>
+#include <libsystem/libsystem.h>
+#include <libsystem/glib-util.h>
+
+#include "busactd.h"
+#include "memory.h"
+#include "log.h"
+
+/* What GDBus keeps per signal subscription besides the rule string:
+ * its subscriber and signal data, the hash table entries and the
+ * AddMatch string. Rough, it cannot be measured from here. */
+#define BUSACTD_MEMORY_SUBSCRIPTION_COST        384
+
+#define BUSACTD_MEMORY_TRIM_DELAY_USEC          G_USEC_PER_SEC
+#define BUSACTD_MEMORY_TRIM_SLACK_USEC          G_USEC_PER_SEC
+
+static const char * const busactd_memory_category_table[_BUSACTD_MEMORY_CATEGORY_MAX] = {
+        [BUSACTD_MEMORY_LISTENERS]      = "Listeners",
+        [BUSACTD_MEMORY_MATCHES]        = "Matches",
+        [BUSACTD_MEMORY_SUBSCRIPTIONS]  = "Subscriptions",
+        [BUSACTD_MEMORY_QUEUED]         = "Queued",
+        [BUSACTD_MEMORY_CLIENTS]        = "Clients",
+};
+
+const char *busactd_memory_category_to_string(enum busactd_memory_category category) {
+
+        if (category < 0 || category >= _BUSACTD_MEMORY_CATEGORY_MAX)
+                return NULL;
+
+        return busactd_memory_category_table[category];
+}
+
+static gsize busactd_memory_string_size(const char *s) {
+        return s ? strlen(s) + 1 : 0;
+}
+
+static gsize busactd_memory_subscription_size(struct busactd_match *match) {
+
+        if (!match->m_id || !match->rule)
+                return 0;
+
+        return BUSACTD_MEMORY_SUBSCRIPTION_COST + match->rule->size;
+}
+
+/* Rules shared between buses are counted for each */
+gsize busactd_memory_match_size(struct busactd_match *match) {
+        gsize size;
+
+        assert(match);
+
+        size = sizeof(struct busactd_match) + sizeof(GList);
+        size += busactd_memory_string_size(match->client);
+
+        if (match->rule) {
+                size += sizeof(struct busactd_rule) + match->rule->size;
+                if (match->rule->filter)
+                        size += sizeof(struct busactd_filter) + busactd_memory_string_size(match->filter);
+        }
+
+        return size;
+}
+
+static gsize busactd_memory_listener_own_size(struct busactd_listener *listener) {
+        return sizeof(struct busactd_listener) + sizeof(GList) + busactd_memory_string_size(listener->busname);
+}
+
+/* With its matches and subscriptions */
+gsize busactd_memory_listener_size(struct busactd_listener *listener) {
+        gsize size;
+        GList *list;
+
+        assert(listener);
+
+        size = busactd_memory_listener_own_size(listener);
+        if (listener->l_id)
+                size += BUSACTD_MEMORY_SUBSCRIPTION_COST;
+
+        FOREACH_G_LIST(list, listener->match_list) {
+                size += busactd_memory_match_size(list->data);
+                size += busactd_memory_subscription_size(list->data);
+        }
+
+        return size;
+}
+
+static gsize busactd_memory_queue_item_size(struct busactd_queue_item *item) {
+        gsize size;
+
+        size = sizeof(struct busactd_queue_item) + sizeof(GList);
+        size += busactd_memory_string_size(item->sender_name);
+        size += busactd_memory_string_size(item->object_path);
+        size += busactd_memory_string_size(item->interface_name);
+        size += busactd_memory_string_size(item->signal_name);
+        if (item->parameters)
+                size += g_variant_get_size(item->parameters);
+
+        return size;
+}
+
+void busactd_memory_account(struct busactd *busactd, enum busactd_memory_category category, gsize size, int sign) {
+        gsize *bytes;
+
+        assert(busactd);
+        assert(category >= 0 && category < _BUSACTD_MEMORY_CATEGORY_MAX);
+
+        bytes = &busactd->memory.bytes[category];
+
+        if (sign > 0) {
+                *bytes += size;
+                return;
+        }
+
+        /* releasing more than was accounted is a bug in the caller,
+         * the total is kept at 0 rather than wrapping around */
+        if (*bytes < size) {
+                log_err("Memory accounting of %s went below zero: %" G_GSIZE_FORMAT " < %" G_GSIZE_FORMAT,
+                        busactd_memory_category_to_string(category), *bytes, size);
+                *bytes = 0;
+                return;
+        }
+
+        *bytes -= size;
+}
+
+/* The listener alone, its matches are accounted one by one */
+void busactd_memory_account_listener(struct busactd_listener *listener, int sign) {
+
+        assert(listener);
+
+        busactd_memory_account(listener->busactd, BUSACTD_MEMORY_LISTENERS,
+                               busactd_memory_listener_own_size(listener), sign);
+}
+
+void busactd_memory_account_match(struct busactd_match *match, int sign) {
+
+        assert(match);
+        assert(match->listener);
+
+        busactd_memory_account(match->listener->busactd, BUSACTD_MEMORY_MATCHES,
+                               busactd_memory_match_size(match), sign);
+}
+
+/* The subscription of 'match' while it has an m_id, or the
+ * NameOwnerChanged one of 'listener' if 'match' is NULL */
+void busactd_memory_account_subscription(struct busactd_listener *listener, struct busactd_match *match, int sign) {
+
+        assert(listener);
+
+        busactd_memory_account(listener->busactd, BUSACTD_MEMORY_SUBSCRIPTIONS,
+                               match ? busactd_memory_subscription_size(match) : BUSACTD_MEMORY_SUBSCRIPTION_COST,
+                               sign);
+}
+
+void busactd_memory_account_queue_item(struct busactd_queue_item *item, int sign) {
+
+        assert(item);
+        assert(item->listener);
+
+        busactd_memory_account(item->listener->busactd, BUSACTD_MEMORY_QUEUED,
+                               busactd_memory_queue_item_size(item), sign);
+}
+
+void busactd_memory_get(struct busactd *busactd, gsize bytes[_BUSACTD_MEMORY_CATEGORY_MAX]) {
+
+        assert(busactd);
+        assert(bytes);
+
+        memcpy(bytes, busactd->memory.bytes, sizeof(busactd->memory.bytes));
+}
+
+gsize busactd_memory_total(struct busactd *busactd) {
+        gsize total = 0;
+        int i;
+
+        assert(busactd);
+
+        for (i = 0; i < _BUSACTD_MEMORY_CATEGORY_MAX; i++)
+                total += busactd->memory.bytes[i];
+
+        return total;
+}
+
+bool busactd_memory_over_budget(struct busactd *busactd) {
+
+        assert(busactd);
+
+        if (busactd->settings.memory_budget_kib <= 0)
+                return false;
+
+        return busactd_memory_total(busactd) >= (gsize) busactd->settings.memory_budget_kib * 1024;
+}
+
+static void busactd_memory_trim(struct busactd_timer *timer, void *userdata) {
+        struct busactd *busactd = userdata;
+
+        assert(busactd);
+
+        log_dbg("Trimming the heap after releasing %zu bytes", busactd->memory.released);
+
+        busactd->memory.released = 0;
+        busactd->stats.memory_trims++;
+#ifdef HAVE_MALLOC_TRIM
+        (void) malloc_trim(0);
+#endif
+}
+
+void busactd_memory_released(struct busactd *busactd, gsize size) {
+        struct busactd_memory *memory;
+
+        assert(busactd);
+
+        memory = &busactd->memory;
+        memory->released += size;
+
+        if (busactd->settings.memory_trim_threshold_kib <= 0 ||
+            memory->released < (gsize) busactd->settings.memory_trim_threshold_kib * 1024)
+                return;
+
+        if (!memory->trim.func)
+                busactd_timer_init(&memory->trim, busactd_memory_trim, busactd);
+
+        /* a burst of removals is trimmed once, when it is over */
+        busactd_timer_arm(&memory->trim, BUSACTD_MEMORY_TRIM_DELAY_USEC, BUSACTD_MEMORY_TRIM_SLACK_USEC);
+}
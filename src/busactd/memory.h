@@ -0,0 +1,68 @@
+/*-*- Mode: C; c-basic-offset: 8; indent-tabs-mode: nil -*-*/
+
+/*
+ * busactd
+ *
+ * Copyright (c) 2016 Samsung Electronics Co., Ltd.
+ *
+ * Licensed under the Apache License, Version 2.0 (the License);
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#pragma once
+
+#include <stdbool.h>
+#include <glib.h>
+
+#include "timer.h"
+
+struct busactd;
+struct busactd_listener;
+struct busactd_match;
+struct busactd_queue_item;
+
+enum busactd_memory_category {
+        BUSACTD_MEMORY_LISTENERS,
+        BUSACTD_MEMORY_MATCHES,
+        /* signal subscriptions kept by GDBus, estimated */
+        BUSACTD_MEMORY_SUBSCRIPTIONS,
+        BUSACTD_MEMORY_QUEUED,
+        BUSACTD_MEMORY_CLIENTS,
+        _BUSACTD_MEMORY_CATEGORY_MAX,
+};
+
+/* Memory held by the registry of one bus, by category. The totals are
+ * kept up to date where things get added and removed, so reading them
+ * costs nothing. Memory released by removals is summed up and the heap
+ * trimmed after a while once enough came together. */
+struct busactd_memory {
+        gsize bytes[_BUSACTD_MEMORY_CATEGORY_MAX];
+        gsize released;
+        struct busactd_timer trim;
+};
+
+const char *busactd_memory_category_to_string(enum busactd_memory_category category);
+gsize busactd_memory_listener_size(struct busactd_listener *listener);
+gsize busactd_memory_match_size(struct busactd_match *match);
+
+/* Adds (sign > 0) or subtracts what is counted in the totals */
+void busactd_memory_account(struct busactd *busactd, enum busactd_memory_category category, gsize size, int sign);
+void busactd_memory_account_listener(struct busactd_listener *listener, int sign);
+void busactd_memory_account_match(struct busactd_match *match, int sign);
+void busactd_memory_account_subscription(struct busactd_listener *listener, struct busactd_match *match, int sign);
+void busactd_memory_account_queue_item(struct busactd_queue_item *item, int sign);
+
+void busactd_memory_get(struct busactd *busactd, gsize bytes[_BUSACTD_MEMORY_CATEGORY_MAX]);
+gsize busactd_memory_total(struct busactd *busactd);
+bool busactd_memory_over_budget(struct busactd *busactd);
+void busactd_memory_released(struct busactd *busactd, gsize size);
@@ -0,0 +1,284 @@
+/*-*- Mode: C; c-basic-offset: 8; indent-tabs-mode: nil -*-*/
+
+/*
+ * busactd
+ *
+ * Copyright (c) 2016 Samsung Electronics Co., Ltd.
+ *
+ * Licensed under the Apache License, Version 2.0 (the License);
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <assert.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <glib.h>
+#include <gio/gio.h>
+#include <libsystem/libsystem.h>
+#include <libsystem/glib-util.h>
+
+#include "busactd.h"
+#include "p2p.h"
+#include "log.h"
+#include "trace.h"
+
+static bool busactd_p2p_uid_allowed(struct busactd *busactd, uid_t uid) {
+        char **u;
+
+        assert(busactd);
+
+        if (uid == 0 || uid == getuid())
+                return true;
+
+        if (!busactd->settings.p2p_allowed_users)
+                return false;
+
+        for (u = busactd->settings.p2p_allowed_users; *u; u++) {
+                char *end;
+                unsigned long allowed;
+
+                errno = 0;
+                allowed = strtoul(*u, &end, 10);
+                if (errno || end == *u || *end)
+                        continue;
+
+                if ((uid_t) allowed == uid)
+                        return true;
+        }
+
+        return false;
+}
+
+static gboolean busactd_p2p_allow_mechanism(GDBusAuthObserver *observer,
+                                            const gchar *mechanism,
+                                            gpointer user_data) {
+
+        return streq(mechanism, "EXTERNAL");
+}
+
+/* Statistics belong to the main loop, peers are authorized on a worker
+ * thread of the socket service. */
+static gboolean busactd_p2p_count_rejected(gpointer user_data) {
+        struct busactd *busactd = user_data;
+
+        busactd->stats.p2p_peers_rejected++;
+
+        return G_SOURCE_REMOVE;
+}
+
+/* The peer is checked by the credentials the kernel recorded for the
+ * socket (SO_PEERCRED), not by what it claimed during authentication. */
+static gboolean busactd_p2p_authorize_peer(GDBusAuthObserver *observer,
+                                           GIOStream *stream,
+                                           GCredentials *credentials,
+                                           gpointer user_data) {
+
+        struct busactd *busactd = user_data;
+        g_autoptr(GError) error = NULL;
+        g_autoptr(GCredentials) peer = NULL;
+        GSocket *socket;
+        uid_t uid;
+
+        assert(busactd);
+
+        if (!G_IS_SOCKET_CONNECTION(stream))
+                goto on_reject;
+
+        socket = g_socket_connection_get_socket(G_SOCKET_CONNECTION(stream));
+        peer = g_socket_get_credentials(socket, &error);
+        if (!peer) {
+                log_err("Failed to get peer credentials: %s", error->message);
+                goto on_reject;
+        }
+
+        uid = g_credentials_get_unix_user(peer, &error);
+        if (uid == BUSACTD_UID_INVALID) {
+                log_err("Failed to get peer uid: %s", error->message);
+                goto on_reject;
+        }
+
+        if (!busactd_p2p_uid_allowed(busactd, uid)) {
+                log_info("Rejected peer to peer connection of uid %u", uid);
+                goto on_reject;
+        }
+
+        return TRUE;
+
+on_reject:
+        g_main_context_invoke(NULL, busactd_p2p_count_rejected, busactd);
+
+        return FALSE;
+}
+
+static void busactd_p2p_signal_callback(GDBusConnection *connection,
+                                        const gchar *sender_name,
+                                        const gchar *object_path,
+                                        const gchar *interface_name,
+                                        const gchar *signal_name,
+                                        GVariant *parameters,
+                                        gpointer user_data) {
+
+        struct busactd *busactd = user_data;
+
+        assert(busactd);
+
+        busactd->stats.p2p_signals_received++;
+        trace_signal_received("", object_path, interface_name, signal_name);
+        busactd_timer_activity();
+
+        if (!busactd->bus->connection)
+                return;
+
+        busactd_lag_enter("peer signal");
+        if (!busactd_dispatch_signal(busactd, object_path, interface_name, signal_name, parameters))
+                log_dbg("No listener for peer signal: path(%s), interface(%s), signal(%s)",
+                        object_path, interface_name, signal_name);
+        busactd_lag_leave();
+}
+
+static void busactd_p2p_connection_closed(GDBusConnection *connection,
+                                          gboolean remote_peer_vanished,
+                                          GError *error,
+                                          gpointer user_data) {
+
+        struct busactd *busactd = user_data;
+
+        assert(busactd);
+
+        log_dbg("Peer to peer connection closed");
+
+        busactd->p2p->connections = g_list_remove(busactd->p2p->connections, connection);
+        g_object_unref(connection);
+}
+
+static gboolean busactd_p2p_new_connection(GDBusServer *server,
+                                           GDBusConnection *connection,
+                                           gpointer user_data) {
+
+        struct busactd *busactd = user_data;
+
+        assert(busactd);
+
+        busactd->p2p->connections = g_list_prepend(busactd->p2p->connections,
+                                                   g_object_ref(connection));
+
+        /* A peer connection has no bus, sender and destination are
+         * always NULL here. */
+        g_dbus_connection_signal_subscribe(connection,
+                                           NULL, NULL, NULL, NULL, NULL,
+                                           G_DBUS_SIGNAL_FLAGS_NONE,
+                                           busactd_p2p_signal_callback,
+                                           busactd,
+                                           NULL);
+
+        g_signal_connect(connection, "closed", G_CALLBACK(busactd_p2p_connection_closed), busactd);
+
+        return TRUE;
+}
+
+static int busactd_p2p_socket_path(struct busactd *busactd, char **path) {
+        int r;
+
+        assert(busactd);
+        assert(path);
+
+        if (busactd->type == BUSACTD_TYPE_SYSTEM)
+                r = asprintf(path, "%s/%s", BUSACTD_RUNTIME_DIR, BUSACTD_P2P_SOCKET);
+        else
+                r = asprintf(path, "%s/%s/%s", getenv("XDG_RUNTIME_DIR"), BUSACTD, BUSACTD_P2P_SOCKET);
+
+        return r < 0 ? -ENOMEM : 0;
+}
+
+int busactd_p2p_initialize(struct busactd *busactd) {
+        struct busactd_p2p *p2p;
+        _cleanup_free_ char *address = NULL;
+        g_autofree gchar *guid = NULL;
+        g_autoptr(GError) error = NULL;
+        int r;
+
+        assert(busactd);
+
+        if (!busactd->settings.p2p_enabled)
+                return 0;
+
+        p2p = new0(struct busactd_p2p, 1);
+        if (!p2p)
+                return -ENOMEM;
+
+        busactd->p2p = p2p;
+
+        r = busactd_p2p_socket_path(busactd, &p2p->path);
+        if (r < 0)
+                return r;
+
+        if (asprintf(&address, "unix:path=%s", p2p->path) < 0)
+                return -ENOMEM;
+
+        /* left over by a previous instance */
+        (void) unlink(p2p->path);
+
+        p2p->observer = g_dbus_auth_observer_new();
+        g_signal_connect(p2p->observer, "allow-mechanism", G_CALLBACK(busactd_p2p_allow_mechanism), busactd);
+        g_signal_connect(p2p->observer, "authorize-authenticated-peer", G_CALLBACK(busactd_p2p_authorize_peer), busactd);
+
+        guid = g_dbus_generate_guid();
+        p2p->server = g_dbus_server_new_sync(address,
+                                             G_DBUS_SERVER_FLAGS_NONE,
+                                             guid,
+                                             p2p->observer,
+                                             NULL,
+                                             &error);
+        if (!p2p->server) {
+                log_err("Failed to create peer to peer server on %s: %s", p2p->path, error->message);
+                return -EIO;
+        }
+
+        g_signal_connect(p2p->server, "new-connection", G_CALLBACK(busactd_p2p_new_connection), busactd);
+
+        /* Access is decided on the peer credentials, see above. */
+        if (chmod(p2p->path, 0666) < 0)
+                log_err("Failed to change mode of %s: %m", p2p->path);
+
+        g_dbus_server_start(p2p->server);
+
+        log_info("Listening for trigger sources on %s", p2p->path);
+
+        return 0;
+}
+
+void busactd_p2p_finalize(struct busactd *busactd) {
+        struct busactd_p2p *p2p;
+
+        assert(busactd);
+
+        p2p = busactd->p2p;
+        if (!p2p)
+                return;
+
+        if (p2p->server) {
+                g_dbus_server_stop(p2p->server);
+                g_object_unref(p2p->server);
+                (void) unlink(p2p->path);
+        }
+
+        g_list_free_full(p2p->connections, g_object_unref);
+        g_clear_object(&p2p->observer);
+        free(p2p->path);
+        free(p2p);
+
+        busactd->p2p = NULL;
+}
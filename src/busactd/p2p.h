@@ -0,0 +1,42 @@
+/*-*- Mode: C; c-basic-offset: 8; indent-tabs-mode: nil -*-*/
+
+/*
+ * busactd
+ *
+ * Copyright (c) 2016 Samsung Electronics Co., Ltd.
+ *
+ * Licensed under the Apache License, Version 2.0 (the License);
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#pragma once
+
+#include <stdbool.h>
+#include <gio/gio.h>
+
+#define BUSACTD_P2P_SOCKET      "p2p"
+
+struct busactd;
+
+/* Private unix socket which trusted trigger sources may connect to and
+ * emit their signals on directly, instead of broadcasting them on the
+ * bus. */
+struct busactd_p2p {
+        GDBusServer *server;
+        GDBusAuthObserver *observer;
+        char *path;
+        GList *connections;
+};
+
+int busactd_p2p_initialize(struct busactd *busactd);
+void busactd_p2p_finalize(struct busactd *busactd);
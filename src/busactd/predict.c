@@ -0,0 +1,573 @@
+/*-*- Mode: C; c-basic-offset: 8; indent-tabs-mode: nil -*-*/
+
+/*
+ * busactd
+ *
+ * Copyright (c) 2016 Samsung Electronics Co., Ltd.
+ *
+ * Licensed under the Apache License, Version 2.0 (the License);
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <assert.h>
+#include <glib.h>
+#include <gio/gio.h>
+#include <libsystem/libsystem.h>
+#include <libsystem/glib-util.h>
+
+#include "busactd.h"
+#include "predict.h"
+#include "log.h"
+
+/* A trigger following another one within this counts as its successor,
+ * and a pre-started service has as long to get triggered. */
+#define BUSACTD_PREDICT_WINDOW_SEC      60
+/* expiring and saving may wait for some other wakeup */
+#define BUSACTD_PREDICT_SLACK_SEC       30
+
+struct busactd_start_request {
+        struct busactd *busactd;
+        char busname[];
+};
+
+static void busactd_prediction_free(struct busactd_prediction *prediction) {
+        guint i;
+
+        if (!prediction)
+                return;
+
+        for (i = 0; prediction->watches && i < prediction->watches->len; i++)
+                g_dbus_connection_signal_unsubscribe(prediction->connection,
+                                                     g_array_index(prediction->watches, guint, i));
+
+        if (prediction->watches)
+                g_array_free(prediction->watches, TRUE);
+        if (prediction->connection)
+                g_object_unref(prediction->connection);
+        free(prediction->busname);
+        free(prediction);
+}
+
+static void busactd_history_free(struct busactd_history *h) {
+        int i;
+
+        if (!h)
+                return;
+
+        for (i = 0; i < BUSACTD_HISTORY_SUCCESSORS; i++)
+                free(h->next[i].busname);
+        free(h->busname);
+        free(h);
+}
+
+static struct busactd_history *busactd_history_get(struct busactd_predict *predict, const char *busname) {
+        struct busactd_history *h;
+
+        assert(predict);
+        assert(busname);
+
+        h = g_hash_table_lookup(predict->history, busname);
+        if (h)
+                return h;
+
+        h = new0(struct busactd_history, 1);
+        if (!h)
+                return NULL;
+
+        h->busname = strdup(busname);
+        if (!h->busname) {
+                free(h);
+                return NULL;
+        }
+
+        g_hash_table_insert(predict->history, h->busname, h);
+
+        return h;
+}
+
+static int busactd_history_add_successor(struct busactd_history *h, const char *busname, guint32 count) {
+        struct busactd_successor *slot = NULL;
+        int i;
+
+        assert(h);
+        assert(busname);
+
+        h->total += count;
+
+        for (i = 0; i < BUSACTD_HISTORY_SUCCESSORS; i++) {
+                struct busactd_successor *s = &h->next[i];
+
+                if (s->busname && streq(s->busname, busname)) {
+                        s->count += count;
+                        return 0;
+                }
+
+                if (!slot || !s->busname || (slot->busname && s->count < slot->count))
+                        slot = s;
+        }
+
+        /* Full, the least frequent one is replaced and its count
+         * inherited, as the new one may have been missed before. */
+        if (slot->busname) {
+                free(slot->busname);
+                count += slot->count;
+        }
+
+        slot->busname = strdup(busname);
+        if (!slot->busname) {
+                slot->count = 0;
+                return -ENOMEM;
+        }
+        slot->count = count;
+
+        return 0;
+}
+
+static int busactd_history_load(struct busactd_predict *predict) {
+        g_autoptr(GKeyFile) keyfile = NULL;
+        g_autoptr(GError) error = NULL;
+        gchar **groups;
+        gsize n_groups, i;
+
+        assert(predict);
+
+        keyfile = g_key_file_new();
+        if (!g_key_file_load_from_file(keyfile, predict->path, G_KEY_FILE_NONE, &error)) {
+                if (!g_error_matches(error, G_FILE_ERROR, G_FILE_ERROR_NOENT))
+                        log_err("Failed to load %s: %s", predict->path, error->message);
+                return 0;
+        }
+
+        groups = g_key_file_get_groups(keyfile, &n_groups);
+
+        for (i = 0; i < n_groups; i++) {
+                struct busactd_history *h;
+                g_autofree gint *hours = NULL;
+                gchar **next;
+                gsize n, j;
+
+                h = busactd_history_get(predict, groups[i]);
+                if (!h)
+                        break;
+
+                hours = g_key_file_get_integer_list(keyfile, groups[i], "Hours", &n, NULL);
+                for (j = 0; hours && j < n && j < G_N_ELEMENTS(h->hours); j++)
+                        h->hours[j] = MAX(hours[j], 0);
+
+                next = g_key_file_get_string_list(keyfile, groups[i], "Next", &n, NULL);
+                for (j = 0; next && j < n; j++) {
+                        char *colon = strrchr(next[j], ':');
+
+                        if (!colon)
+                                continue;
+
+                        *colon = '\0';
+                        (void) busactd_history_add_successor(h, next[j], strtoul(colon + 1, NULL, 10));
+                }
+                g_strfreev(next);
+        }
+
+        g_strfreev(groups);
+
+        return 0;
+}
+
+static int busactd_history_save(struct busactd_predict *predict) {
+        g_autoptr(GKeyFile) keyfile = NULL;
+        g_autoptr(GError) error = NULL;
+        struct busactd_history *h;
+        GHashTableIter iter;
+
+        assert(predict);
+
+        keyfile = g_key_file_new();
+
+        g_hash_table_iter_init(&iter, predict->history);
+        while (g_hash_table_iter_next(&iter, NULL, (gpointer *) &h)) {
+                g_autoptr(GPtrArray) next = g_ptr_array_new_with_free_func(g_free);
+                gint hours[G_N_ELEMENTS(h->hours)];
+                int i;
+
+                for (i = 0; i < (int) G_N_ELEMENTS(h->hours); i++)
+                        hours[i] = MIN(h->hours[i], (guint32) G_MAXINT);
+                g_key_file_set_integer_list(keyfile, h->busname, "Hours", hours, G_N_ELEMENTS(hours));
+
+                for (i = 0; i < BUSACTD_HISTORY_SUCCESSORS; i++) {
+                        if (!h->next[i].busname)
+                                continue;
+
+                        g_ptr_array_add(next, g_strdup_printf("%s:%u", h->next[i].busname, h->next[i].count));
+                }
+
+                if (next->len)
+                        g_key_file_set_string_list(keyfile, h->busname, "Next",
+                                                   (const gchar * const *) next->pdata, next->len);
+        }
+
+        if (!g_key_file_save_to_file(keyfile, predict->path, &error)) {
+                log_err("Failed to save %s: %s", predict->path, error->message);
+                return -EIO;
+        }
+
+        predict->dirty = false;
+
+        return 0;
+}
+
+static void busactd_predict_expire(struct busactd *busactd, gint64 now) {
+        struct busactd_predict *predict = busactd->predict;
+        struct busactd_prediction *prediction;
+        GHashTableIter iter;
+
+        g_hash_table_iter_init(&iter, predict->pending);
+        while (g_hash_table_iter_next(&iter, NULL, (gpointer *) &prediction)) {
+                if (prediction->deadline > now)
+                        continue;
+
+                busactd->stats.predictions_missed++;
+                g_hash_table_iter_remove(&iter);
+        }
+}
+
+static void busactd_predict_schedule(struct busactd_predict *predict) {
+
+        if (!predict->timer.armed)
+                busactd_timer_arm(&predict->timer,
+                                  BUSACTD_PREDICT_WINDOW_SEC * G_USEC_PER_SEC,
+                                  BUSACTD_PREDICT_SLACK_SEC * G_USEC_PER_SEC);
+}
+
+static void busactd_predict_timer(struct busactd_timer *timer, void *userdata) {
+        struct busactd *busactd = userdata;
+
+        assert(busactd);
+
+        busactd_lag_enter("prediction timer");
+        busactd_predict_expire(busactd, g_get_monotonic_time());
+
+        if (busactd->predict->dirty)
+                (void) busactd_history_save(busactd->predict);
+
+        if (g_hash_table_size(busactd->predict->pending) > 0)
+                busactd_predict_schedule(busactd->predict);
+        busactd_lag_leave();
+}
+
+static void busactd_predict_start_callback(GObject *source,
+                                           GAsyncResult *result,
+                                           gpointer user_data) {
+
+        struct busactd_start_request *request = user_data;
+        g_autoptr(GError) error = NULL;
+        g_autoptr(GVariant) reply = NULL;
+
+        assert(request);
+
+        reply = g_dbus_connection_call_finish(G_DBUS_CONNECTION(source), result, &error);
+        if (!reply) {
+                log_err("Failed to pre-start %s: %s", request->busname, error->message);
+                request->busactd->stats.predictions_failed++;
+                if (request->busactd->predict)
+                        g_hash_table_remove(request->busactd->predict->pending, request->busname);
+        }
+
+        free(request);
+}
+
+/* Whether a budget is left: StartsPerMinute bounds the CPU spent on
+ * speculation, MaxPending the memory held by services started ahead. */
+static bool busactd_predict_budget(struct busactd *busactd, gint64 now) {
+        struct busactd_predict *predict = busactd->predict;
+        struct busactd_settings *settings = &busactd->settings;
+
+        if (now - predict->budget_window >= 60 * G_USEC_PER_SEC) {
+                predict->budget_window = now;
+                predict->budget_starts = 0;
+        }
+
+        if (settings->predict_starts_per_minute > 0 &&
+            predict->budget_starts >= (unsigned int) settings->predict_starts_per_minute)
+                return false;
+
+        if (settings->predict_max_pending > 0 &&
+            g_hash_table_size(predict->pending) >= (unsigned int) settings->predict_max_pending)
+                return false;
+
+        return true;
+}
+
+static void busactd_prediction_hit_callback(GDBusConnection *connection,
+                                            const gchar *sender_name,
+                                            const gchar *object_path,
+                                            const gchar *interface_name,
+                                            const gchar *signal_name,
+                                            GVariant *parameters,
+                                            gpointer user_data) {
+
+        struct busactd_prediction *prediction = user_data;
+        struct busactd *busactd;
+
+        assert(prediction);
+        busactd = prediction->busactd;
+
+        log_dbg("Pre-started %s got triggered", prediction->busname);
+
+        busactd->stats.predictions_hit++;
+        g_hash_table_remove(busactd->predict->pending, prediction->busname);
+}
+
+/* Body filters are not applied, the header of a rule tells a hit. */
+static struct busactd_prediction *busactd_prediction_new(struct busactd_listener *listener, gint64 deadline) {
+        struct busactd_prediction *prediction;
+        GList *list;
+
+        assert(listener);
+
+        prediction = new0(struct busactd_prediction, 1);
+        if (!prediction)
+                return NULL;
+
+        prediction->busactd = listener->busactd;
+        prediction->deadline = deadline;
+        prediction->busname = strdup(listener->busname);
+        prediction->watches = g_array_new(FALSE, FALSE, sizeof(guint));
+        prediction->connection = busactd_listener_get_connection(listener);
+        if (!prediction->busname || !prediction->connection) {
+                busactd_prediction_free(prediction);
+                return NULL;
+        }
+
+        g_object_ref(prediction->connection);
+
+        FOREACH_G_LIST(list, listener->match_list) {
+                struct busactd_match *match = list->data;
+                guint id;
+
+                id = g_dbus_connection_signal_subscribe(prediction->connection,
+                                                        match->sender,
+                                                        match->interface,
+                                                        match->member,
+                                                        match->path,
+                                                        match->arg,
+                                                        G_DBUS_SIGNAL_FLAGS_NONE,
+                                                        busactd_prediction_hit_callback,
+                                                        prediction,
+                                                        NULL);
+                if (id)
+                        g_array_append_val(prediction->watches, id);
+        }
+
+        return prediction;
+}
+
+static void busactd_predict_start(struct busactd *busactd, struct busactd_listener *listener, gint64 now) {
+        struct busactd_predict *predict = busactd->predict;
+        struct busactd_start_request *request;
+        struct busactd_prediction *prediction;
+        const char *busname = listener->busname;
+
+        request = malloc(sizeof(struct busactd_start_request) + strlen(busname) + 1);
+        if (!request)
+                return;
+
+        prediction = busactd_prediction_new(listener, now + BUSACTD_PREDICT_WINDOW_SEC * G_USEC_PER_SEC);
+        if (!prediction) {
+                free(request);
+                return;
+        }
+
+        request->busactd = busactd;
+        strcpy(request->busname, busname);
+
+        g_hash_table_insert(predict->pending, prediction->busname, prediction);
+        busactd_predict_schedule(predict);
+
+        predict->budget_starts++;
+        busactd->stats.predictions_started++;
+
+        log_dbg("Pre-starting %s", busname);
+
+        g_dbus_connection_call(busactd->bus->connection,
+                               "org.freedesktop.DBus",
+                               "/org/freedesktop/DBus",
+                               "org.freedesktop.DBus",
+                               "StartServiceByName",
+                               g_variant_new("(su)", busname, 0),
+                               G_VARIANT_TYPE("(u)"),
+                               G_DBUS_CALL_FLAGS_NONE,
+                               -1,
+                               NULL,
+                               busactd_predict_start_callback,
+                               request);
+}
+
+/* Pre-starts the likely successors of the listener just triggered,
+ * which also used to trigger at this hour of the day. */
+static void busactd_predict_successors(struct busactd *busactd, struct busactd_history *h, unsigned int hour, gint64 now) {
+        struct busactd_predict *predict = busactd->predict;
+        int i;
+
+        if (!h->total)
+                return;
+
+        for (i = 0; i < BUSACTD_HISTORY_SUCCESSORS; i++) {
+                struct busactd_successor *s = &h->next[i];
+                struct busactd_history *sh;
+                struct busactd_listener *listener;
+
+                if (!s->busname)
+                        continue;
+
+                if ((guint64) s->count * 100 < (guint64) busactd->settings.predict_confidence * h->total)
+                        continue;
+
+                sh = g_hash_table_lookup(predict->history, s->busname);
+                if (!sh || !sh->hours[hour])
+                        continue;
+
+                listener = busactd_find_listener(busactd, s->busname);
+                if (!listener || listener->name_has_owner != NAME_HAS_OWNER_FALSE)
+                        continue;
+
+                if (g_hash_table_contains(predict->pending, s->busname))
+                        continue;
+
+                if (!busactd_predict_budget(busactd, now)) {
+                        busactd->stats.predictions_skipped++;
+                        continue;
+                }
+
+                busactd_predict_start(busactd, listener, now);
+        }
+}
+
+void busactd_predict_trigger(struct busactd_listener *listener) {
+        struct busactd *busactd;
+        struct busactd_predict *predict;
+        struct busactd_history *h, *last;
+        g_autoptr(GDateTime) local = NULL;
+        unsigned int hour;
+        gint64 now;
+
+        assert(listener);
+        busactd = listener->busactd;
+        assert(busactd);
+
+        predict = busactd->predict;
+        if (!predict)
+                return;
+
+        now = g_get_monotonic_time();
+
+        if (g_hash_table_remove(predict->pending, listener->busname))
+                busactd->stats.predictions_hit++;
+
+        h = busactd_history_get(predict, listener->busname);
+        if (!h)
+                return;
+
+        local = g_date_time_new_now_local();
+        hour = g_date_time_get_hour(local);
+        h->hours[hour]++;
+
+        if (predict->last_busname &&
+            !streq(predict->last_busname, listener->busname) &&
+            now - predict->last_time < BUSACTD_PREDICT_WINDOW_SEC * G_USEC_PER_SEC) {
+                last = g_hash_table_lookup(predict->history, predict->last_busname);
+                if (last)
+                        (void) busactd_history_add_successor(last, listener->busname, 1);
+        }
+
+        /* h->busname lives as long as the history */
+        predict->last_busname = h->busname;
+        predict->last_time = now;
+        predict->dirty = true;
+        busactd_predict_schedule(predict);
+
+        /* the history is always learnt, pre-starting is opt-in */
+        if (busactd->settings.predict_enabled && busactd->bus->connection)
+                busactd_predict_successors(busactd, h, hour, now);
+}
+
+/* A pre-started service leaving before it got triggered was a miss. */
+void busactd_predict_owner_changed(struct busactd_listener *listener) {
+        struct busactd *busactd;
+
+        assert(listener);
+        busactd = listener->busactd;
+        assert(busactd);
+
+        if (!busactd->predict || listener->name_has_owner != NAME_HAS_OWNER_FALSE)
+                return;
+
+        if (g_hash_table_remove(busactd->predict->pending, listener->busname))
+                busactd->stats.predictions_missed++;
+}
+
+int busactd_predict_initialize(struct busactd *busactd) {
+        struct busactd_predict *predict;
+        int r;
+
+        assert(busactd);
+
+        predict = new0(struct busactd_predict, 1);
+        if (!predict)
+                return -ENOMEM;
+
+        busactd_timer_init(&predict->timer, busactd_predict_timer, busactd);
+        busactd->predict = predict;
+
+        if (busactd->type == BUSACTD_TYPE_SYSTEM)
+                r = asprintf(&predict->path, "%s/%s", BUSACTD_RUNTIME_DIR, BUSACTD_HISTORY_FILE);
+        else
+                r = asprintf(&predict->path, "%s/%s/%s", getenv("XDG_RUNTIME_DIR"), BUSACTD, BUSACTD_HISTORY_FILE);
+        if (r < 0)
+                return -ENOMEM;
+
+        predict->history = g_hash_table_new_full(g_str_hash, g_str_equal, NULL,
+                                                 (GDestroyNotify) busactd_history_free);
+        predict->pending = g_hash_table_new_full(g_str_hash, g_str_equal, NULL,
+                                                 (GDestroyNotify) busactd_prediction_free);
+
+        (void) busactd_history_load(predict);
+
+        return 0;
+}
+
+void busactd_predict_finalize(struct busactd *busactd) {
+        struct busactd_predict *predict;
+
+        assert(busactd);
+
+        predict = busactd->predict;
+        if (!predict)
+                return;
+
+        if (predict->dirty)
+                (void) busactd_history_save(predict);
+
+        busactd_timer_release(&predict->timer);
+
+        if (predict->history)
+                g_hash_table_destroy(predict->history);
+        if (predict->pending)
+                g_hash_table_destroy(predict->pending);
+        free(predict->path);
+        free(predict);
+
+        busactd->predict = NULL;
+}
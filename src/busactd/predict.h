@@ -0,0 +1,83 @@
+/*-*- Mode: C; c-basic-offset: 8; indent-tabs-mode: nil -*-*/
+
+/*
+ * busactd
+ *
+ * Copyright (c) 2016 Samsung Electronics Co., Ltd.
+ *
+ * Licensed under the Apache License, Version 2.0 (the License);
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#pragma once
+
+#include <stdbool.h>
+#include <glib.h>
+#include <gio/gio.h>
+
+#include "timer.h"
+
+#define BUSACTD_HISTORY_FILE            "history"
+#define BUSACTD_HISTORY_SUCCESSORS      4
+
+struct busactd;
+struct busactd_listener;
+
+struct busactd_successor {
+        char *busname;
+        guint32 count;
+};
+
+/* What is known about when a listener triggers: a count per hour of the
+ * day, and the listeners triggered within a short while after it. The
+ * successors are the most frequent ones only, kept with the space-saving
+ * algorithm, 'total' counts all successors seen. */
+struct busactd_history {
+        char *busname;
+        guint32 hours[24];
+        guint32 total;
+        struct busactd_successor next[BUSACTD_HISTORY_SUCCESSORS];
+};
+
+/* A service started ahead, until it got triggered or the deadline.
+ * busactd drops the subscriptions of a listener whose name has an
+ * owner, so its rules are watched here to tell a hit. */
+struct busactd_prediction {
+        struct busactd *busactd;
+        char *busname;
+        gint64 deadline;
+        GDBusConnection *connection;
+        /* subscription ids on 'connection' */
+        GArray *watches;
+};
+
+struct busactd_predict {
+        /* struct busactd_history, keyed by busname */
+        GHashTable *history;
+        char *path;
+        bool dirty;
+        char *last_busname;
+        gint64 last_time;
+        /* pre-started names not triggered yet, busname to
+         * struct busactd_prediction */
+        GHashTable *pending;
+        gint64 budget_window;
+        unsigned int budget_starts;
+        /* armed while something is pending or the history is dirty */
+        struct busactd_timer timer;
+};
+
+int busactd_predict_initialize(struct busactd *busactd);
+void busactd_predict_finalize(struct busactd *busactd);
+void busactd_predict_trigger(struct busactd_listener *listener);
+void busactd_predict_owner_changed(struct busactd_listener *listener);
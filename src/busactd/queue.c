@@ -0,0 +1,292 @@
+/*-*- Mode: C; c-basic-offset: 8; indent-tabs-mode: nil -*-*/
+
+/*
+ * busactd
+ *
+ * Copyright (c) 2016 Samsung Electronics Co., Ltd.
+ *
+ * Licensed under the Apache License, Version 2.0 (the License);
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <assert.h>
+#include <glib.h>
+#include <gio/gio.h>
+#include <libsystem/libsystem.h>
+#include <libsystem/glib-util.h>
+
+#include "busactd.h"
+#include "queue.h"
+#include "log.h"
+
+/* Signals forwarded per dispatch, before giving other sources a turn */
+#define BUSACTD_QUEUE_BATCH     32
+
+static const gint busactd_queue_source_priority[_BUSACTD_PRIORITY_MAX] = {
+        [BUSACTD_PRIORITY_HIGH]         = G_PRIORITY_HIGH,
+        [BUSACTD_PRIORITY_NORMAL]       = G_PRIORITY_DEFAULT,
+        [BUSACTD_PRIORITY_LOW]          = G_PRIORITY_LOW,
+};
+
+void busactd_queue_item_free(struct busactd_queue_item *item) {
+
+        if (!item)
+                return;
+
+        busactd_memory_account_queue_item(item, -1);
+
+        if (item->parameters)
+                g_variant_unref(item->parameters);
+        free(item);
+}
+
+static const char *busactd_queue_item_store(char **p, const char *s) {
+        const char *stored = *p;
+
+        if (!s)
+                return NULL;
+
+        *p = stpcpy(*p, s) + 1;
+
+        return stored;
+}
+
+static struct busactd_queue_item *busactd_queue_item_new(struct busactd_listener *listener,
+                                                         enum busactd_priority priority,
+                                                         const char *sender_name,
+                                                         const char *object_path,
+                                                         const char *interface_name,
+                                                         const char *signal_name,
+                                                         GVariant *parameters) {
+
+        struct busactd_queue_item *item;
+        size_t size = 0;
+        char *p;
+
+        assert(listener);
+
+        size += sender_name ? strlen(sender_name) + 1 : 0;
+        size += object_path ? strlen(object_path) + 1 : 0;
+        size += interface_name ? strlen(interface_name) + 1 : 0;
+        size += signal_name ? strlen(signal_name) + 1 : 0;
+
+        item = malloc(sizeof(struct busactd_queue_item) + size);
+        if (!item)
+                return NULL;
+
+        item->listener = listener;
+        item->priority = priority;
+        item->parameters = parameters ? g_variant_ref(parameters) : NULL;
+        item->queued = g_get_monotonic_time();
+        item->deferred = 0;
+
+        p = item->strings;
+        item->sender_name = busactd_queue_item_store(&p, sender_name);
+        item->object_path = busactd_queue_item_store(&p, object_path);
+        item->interface_name = busactd_queue_item_store(&p, interface_name);
+        item->signal_name = busactd_queue_item_store(&p, signal_name);
+
+        /* counted until freed, queued or held for an activation slot */
+        busactd_memory_account_queue_item(item, 1);
+
+        return item;
+}
+
+/* A class queued below the default priority waits for an idle main
+ * loop. While its oldest signal is older than MaxAgeMSec it is served
+ * at the default priority instead, taking turns with incoming work. */
+static void busactd_queue_age(struct busactd_queue *queue, gint64 now) {
+        struct busactd_queue_item *head;
+        int max_age_msec;
+        bool aged;
+
+        assert(queue);
+
+        if (!queue->source ||
+            busactd_queue_source_priority[queue->priority] <= G_PRIORITY_DEFAULT)
+                return;
+
+        max_age_msec = queue->busactd->settings.queue_max_age_msec;
+        head = g_queue_peek_head(&queue->items);
+        aged = max_age_msec > 0 && head &&
+                now - head->queued >= (gint64) max_age_msec * 1000;
+
+        if (aged == queue->aged)
+                return;
+
+        g_source_set_priority(queue->source,
+                              aged ? G_PRIORITY_DEFAULT : busactd_queue_source_priority[queue->priority]);
+        queue->aged = aged;
+}
+
+/* Accounts 'item' as dispatched, right before it is forwarded */
+void busactd_queue_item_account(struct busactd_queue_item *item) {
+        struct busactd_queue_stats *stats;
+        gint64 latency;
+
+        assert(item);
+        assert(item->listener);
+
+        stats = &item->listener->busactd->stats.queues[item->priority];
+        latency = g_get_monotonic_time() - item->queued;
+
+        stats->dispatched++;
+        stats->latency_usec_sum += latency;
+        if ((guint64) latency > stats->latency_usec_max)
+                stats->latency_usec_max = latency;
+}
+
+void busactd_queue_item_forward(struct busactd_queue_item *item) {
+
+        assert(item);
+
+        (void) busactd_listener_forward_signal(item->listener,
+                                               item->sender_name,
+                                               item->object_path,
+                                               item->interface_name,
+                                               item->signal_name,
+                                               item->parameters);
+}
+
+static gboolean busactd_queue_dispatch(gpointer user_data) {
+        struct busactd_queue *queue = user_data;
+        struct busactd_queue_stats *stats;
+        unsigned int n;
+
+        assert(queue);
+        assert(queue->busactd);
+
+        stats = &queue->busactd->stats.queues[queue->priority];
+
+        busactd_lag_enter("signal forwarding");
+
+        for (n = 0; n < BUSACTD_QUEUE_BATCH; n++) {
+                struct busactd_queue_item *item;
+
+                item = g_queue_pop_head(&queue->items);
+                if (!item)
+                        break;
+
+                stats->depth--;
+
+                /* held back until an activation slot is free, accounted
+                 * once forwarded from there */
+                if (!busactd_activation_admit(item))
+                        continue;
+
+                busactd_queue_item_account(item);
+                busactd_queue_item_forward(item);
+                busactd_queue_item_free(item);
+        }
+
+        busactd_lag_leave();
+
+        if (!g_queue_is_empty(&queue->items)) {
+                busactd_queue_age(queue, g_get_monotonic_time());
+                return G_SOURCE_CONTINUE;
+        }
+
+        queue->source = NULL;
+        queue->aged = false;
+
+        return G_SOURCE_REMOVE;
+}
+
+int busactd_queue_signal(struct busactd_listener *listener,
+                         enum busactd_priority priority,
+                         const char *sender_name,
+                         const char *object_path,
+                         const char *interface_name,
+                         const char *signal_name,
+                         GVariant *parameters) {
+
+        struct busactd *busactd;
+        struct busactd_queue *queue;
+        struct busactd_queue_stats *stats;
+        struct busactd_queue_item *item;
+        int i;
+
+        assert(listener);
+        busactd = listener->busactd;
+        assert(busactd);
+        assert(priority >= 0 && priority < _BUSACTD_PRIORITY_MAX);
+
+        item = busactd_queue_item_new(listener, priority, sender_name, object_path,
+                                      interface_name, signal_name, parameters);
+        if (!item) {
+                log_err("Failed to queue signal for %s", listener->busname);
+                return -ENOMEM;
+        }
+
+        queue = &busactd->queues[priority];
+        stats = &busactd->stats.queues[priority];
+
+        if (busactd->settings.queue_max_depth > 0 &&
+            g_queue_get_length(&queue->items) >= (guint) busactd->settings.queue_max_depth) {
+                busactd_queue_item_free(g_queue_pop_head(&queue->items));
+                stats->depth--;
+                stats->dropped++;
+        }
+
+        g_queue_push_tail(&queue->items, item);
+
+        stats->depth++;
+        if (stats->depth > stats->depth_max)
+                stats->depth_max = stats->depth;
+
+        if (!queue->source) {
+                queue->busactd = busactd;
+                queue->priority = priority;
+                queue->source = g_idle_source_new();
+                g_source_set_priority(queue->source, busactd_queue_source_priority[priority]);
+                g_source_set_callback(queue->source, busactd_queue_dispatch, queue, NULL);
+                g_source_attach(queue->source, NULL);
+                g_source_unref(queue->source);
+        }
+
+        /* incoming work is what keeps the lower classes waiting */
+        for (i = priority; i < _BUSACTD_PRIORITY_MAX; i++)
+                busactd_queue_age(&busactd->queues[i], item->queued);
+
+        return 0;
+}
+
+/* Called before the listener goes away, its pending signals are lost. */
+void busactd_queue_drop_listener(struct busactd *busactd, struct busactd_listener *listener) {
+        int i;
+
+        assert(busactd);
+        assert(listener);
+
+        for (i = 0; i < _BUSACTD_PRIORITY_MAX; i++) {
+                struct busactd_queue *queue = &busactd->queues[i];
+                GList *list, *next;
+
+                for (list = queue->items.head; list; list = next) {
+                        struct busactd_queue_item *item = list->data;
+
+                        next = list->next;
+
+                        if (item->listener != listener)
+                                continue;
+
+                        g_queue_delete_link(&queue->items, list);
+                        busactd_queue_item_free(item);
+                        busactd->stats.queues[i].depth--;
+                }
+        }
+}
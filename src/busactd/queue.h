@@ -0,0 +1,90 @@
+/*-*- Mode: C; c-basic-offset: 8; indent-tabs-mode: nil -*-*/
+
+/*
+ * busactd
+ *
+ * Copyright (c) 2016 Samsung Electronics Co., Ltd.
+ *
+ * Licensed under the Apache License, Version 2.0 (the License);
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#pragma once
+
+#include <stdbool.h>
+#include <glib.h>
+#include <gio/gio.h>
+
+struct busactd;
+struct busactd_listener;
+
+/* Ordered from the most urgent */
+enum busactd_priority {
+        BUSACTD_PRIORITY_HIGH,
+        BUSACTD_PRIORITY_NORMAL,
+        BUSACTD_PRIORITY_LOW,
+        _BUSACTD_PRIORITY_MAX,
+        _BUSACTD_PRIORITY_INVALID = -1,
+};
+
+/* Signals waiting to be forwarded in one priority class. Each class is
+ * drained by its own idle source attached at a matching main loop
+ * priority, so higher classes always run first and the low class only
+ * runs once nothing else is pending. */
+struct busactd_queue {
+        struct busactd *busactd;
+        enum busactd_priority priority;
+        GQueue items;
+        GSource *source;
+        /* 'source' raised to G_PRIORITY_DEFAULT, see [Queue] MaxAgeMSec */
+        bool aged;
+};
+
+/* A signal to forward to one listener */
+struct busactd_queue_item {
+        struct busactd_listener *listener;
+        enum busactd_priority priority;
+        GVariant *parameters;
+        /* when received, and when held back for an activation slot */
+        gint64 queued;
+        gint64 deferred;
+        const char *sender_name;
+        const char *object_path;
+        const char *interface_name;
+        const char *signal_name;
+        /* the strings above are stored here */
+        char strings[];
+};
+
+/* Latencies are from receiving the signal to forwarding it, in usec */
+struct busactd_queue_stats {
+        guint64 depth;
+        guint64 depth_max;
+        guint64 dispatched;
+        /* the oldest dropped beyond [Queue] MaxDepth */
+        guint64 dropped;
+        guint64 latency_usec_sum;
+        guint64 latency_usec_max;
+};
+
+int busactd_queue_signal(struct busactd_listener *listener,
+                         enum busactd_priority priority,
+                         const char *sender_name,
+                         const char *object_path,
+                         const char *interface_name,
+                         const char *signal_name,
+                         GVariant *parameters);
+void busactd_queue_item_forward(struct busactd_queue_item *item);
+void busactd_queue_item_account(struct busactd_queue_item *item);
+void busactd_queue_item_free(struct busactd_queue_item *item);
+void busactd_queue_drop_listener(struct busactd *busactd, struct busactd_listener *listener);
@@ -0,0 +1,234 @@
+/*-*- Mode: C; c-basic-offset: 8; indent-tabs-mode: nil -*-*/
+
+/*
+ * busactd
+ *
+ * Copyright (c) 2016 Samsung Electronics Co., Ltd.
+ *
+ * Licensed under the Apache License, Version 2.0 (the License);
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <assert.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <glib.h>
+#include <libsystem/libsystem.h>
+#include <libsystem/glib-util.h>
+
+#include "busactd.h"
+#include "dbus.h"
+#include "shmstats.h"
+#include "log.h"
+
+#define BUSACTD_SHM_INTERVAL_USEC       G_USEC_PER_SEC
+#define BUSACTD_SHM_SLACK_USEC          (G_USEC_PER_SEC / 2)
+#define BUSACTD_SHM_LISTENERS_MIN       64
+
+static size_t busactd_shm_size(unsigned int capacity) {
+        return sizeof(struct busactd_shm_stats) + capacity * sizeof(struct busactd_shm_listener);
+}
+
+static void busactd_shm_unmap(struct busactd_shm *shm) {
+
+        if (shm->map) {
+                __atomic_store_n(&shm->map->replaced, 1, __ATOMIC_RELEASE);
+                munmap(shm->map, shm->map->size);
+                shm->map = NULL;
+        }
+
+        if (shm->fd >= 0) {
+                close(shm->fd);
+                shm->fd = -1;
+        }
+}
+
+/* Creates the file beside and renames it over the current one, so a
+ * reader never maps a file of the wrong size. */
+static int busactd_shm_create(struct busactd_shm *shm, unsigned int capacity) {
+        _cleanup_free_ char *tmp = NULL;
+        struct busactd_shm_stats *map;
+        size_t size;
+        int fd, r;
+
+        assert(shm);
+
+        if (asprintf(&tmp, "%s.XXXXXX", shm->path) < 0)
+                return -ENOMEM;
+
+        fd = mkostemp(tmp, O_CLOEXEC);
+        if (fd < 0)
+                return -errno;
+
+        size = busactd_shm_size(capacity);
+
+        if (fchmod(fd, 0644) < 0 || ftruncate(fd, size) < 0) {
+                r = -errno;
+                goto on_error;
+        }
+
+        map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (map == MAP_FAILED) {
+                r = -errno;
+                goto on_error;
+        }
+
+        map->magic = BUSACTD_SHM_STATS_MAGIC;
+        map->version = BUSACTD_SHM_STATS_VERSION;
+        map->size = size;
+        map->listener_capacity = capacity;
+
+        if (rename(tmp, shm->path) < 0) {
+                r = -errno;
+                munmap(map, size);
+                goto on_error;
+        }
+
+        busactd_shm_unmap(shm);
+        shm->map = map;
+        shm->fd = fd;
+
+        return 0;
+
+on_error:
+        close(fd);
+        unlink(tmp);
+        return r;
+}
+
+static void busactd_shm_publish(struct busactd *busactd) {
+        struct busactd_shm *shm = busactd->shm;
+        struct busactd_shm_stats *map;
+        const char *name;
+        guint64 value;
+        unsigned int i, n;
+        uint32_t seq;
+        GList *list;
+
+        n = g_list_length(busactd->listener_list);
+        if (n > shm->map->listener_capacity &&
+            busactd_shm_create(shm, MAX(n * 2, BUSACTD_SHM_LISTENERS_MIN)) < 0)
+                log_err("Failed to grow %s, listing %u of %u listeners",
+                        shm->path, shm->map->listener_capacity, n);
+
+        map = shm->map;
+
+        seq = map->seq;
+        __atomic_store_n(&map->seq, seq + 1, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_RELEASE);
+
+        for (i = 0; i < BUSACTD_SHM_COUNTERS_MAX && (name = busactd_dbus_get_statistic(busactd, i, &value)); i++) {
+                strncpy(map->counters[i].name, name, BUSACTD_SHM_NAME_MAX - 1);
+                map->counters[i].value = value;
+        }
+        map->n_counters = i;
+
+        i = 0;
+        FOREACH_G_LIST(list, busactd->listener_list) {
+                struct busactd_listener *listener = list->data;
+                struct busactd_shm_listener *l;
+
+                if (i >= map->listener_capacity)
+                        break;
+
+                l = &map->listeners[i++];
+                strncpy(l->busname, listener->busname, BUSACTD_SHM_BUSNAME_MAX - 1);
+                l->busname[BUSACTD_SHM_BUSNAME_MAX - 1] = '\0';
+                l->signals_forwarded = listener->signals_forwarded;
+                l->signals_forward_failed = listener->signals_forward_failed;
+                l->n_matches = g_list_length(listener->match_list);
+                l->has_owner = listener->name_has_owner == NAME_HAS_OWNER_TRUE;
+        }
+        map->n_listeners = i;
+        map->updated = g_get_real_time();
+
+        __atomic_store_n(&map->seq, seq + 2, __ATOMIC_RELEASE);
+}
+
+static void busactd_shm_timer(struct busactd_timer *timer, void *userdata) {
+        struct busactd *busactd = userdata;
+
+        assert(busactd);
+
+        busactd_lag_enter("statistics publishing");
+        busactd_shm_publish(busactd);
+        busactd_lag_leave();
+}
+
+int busactd_shm_initialize(struct busactd *busactd) {
+        struct busactd_shm *shm;
+        int r;
+
+        assert(busactd);
+
+        if (!busactd->settings.shm_stats_enabled)
+                return 0;
+
+        shm = new0(struct busactd_shm, 1);
+        if (!shm)
+                return -ENOMEM;
+
+        shm->fd = -1;
+        busactd_timer_init(&shm->timer, busactd_shm_timer, busactd);
+        busactd->shm = shm;
+
+        if (busactd->type == BUSACTD_TYPE_SYSTEM)
+                r = asprintf(&shm->path, "%s/%s", BUSACTD_RUNTIME_DIR, BUSACTD_SHM_STATS_FILE);
+        else
+                r = asprintf(&shm->path, "%s/%s/%s", getenv("XDG_RUNTIME_DIR"), BUSACTD, BUSACTD_SHM_STATS_FILE);
+        if (r < 0) {
+                shm->path = NULL;
+                return -ENOMEM;
+        }
+
+        r = busactd_shm_create(shm, BUSACTD_SHM_LISTENERS_MIN);
+        if (r < 0) {
+                /* monitoring only, busactd works without */
+                log_err("Failed to create %s: %s", shm->path, strerror(-r));
+                busactd_shm_finalize(busactd);
+                return 0;
+        }
+
+        busactd_timer_on_activity(&shm->timer, BUSACTD_SHM_INTERVAL_USEC, BUSACTD_SHM_SLACK_USEC);
+        busactd_timer_arm(&shm->timer, BUSACTD_SHM_INTERVAL_USEC, BUSACTD_SHM_SLACK_USEC);
+
+        return 0;
+}
+
+void busactd_shm_finalize(struct busactd *busactd) {
+        struct busactd_shm *shm;
+
+        assert(busactd);
+
+        shm = busactd->shm;
+        if (!shm)
+                return;
+
+        busactd_timer_release(&shm->timer);
+
+        if (shm->map)
+                (void) unlink(shm->path);
+
+        busactd_shm_unmap(shm);
+        free(shm->path);
+        free(shm);
+
+        busactd->shm = NULL;
+}
@@ -0,0 +1,98 @@
+/*-*- Mode: C; c-basic-offset: 8; indent-tabs-mode: nil -*-*/
+
+/*
+ * busactd
+ *
+ * Copyright (c) 2016 Samsung Electronics Co., Ltd.
+ *
+ * Licensed under the Apache License, Version 2.0 (the License);
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "timer.h"
+
+/* Layout of the statistics file busactd publishes in its runtime
+ * directory, meant to be mmap()ed read-only by monitoring tools.
+ *
+ * The writer bumps 'seq' to an odd value before and to the next even
+ * value after updating, a reader copies the region and retries while
+ * 'seq' was odd or changed meanwhile. Counters are named so new ones
+ * can be added without bumping the version. When more listeners have
+ * to fit, a bigger file replaces this one and 'replaced' is set, the
+ * reader has to open the file again. */
+
+#define BUSACTD_SHM_STATS_FILE          "stats"
+#define BUSACTD_SHM_STATS_MAGIC         0x54534142U     /* "BAST" */
+#define BUSACTD_SHM_STATS_VERSION       1
+#define BUSACTD_SHM_COUNTERS_MAX        128
+#define BUSACTD_SHM_NAME_MAX            48
+#define BUSACTD_SHM_BUSNAME_MAX         256
+
+struct busactd_shm_counter {
+        char name[BUSACTD_SHM_NAME_MAX];
+        uint64_t value;
+};
+
+struct busactd_shm_listener {
+        char busname[BUSACTD_SHM_BUSNAME_MAX];
+        uint64_t signals_forwarded;
+        uint64_t signals_forward_failed;
+        uint32_t n_matches;
+        uint32_t has_owner;
+};
+
+struct busactd_shm_stats {
+        uint32_t magic;
+        uint32_t version;
+        uint32_t seq;
+        uint32_t replaced;
+        /* of the whole file */
+        uint64_t size;
+        /* CLOCK_REALTIME of the last update, in usec */
+        int64_t updated;
+        uint32_t n_counters;
+        uint32_t n_listeners;
+        uint32_t listener_capacity;
+        uint32_t reserved;
+        struct busactd_shm_counter counters[BUSACTD_SHM_COUNTERS_MAX];
+        struct busactd_shm_listener listeners[];
+};
+
+static inline uint32_t busactd_shm_read_begin(const struct busactd_shm_stats *s) {
+        return __atomic_load_n(&s->seq, __ATOMIC_ACQUIRE);
+}
+
+/* True if what was read since busactd_shm_read_begin() is consistent */
+static inline bool busactd_shm_read_end(const struct busactd_shm_stats *s, uint32_t seq) {
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        return !(seq & 1) && __atomic_load_n(&s->seq, __ATOMIC_RELAXED) == seq;
+}
+
+struct busactd;
+
+/* Writer side, in busactd */
+struct busactd_shm {
+        char *path;
+        int fd;
+        struct busactd_shm_stats *map;
+        /* armed on activity, nothing changes while the bus is quiet */
+        struct busactd_timer timer;
+};
+
+int busactd_shm_initialize(struct busactd *busactd);
+void busactd_shm_finalize(struct busactd *busactd);
@@ -0,0 +1,283 @@
+/*-*- Mode: C; c-basic-offset: 8; indent-tabs-mode: nil -*-*/
+
+/*
+ * busactd
+ *
+ * Copyright (c) 2016 Samsung Electronics Co., Ltd.
+ *
+ * Licensed under the Apache License, Version 2.0 (the License);
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <assert.h>
+#include <glib.h>
+#include <libsystem/libsystem.h>
+#include <libsystem/glib-util.h>
+
+#include "busactd.h"
+#include "timer.h"
+#include "log.h"
+
+/* Wakeups of the last hour, counted per minute */
+#define BUSACTD_WAKEUP_SLOTS            60
+#define BUSACTD_WAKEUP_SLOT_USEC        ((gint64) 60 * G_USEC_PER_SEC)
+
+struct busactd_timers {
+        struct busactd *busactd;
+        GSource *source;
+        /* struct busactd_timer, armed ones only */
+        GList *armed;
+        /* struct busactd_timer, armed on activity */
+        GList *on_activity;
+        GPollFunc poll;
+        gint64 slot_start[BUSACTD_WAKEUP_SLOTS];
+        guint64 slot_wakeups[BUSACTD_WAKEUP_SLOTS];
+};
+
+/* There is one main loop, however many buses are served */
+static struct busactd_timers *timers;
+
+static void busactd_timer_update(void) {
+        struct busactd_timer *timer;
+        gint64 ready = -1;
+        GList *l;
+
+        if (!timers)
+                return;
+
+        FOREACH_G_LIST(l, timers->armed) {
+                timer = l->data;
+                if (ready < 0 || timer->deadline < ready)
+                        ready = timer->deadline;
+        }
+
+        g_source_set_ready_time(timers->source, ready);
+}
+
+void busactd_timer_init(struct busactd_timer *timer, busactd_timer_func_t func, void *userdata) {
+
+        assert(timer);
+        assert(func);
+
+        *timer = (struct busactd_timer) {
+                .func = func,
+                .userdata = userdata,
+        };
+}
+
+void busactd_timer_arm(struct busactd_timer *timer, gint64 usec, gint64 slack_usec) {
+        gint64 now;
+
+        assert(timer);
+        assert(usec >= 0);
+        assert(slack_usec >= 0);
+
+        if (!timers)
+                return;
+
+        now = g_get_monotonic_time();
+        timer->due = now + usec;
+        timer->deadline = timer->due + slack_usec;
+
+        timer->firing = false;
+        if (!timer->armed) {
+                timers->armed = g_list_prepend(timers->armed, timer);
+                timer->armed = true;
+        }
+
+        busactd_timer_update();
+}
+
+void busactd_timer_disarm(struct busactd_timer *timer) {
+
+        assert(timer);
+
+        timer->firing = false;
+        if (!timer->armed)
+                return;
+
+        timer->armed = false;
+
+        if (!timers)
+                return;
+
+        timers->armed = g_list_remove(timers->armed, timer);
+        busactd_timer_update();
+}
+
+void busactd_timer_on_activity(struct busactd_timer *timer, gint64 usec, gint64 slack_usec) {
+
+        assert(timer);
+
+        if (!timers)
+                return;
+
+        timer->activity_usec = usec;
+        timer->activity_slack_usec = slack_usec;
+
+        if (!g_list_find(timers->on_activity, timer))
+                timers->on_activity = g_list_prepend(timers->on_activity, timer);
+}
+
+void busactd_timer_release(struct busactd_timer *timer) {
+
+        assert(timer);
+
+        busactd_timer_disarm(timer);
+
+        if (timers)
+                timers->on_activity = g_list_remove(timers->on_activity, timer);
+}
+
+void busactd_timer_activity(void) {
+        struct busactd_timer *timer;
+        GList *l;
+
+        if (!timers)
+                return;
+
+        FOREACH_G_LIST(l, timers->on_activity) {
+                timer = l->data;
+                if (!timer->armed)
+                        busactd_timer_arm(timer, timer->activity_usec, timer->activity_slack_usec);
+        }
+}
+
+static gboolean busactd_timer_dispatch(GSource *source, GSourceFunc callback, gpointer user_data) {
+        struct busactd_timer *timer;
+        GList *l, *due = NULL;
+        gint64 now;
+
+        now = g_get_monotonic_time();
+
+        /* everything due by now goes on this wakeup, even if it could
+         * have waited a bit longer */
+        FOREACH_G_LIST(l, timers->armed) {
+                timer = l->data;
+                if (timer->due > now)
+                        continue;
+
+                timer->late = now - timer->due;
+                due = g_list_prepend(due, timer);
+        }
+
+        timers->busactd->stats.timer_wakeups++;
+
+        FOREACH_G_LIST(l, due) {
+                timer = l->data;
+                busactd_timer_disarm(timer);
+                timer->firing = true;
+        }
+
+        /* a callback may re-arm or disarm timers still to be run, which
+         * then do not fire now */
+        while (due) {
+                timer = due->data;
+                due = g_list_delete_link(due, due);
+
+                if (!timer->firing)
+                        continue;
+
+                timer->firing = false;
+                timer->func(timer, timer->userdata);
+        }
+
+        busactd_timer_update();
+
+        return G_SOURCE_CONTINUE;
+}
+
+static GSourceFuncs busactd_timer_source_funcs = {
+        .dispatch = busactd_timer_dispatch,
+};
+
+/* Counts the times the main loop went to sleep and got woken up,
+ * however it was. */
+static gint busactd_timer_poll(GPollFD *ufds, guint nfds, gint timeout) {
+        struct busactd_stats *stats;
+        gint64 now, start;
+        unsigned int i, slot;
+        gint r;
+
+        r = timers->poll(ufds, nfds, timeout);
+        if (timeout == 0)
+                return r;
+
+        stats = &timers->busactd->stats;
+        stats->main_loop_wakeups++;
+
+        now = g_get_monotonic_time();
+        start = now - now % BUSACTD_WAKEUP_SLOT_USEC;
+        slot = (now / BUSACTD_WAKEUP_SLOT_USEC) % BUSACTD_WAKEUP_SLOTS;
+        if (timers->slot_start[slot] != start) {
+                timers->slot_start[slot] = start;
+                timers->slot_wakeups[slot] = 0;
+        }
+        timers->slot_wakeups[slot]++;
+
+        stats->wakeups_last_hour = 0;
+        for (i = 0; i < BUSACTD_WAKEUP_SLOTS; i++)
+                if (now - timers->slot_start[i] < BUSACTD_WAKEUP_SLOTS * BUSACTD_WAKEUP_SLOT_USEC)
+                        stats->wakeups_last_hour += timers->slot_wakeups[i];
+
+        return r;
+}
+
+int busactd_timer_initialize(struct busactd *busactd) {
+
+        assert(busactd);
+        assert(!timers);
+
+        timers = new0(struct busactd_timers, 1);
+        if (!timers)
+                return -ENOMEM;
+
+        timers->busactd = busactd;
+
+        timers->source = g_source_new(&busactd_timer_source_funcs, sizeof(GSource));
+        g_source_set_priority(timers->source, G_PRIORITY_HIGH);
+        g_source_set_ready_time(timers->source, -1);
+        g_source_attach(timers->source, NULL);
+
+        timers->poll = g_main_context_get_poll_func(NULL);
+        g_main_context_set_poll_func(NULL, busactd_timer_poll);
+
+        return 0;
+}
+
+void busactd_timer_finalize(struct busactd *busactd) {
+        struct busactd_timer *timer;
+
+        assert(busactd);
+
+        if (!timers)
+                return;
+
+        while (timers->armed) {
+                timer = timers->armed->data;
+                timer->armed = false;
+                timers->armed = g_list_delete_link(timers->armed, timers->armed);
+        }
+        g_list_free(timers->on_activity);
+
+        g_main_context_set_poll_func(NULL, timers->poll);
+
+        g_source_destroy(timers->source);
+        g_source_unref(timers->source);
+
+        free(timers);
+        timers = NULL;
+}
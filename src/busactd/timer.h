@@ -0,0 +1,64 @@
+/*-*- Mode: C; c-basic-offset: 8; indent-tabs-mode: nil -*-*/
+
+/*
+ * busactd
+ *
+ * Copyright (c) 2016 Samsung Electronics Co., Ltd.
+ *
+ * Licensed under the Apache License, Version 2.0 (the License);
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#pragma once
+
+#include <stdbool.h>
+#include <glib.h>
+
+struct busactd;
+struct busactd_timer;
+
+typedef void (*busactd_timer_func_t)(struct busactd_timer *timer, void *userdata);
+
+/* A one shot timer. All timers of busactd share one main loop source
+ * which is only armed while some timer is. A timer fires between 'due'
+ * and 'due' plus its slack, together with any other timer due by then,
+ * so timers close to each other cost one wakeup. */
+struct busactd_timer {
+        busactd_timer_func_t func;
+        void *userdata;
+        bool armed;
+        /* due on the wakeup being dispatched */
+        bool firing;
+        gint64 due;
+        gint64 deadline;
+        /* how long after 'due' it fired, slack included, set before
+         * 'func' gets called */
+        gint64 late;
+        /* re-armed on external activity, see busactd_timer_activity() */
+        gint64 activity_usec;
+        gint64 activity_slack_usec;
+};
+
+void busactd_timer_init(struct busactd_timer *timer, busactd_timer_func_t func, void *userdata);
+void busactd_timer_arm(struct busactd_timer *timer, gint64 usec, gint64 slack_usec);
+void busactd_timer_disarm(struct busactd_timer *timer);
+
+/* Has 'timer' armed in 'usec' whenever something happened from
+ * outside (a method call, a signal, ...) while it is not armed. */
+void busactd_timer_on_activity(struct busactd_timer *timer, gint64 usec, gint64 slack_usec);
+void busactd_timer_activity(void);
+/* Disarms 'timer' and forgets it, before it gets freed */
+void busactd_timer_release(struct busactd_timer *timer);
+
+int busactd_timer_initialize(struct busactd *busactd);
+void busactd_timer_finalize(struct busactd *busactd);
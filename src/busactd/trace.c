@@ -0,0 +1,41 @@
+/*-*- Mode: C; c-basic-offset: 8; indent-tabs-mode: nil -*-*/
+
+/*
+ * busactd
+ *
+ * Copyright (c) 2016 Samsung Electronics Co., Ltd.
+ *
+ * Licensed under the Apache License, Version 2.0 (the License);
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "trace.h"
+
+#ifdef HAVE_USDT
+
+/* Raised by the tracer while attached to the probe, see trace.h */
+#define TRACE_DEFINE_SEMAPHORE(name) \
+        unsigned short TRACE_SEMAPHORE(name) __attribute__((section(".probes")))
+
+TRACE_DEFINE_SEMAPHORE(signal_received);
+TRACE_DEFINE_SEMAPHORE(match_hit);
+TRACE_DEFINE_SEMAPHORE(emit_start);
+TRACE_DEFINE_SEMAPHORE(emit_end);
+TRACE_DEFINE_SEMAPHORE(owner_changed);
+TRACE_DEFINE_SEMAPHORE(subscribe);
+TRACE_DEFINE_SEMAPHORE(unsubscribe);
+TRACE_DEFINE_SEMAPHORE(config_parsed);
+TRACE_DEFINE_SEMAPHORE(method_call_start);
+TRACE_DEFINE_SEMAPHORE(method_call_end);
+
+#endif
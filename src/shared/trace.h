@@ -0,0 +1,105 @@
+/*-*- Mode: C; c-basic-offset: 8; indent-tabs-mode: nil -*-*/
+
+/*
+ * busactd
+ *
+ * Copyright (c) 2016 Samsung Electronics Co., Ltd.
+ *
+ * Licensed under the Apache License, Version 2.0 (the License);
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#pragma once
+
+/* USDT probes of provider "busactd", built in with --enable-usdt. Each
+ * probe has a semaphore the tracer raises while attached, and its
+ * arguments are only evaluated then, so they must not have side
+ * effects. Otherwise a probe costs a test of its semaphore, and nothing
+ * at all without --enable-usdt. Example:
+ *
+ *   bpftrace -e 'usdt:/usr/lib/busactd/busactd:busactd:emit_end
+ *                { printf("%s %d\n", str(arg0), arg2); }'
+ */
+
+#ifdef HAVE_USDT
+
+#define _SDT_HAS_SEMAPHORES 1
+#include <sys/sdt.h>
+
+/* defined in trace.c, in the .probes section the tracer writes to */
+#define TRACE_SEMAPHORE(name) busactd_##name##_semaphore
+
+extern unsigned short TRACE_SEMAPHORE(signal_received);
+extern unsigned short TRACE_SEMAPHORE(match_hit);
+extern unsigned short TRACE_SEMAPHORE(emit_start);
+extern unsigned short TRACE_SEMAPHORE(emit_end);
+extern unsigned short TRACE_SEMAPHORE(owner_changed);
+extern unsigned short TRACE_SEMAPHORE(subscribe);
+extern unsigned short TRACE_SEMAPHORE(unsubscribe);
+extern unsigned short TRACE_SEMAPHORE(config_parsed);
+extern unsigned short TRACE_SEMAPHORE(method_call_start);
+extern unsigned short TRACE_SEMAPHORE(method_call_end);
+
+/* whether a tracer is attached to probe 'name' */
+#define trace_enabled(name) __builtin_expect(TRACE_SEMAPHORE(name) != 0, 0)
+
+/* a signal reached busactd, from the bus or a peer (sender ""), once
+ * per message and connection */
+#define trace_signal_received(sender, path, interface, member)          \
+        do { if (trace_enabled(signal_received))                        \
+                DTRACE_PROBE4(busactd, signal_received, sender, path, interface, member); } while (0)
+/* the signal matched rule 'id' of listener 'busname' */
+#define trace_match_hit(busname, id)                                    \
+        do { if (trace_enabled(match_hit))                              \
+                DTRACE_PROBE2(busactd, match_hit, busname, id); } while (0)
+#define trace_emit_start(busname, member)                               \
+        do { if (trace_enabled(emit_start))                             \
+                DTRACE_PROBE2(busactd, emit_start, busname, member); } while (0)
+#define trace_emit_end(busname, member, ok)                             \
+        do { if (trace_enabled(emit_end))                               \
+                DTRACE_PROBE3(busactd, emit_end, busname, member, ok); } while (0)
+#define trace_owner_changed(busname, has_owner)                         \
+        do { if (trace_enabled(owner_changed))                          \
+                DTRACE_PROBE2(busactd, owner_changed, busname, has_owner); } while (0)
+#define trace_subscribe(busname, id)                                    \
+        do { if (trace_enabled(subscribe))                              \
+                DTRACE_PROBE2(busactd, subscribe, busname, id); } while (0)
+#define trace_unsubscribe(busname, id)                                  \
+        do { if (trace_enabled(unsubscribe))                            \
+                DTRACE_PROBE2(busactd, unsubscribe, busname, id); } while (0)
+/* 'busname' is NULL if the file did not yield a listener */
+#define trace_config_parsed(path, busname)                              \
+        do { if (trace_enabled(config_parsed))                          \
+                DTRACE_PROBE2(busactd, config_parsed, path, busname); } while (0)
+#define trace_method_call_start(sender, method)                         \
+        do { if (trace_enabled(method_call_start))                      \
+                DTRACE_PROBE2(busactd, method_call_start, sender, method); } while (0)
+#define trace_method_call_end(sender, method)                           \
+        do { if (trace_enabled(method_call_end))                        \
+                DTRACE_PROBE2(busactd, method_call_end, sender, method); } while (0)
+
+#else
+
+#define trace_enabled(name)                                     (0)
+#define trace_signal_received(sender, path, interface, member)  do {} while (0)
+#define trace_match_hit(busname, id)                            do {} while (0)
+#define trace_emit_start(busname, member)                       do {} while (0)
+#define trace_emit_end(busname, member, ok)                     do {} while (0)
+#define trace_owner_changed(busname, has_owner)                 do {} while (0)
+#define trace_subscribe(busname, id)                            do {} while (0)
+#define trace_unsubscribe(busname, id)                          do {} while (0)
+#define trace_config_parsed(path, busname)                      do {} while (0)
+#define trace_method_call_start(sender, method)                 do {} while (0)
+#define trace_method_call_end(sender, method)                   do {} while (0)
+
+#endif
@@ -0,0 +1,264 @@
+/*-*- Mode: C; c-basic-offset: 8; indent-tabs-mode: nil -*-*/
+
+/*
+ * busactd
+ *
+ * Copyright (c) 2016 Samsung Electronics Co., Ltd.
+ *
+ * Licensed under the Apache License, Version 2.0 (the License);
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+/*
+ * Unit test of the signal body filters, compiled and evaluated without
+ * a bus.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <assert.h>
+
+#include <glib.h>
+
+#include <libsystem/libsystem.h>
+
+#include "busactd/busactd.h"
+#include "busactd/filter.h"
+
+static bool eval(const char *expression, GVariant *parameters) {
+        struct busactd_filter *filter = NULL;
+        g_autoptr(GVariant) body = NULL;
+        bool result;
+
+        g_assert_cmpint(busactd_filter_compile(expression, &filter, NULL), ==, 0);
+
+        if (parameters)
+                body = g_variant_ref_sink(parameters);
+
+        result = busactd_filter_eval(filter, body, NULL);
+        busactd_filter_free(filter);
+
+        return result;
+}
+
+/* Expects 'expression' to be rejected for 'reason' at 'column' */
+static void reject(const char *expression, unsigned int column, const char *reason) {
+        struct busactd_parse_error error = {};
+        struct busactd_filter *filter = NULL;
+
+        g_assert_cmpint(busactd_filter_compile(expression, &filter, &error), ==, -EINVAL);
+        g_assert_null(filter);
+        g_assert_cmpstr(error.reason, ==, reason);
+        g_assert_cmpuint(error.column, ==, column);
+}
+
+/* Expects the match rule 'string' to be rejected for 'reason' at
+ * 'column' of the rule */
+static void reject_rule(const char *string, unsigned int column, const char *reason) {
+        struct busactd_parse_error error = {};
+        struct busactd_listener *listener;
+        struct busactd_match *match = NULL;
+
+        listener = busactd_listener_new(NULL);
+        g_assert_nonnull(listener);
+
+        g_assert_cmpint(busactd_match_new_from_string(listener, string, &match, &error), ==, -EINVAL);
+        g_assert_null(match);
+        g_assert_cmpstr(error.reason, ==, reason);
+        g_assert_cmpuint(error.column, ==, column);
+
+        busactd_listener_free(listener);
+}
+
+static char *repeat(const char *term, const char *separator, unsigned int n) {
+        GString *s = g_string_new(NULL);
+        unsigned int i;
+
+        for (i = 0; i < n; i++)
+                g_string_append_printf(s, "%s%s", i ? separator : "", term);
+
+        return g_string_free(s, false);
+}
+
+static void test_precedence(void) {
+
+        /* && binds tighter than || */
+        g_assert_true(eval("arg0 == 1 || arg1 == 1 && arg2 == 1", g_variant_new("(iii)", 1, 0, 0)));
+        g_assert_false(eval("arg0 == 1 || arg1 == 1 && arg2 == 1", g_variant_new("(iii)", 0, 1, 0)));
+        g_assert_false(eval("(arg0 == 1 || arg1 == 1) && arg2 == 1", g_variant_new("(iii)", 1, 0, 0)));
+
+        /* ! applies to the whole comparison */
+        g_assert_false(eval("!arg0 == 1", g_variant_new("(i)", 1)));
+        g_assert_true(eval("!arg0 == 1", g_variant_new("(i)", 2)));
+        g_assert_true(eval("!!arg0", g_variant_new("(b)", true)));
+
+        /* the left operand is the result when the right one is skipped */
+        g_assert_true(eval("arg0 || arg1 == 'x'", g_variant_new("(bs)", true, "y")));
+        g_assert_false(eval("arg0 && arg1 == 'x'", g_variant_new("(bs)", false, "x")));
+}
+
+static void test_range(void) {
+        const char *range = "arg0 in 0..15";
+
+        g_assert_true(eval(range, g_variant_new("(i)", 0)));
+        g_assert_true(eval(range, g_variant_new("(i)", 15)));
+        g_assert_false(eval(range, g_variant_new("(i)", -1)));
+        g_assert_false(eval(range, g_variant_new("(i)", 16)));
+        g_assert_true(eval(range, g_variant_new("(d)", 7.5)));
+        g_assert_false(eval(range, g_variant_new("(s)", "7")));
+
+        g_assert_true(eval("arg0 in -1.5..1.5 && arg1", g_variant_new("(db)", -1.5, true)));
+        g_assert_false(eval("arg0 in -1.5..1.5 && arg1", g_variant_new("(db)", 1.0, false)));
+}
+
+static void test_lookup(void) {
+        GVariantBuilder builder;
+        GVariant *nested;
+
+        g_variant_builder_init(&builder, G_VARIANT_TYPE("a{sv}"));
+        g_variant_builder_add(&builder, "{sv}", "Level", g_variant_new_int32(5));
+        nested = g_variant_new_variant(g_variant_new_string("charging"));
+        g_variant_builder_add(&builder, "{sv}", "State", nested);
+
+        g_assert_true(eval("arg1[\"Level\"] in 0..15 && arg1['State'] == 'charging'",
+                           g_variant_new("(sa{sv})", "battery", &builder)));
+
+        g_variant_builder_init(&builder, G_VARIANT_TYPE("a{sv}"));
+        g_variant_builder_add(&builder, "{sv}", "Level", g_variant_new_int32(50));
+        g_assert_false(eval("arg0['Level'] in 0..15", g_variant_new("(a{sv})", &builder)));
+
+        /* a missing key, child or argument is false, whatever the test */
+        g_variant_builder_init(&builder, G_VARIANT_TYPE("a{sv}"));
+        g_assert_false(eval("arg0['Level'] != 1", g_variant_new("(a{sv})", &builder)));
+        g_assert_false(eval("arg0.2 != 1", g_variant_new("((ii))", 1, 2)));
+        g_assert_false(eval("arg3 != 1", g_variant_new("(i)", 1)));
+        g_assert_false(eval("arg0 != 1", NULL));
+
+        /* struct and array children, through a variant */
+        g_assert_true(eval("arg0.1 == 'b'", g_variant_new("(v)", g_variant_new("(ss)", "a", "b"))));
+        g_assert_true(eval("arg0[1] == 2", g_variant_new("(@ai)", g_variant_new_fixed_array(G_VARIANT_TYPE_INT32,
+                                                                                            (gint32[]) { 1, 2 }, 2, sizeof(gint32)))));
+}
+
+static void test_types(void) {
+
+        /* values of different kinds never compare, not even unequal */
+        g_assert_false(eval("arg0 == 'x'", g_variant_new("(i)", 1)));
+        g_assert_false(eval("arg0 != 'x'", g_variant_new("(i)", 1)));
+        g_assert_false(eval("arg0 == 1", g_variant_new("(b)", true)));
+
+        /* booleans are not ordered */
+        g_assert_false(eval("arg0 < true", g_variant_new("(b)", false)));
+        g_assert_true(eval("arg0 != true", g_variant_new("(b)", false)));
+
+        /* a bare operand is only true if it is the boolean true */
+        g_assert_false(eval("arg0", g_variant_new("(i)", 1)));
+        g_assert_false(eval("arg0", g_variant_new("(s)", "true")));
+
+        /* integers and doubles compare as numbers */
+        g_assert_true(eval("arg0 == 2", g_variant_new("(d)", 2.0)));
+        g_assert_true(eval("arg0 > 0", g_variant_new("(t)", G_MAXUINT64)));
+        g_assert_true(eval("arg0 == 255", g_variant_new("(y)", 255)));
+}
+
+static void test_limits(void) {
+        g_autofree char *left = NULL, *right = NULL;
+        g_autofree char *nested = NULL, *too_nested = NULL;
+        g_autofree char *insns = NULL, *too_many_insns = NULL;
+        g_autofree char *consts = NULL, *too_many_consts = NULL;
+        g_autofree char *paths = NULL, *too_many_paths = NULL;
+        g_autofree char *nots = NULL;
+
+        /* the compiler recurses on parentheses and '!' */
+        left = repeat("(", "", BUSACTD_FILTER_STACK_MAX);
+        right = repeat(")", "", BUSACTD_FILTER_STACK_MAX);
+        nested = g_strdup_printf("%sarg0%s", left, right);
+        g_assert_true(eval(nested, g_variant_new("(b)", true)));
+        too_nested = g_strdup_printf("(%s)", nested);
+        reject(too_nested, BUSACTD_FILTER_STACK_MAX + 1, "filter nested too deeply");
+        nots = repeat("!", "", 10000);
+        reject(nots, BUSACTD_FILTER_STACK_MAX + 1, "filter nested too deeply");
+
+        /* 8 instructions per term, the last one without || */
+        insns = repeat("arg0 in 0..1", " || ", BUSACTD_FILTER_INSNS_MAX / 8);
+        g_assert_true(eval(insns, g_variant_new("(i)", 1)));
+        too_many_insns = repeat("arg0 in 0..1", " || ", BUSACTD_FILTER_INSNS_MAX / 8 + 1);
+        reject(too_many_insns, strlen(insns) + strlen(" || arg0") + 1, "filter too long");
+
+        /* 2 constants per term */
+        consts = repeat("1 == 1", " || ", BUSACTD_FILTER_CONSTS_MAX / 2);
+        g_assert_true(eval(consts, NULL));
+        too_many_consts = repeat("1 == 1", " || ", BUSACTD_FILTER_CONSTS_MAX / 2 + 1);
+        reject(too_many_consts, strlen(consts) + strlen(" || 1") + 1, "too many constants");
+
+        paths = repeat("arg0", " && ", BUSACTD_FILTER_PATHS_MAX);
+        g_assert_true(eval(paths, g_variant_new("(b)", true)));
+        too_many_paths = repeat("arg0", " && ", BUSACTD_FILTER_PATHS_MAX + 1);
+        reject(too_many_paths, strlen(paths) + strlen(" && ") + 1, "too many arguments referenced");
+
+        reject("arg0.0.0.0.0.0.0.0.0 == 1", 1, "argument nested too deeply");
+        g_assert_true(eval("arg0.0.0.0.0.0.0.0 == 1", g_variant_new("((((((((i))))))))", 1)));
+}
+
+static void test_index(void) {
+
+        g_assert_true(eval("arg65535 != 1 || true", NULL));
+
+        /* parsed as a long and range checked, not truncated to arg0 */
+        reject("arg65536 == 1", 4, "index out of range");
+        reject("arg4294967296 == 1", 4, "index out of range");
+        reject("arg99999999999999999999999 == 1", 4, "index out of range");
+        reject("arg0.4294967296 == 1", 6, "index out of range");
+}
+
+static void test_errors(void) {
+
+        reject("", 1, "expected argument or value");
+        reject("arg0 == ", 9, "expected argument or value");
+        reject("arg0 = 1", 6, "unexpected trailing input");
+        reject("arg0 in 0 1", 11, "expected '..'");
+        reject("(arg0 == 1", 11, "expected ')'");
+        reject("arg0 == 'on", 9, "unterminated quote");
+        reject("arg0[on] == 1", 6, "expected quoted key");
+        reject("arg0['on' == 1", 11, "expected ']'");
+        reject("arg0 == 99999999999999999999", 9, "number out of range");
+}
+
+static void test_rule_errors(void) {
+
+        /* filter errors point into the rule as written, not into the
+         * value left after removing quotes and backslashes */
+        reject_rule("type='signal' filter=arg0==1&&", 31, "expected argument or value");
+        reject_rule("type='signal' filter=\"arg0 == \\\"on\\\" && arg1 = 1\"", 46, "unexpected trailing input");
+        reject_rule("type='signal' filter=arg0\\ ==\\ 1\\ &&\\ (", 40, "expected argument or value");
+        reject_rule("filter=\"arg0 in 0 1\" type='signal'", 19, "expected '..'");
+}
+
+int main(int argc, char *argv[]) {
+
+        g_test_init(&argc, &argv, NULL);
+
+        g_test_add_func("/filter/precedence", test_precedence);
+        g_test_add_func("/filter/range", test_range);
+        g_test_add_func("/filter/lookup", test_lookup);
+        g_test_add_func("/filter/types", test_types);
+        g_test_add_func("/filter/limits", test_limits);
+        g_test_add_func("/filter/index", test_index);
+        g_test_add_func("/filter/errors", test_errors);
+        g_test_add_func("/filter/rule-errors", test_rule_errors);
+
+        return g_test_run();
+}
@@ -0,0 +1,65 @@
+#!/bin/sh
+
+# Serves two private session buses from one busactd and checks that both
+# get the preset listeners while runtime subscriptions stay per bus.
+
+busactd=${BUSACTD:-/usr/lib/busactd/busactd}
+name=org.tizen.busactd.test
+runtime=org.tizen.busactd.test.runtime
+pids=
+
+cleanup() {
+    [ -n "$pids" ] && kill $pids 2>/dev/null
+}
+trap cleanup EXIT
+
+start_bus() {
+    dbus-daemon --session --fork --print-address=1 --print-pid=1
+}
+
+list() {
+    dbus-send --bus="$1" --print-reply --dest=org.tizen.busactd \
+        /Org/Tizen/BusActD org.tizen.busactd.ListListenersFiltered \
+        string:"$2" string:"" uint32:0 uint32:0
+}
+
+fail() {
+    echo "FAIL: $*"
+    exit 1
+}
+
+# Waits until every load phase of the bus is armed, the last one is
+# "low".
+wait_loaded() {
+    i=0
+    while [ $i -lt 100 ]; do
+        dbus-send --bus="$1" --print-reply --dest=org.tizen.busactd \
+            /Org/Tizen/BusActD org.freedesktop.DBus.Properties.Get \
+            string:org.tizen.busactd string:LoadedPhases 2>/dev/null \
+            | grep -q '"low"' && return 0
+        sleep 0.1
+        i=$((i + 1))
+    done
+    fail "listeners of $1 not loaded"
+}
+
+set -- $(start_bus) $(start_bus)
+bus1=$1 pid1=$2 bus2=$3 pid2=$4
+pids="$pid1 $pid2"
+
+$busactd --user --address="$bus1" --address="$bus2" &
+pids="$pids $!"
+wait_loaded "$bus1"
+wait_loaded "$bus2"
+
+list "$bus1" "$name" | grep -q "\"$name\"" || fail "no preset listener on the first bus"
+list "$bus2" "$name" | grep -q "\"$name\"" || fail "no preset listener on the second bus"
+
+dbus-send --bus="$bus1" --print-reply --dest=org.tizen.busactd \
+    /Org/Tizen/BusActD org.tizen.busactd.AddSubscriptionWithFlags \
+    string:"$runtime" string:"member='Hello'" uint32:1 >/dev/null || fail "AddSubscription"
+
+list "$bus1" "$runtime" | grep -q "\"$runtime\"" || fail "runtime subscription missing on the first bus"
+list "$bus2" "$runtime" | grep -q "\"$runtime\"" && fail "runtime subscription leaked to the second bus"
+
+echo "PASS"